@@ -0,0 +1,1083 @@
+// Bench.cpp
+
+#include "NM-Bridge.h"
+#include "NM-Handles.h"
+#include "NM-Metrics.h"
+#include "StandInServer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <fstream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <unistd.h>
+
+#include "include/json.hpp"
+using json = nlohmann::json;
+
+// Heap use of the calling thread, for the reply buffer section. The stand-in server runs on
+// threads of its own, so only the client side of a call is counted.
+namespace
+{
+    thread_local uint64_t threadAllocations = 0;
+    thread_local uint64_t threadAllocatedBytes = 0;
+}
+
+// GCC sees these deletes inlined next to the replaced new and, not knowing that new is malloc
+// underneath, warns that free gets a pointer from operator new.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+    ++threadAllocations;
+    threadAllocatedBytes += size;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    ++threadAllocations;
+    threadAllocatedBytes += size;
+    std::size_t alignment = static_cast<std::size_t>(align);
+    if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Client-stack benchmarks against NM_StandInServer.
+//
+//   nm_bench [--quick] [--iterations N] [--seconds S] [--json FILE] [--server-timing] [--capture FILE]
+//
+// Every section prints one row per case; --json also writes them for tracking over time.
+// --capture records the latency section's traffic for nm_replay. A few sections also check
+// behaviour the numbers depend on; any failed check makes the exit code 1.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Settings
+    {
+        int iterations = 20000;
+        double seconds = 2.0;
+        bool serverTiming = false;
+        bool quick = false;
+        std::string jsonPath;
+        std::string capturePath;
+        std::string hostPath;       // nm_standin_host, next to nm_bench
+    };
+
+    const char* Token = "bench-token";
+
+    int failedChecks = 0;
+
+    bool Check(bool ok, const std::string& what)
+    {
+        if (!ok)
+        {
+            ++failedChecks;
+            std::fprintf(stderr, "CHECK FAILED: %s\n", what.c_str());
+        }
+        return ok;
+    }
+
+    std::string Endpoint()
+    {
+        return "nm_bench_" + std::to_string(getpid());
+    }
+
+    uint64_t MicrosBetween(Clock::time_point from, Clock::time_point to)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(to - from).count());
+    }
+
+    std::string Narrow(const std::wstring& ws)
+    {
+        return std::string(ws.begin(), ws.end());
+    }
+
+    json Row(const std::string& name, const NM_Histogram& h, double seconds = 0)
+    {
+        auto s = h.Snapshot();
+        json row = {
+            {"case", name}, {"count", s.count}, {"meanUs", s.meanUs}, {"p50Us", s.p50Us},
+            {"p90Us", s.p90Us}, {"p99Us", s.p99Us}, {"p999Us", s.p999Us}, {"maxUs", s.maxUs}
+        };
+        if (seconds > 0) row["opsPerSec"] = static_cast<double>(s.count) / seconds;
+
+        std::printf("  %-28s %9llu %9.1f %8llu %8llu %8llu %8llu %8llu",
+            name.c_str(), (unsigned long long)s.count, s.meanUs, (unsigned long long)s.p50Us, (unsigned long long)s.p90Us,
+            (unsigned long long)s.p99Us, (unsigned long long)s.p999Us, (unsigned long long)s.maxUs);
+        if (seconds > 0) std::printf(" %10.0f/s", row["opsPerSec"].get<double>());
+        std::printf("\n");
+        return row;
+    }
+
+    void Header(const char* title)
+    {
+        std::printf("\n%s\n  %-28s %9s %9s %8s %8s %8s %8s %8s\n", title, "case", "count", "meanUs", "p50", "p90", "p99", "p99.9", "max");
+    }
+
+    bool Attach(NM_Bridge& bridge, const std::string& endpoint, const NM_Bridge::Options& options, const char* domainId)
+    {
+        std::wstring error;
+        std::string response;
+        if (!bridge.Connect(endpoint, Token, options, error) || (domainId && !bridge.CreateDomain(domainId, response, error)))
+        {
+            std::fprintf(stderr, "attach failed: %s\n", Narrow(error).c_str());
+            return false;
+        }
+        return true;
+    }
+
+
+    // ---------------- Startup ----------------
+
+    // Bringing a server up and attaching to it; on Windows the same path includes CLR start.
+    json BenchStartup(const Settings& settings)
+    {
+        Header("startup");
+        NM_Histogram listen, attach, domain;
+        int rounds = settings.quick ? 10 : 50;
+
+        for (int i = 0; i < rounds; ++i)
+        {
+            std::string endpoint = Endpoint() + "_s" + std::to_string(i);
+            std::wstring error;
+            std::string response;
+
+            auto t0 = Clock::now();
+            NM_StandInServer server;
+            if (!server.Start(endpoint, Token, NM_StandInServer::Options(), error)) break;
+            auto t1 = Clock::now();
+
+            NM_Bridge bridge;
+            if (!bridge.Connect(endpoint, Token, NM_Bridge::Options(), error)) break;
+            auto t2 = Clock::now();
+
+            if (!bridge.CreateDomain("d", response, error)) break;
+            auto t3 = Clock::now();
+
+            listen.Record(MicrosBetween(t0, t1));
+            attach.Record(MicrosBetween(t1, t2));
+            domain.Record(MicrosBetween(t2, t3));
+        }
+
+        return json::array({ Row("server start", listen), Row("connect", attach), Row("first CreateDomain", domain) });
+    }
+
+
+    // ---------------- Round-trip latency ----------------
+
+    json BenchLatency(const Settings& settings, const std::string& endpoint)
+    {
+        Header("round-trip latency");
+        json rows = json::array();
+
+        NM_Bridge::Options options;
+        options.serverTiming = settings.serverTiming;
+        options.capturePath = settings.capturePath;
+        NM_Bridge bridge;
+        if (!Attach(bridge, endpoint, options, "latency")) return rows;
+
+        struct Case { const char* name; const char* method; const char* args; };
+        const Case cases[] = {
+            { "InvokeStatic Echo(int)", "Echo", "[42]" },
+            { "InvokeStatic Echo(string)", "Echo", "[\"hello, bridge\"]" },
+            { "InvokeStatic Sleep(100us)", "Sleep", "[100]" }
+        };
+
+        for (const auto& c : cases)
+        {
+            NM_Histogram h;
+            std::string response;
+            std::wstring error;
+            int n = std::strcmp(c.method, "Sleep") == 0 ? settings.iterations / 10 : settings.iterations;
+
+            for (int i = 0; i < n; ++i)
+            {
+                auto t0 = Clock::now();
+                if (!bridge.InvokeStatic("latency", "Bench", "Bench.Target", c.method, c.args, response, error)) break;
+                h.Record(MicrosBetween(t0, Clock::now()));
+            }
+            rows.push_back(Row(c.name, h));
+        }
+
+        // Where the time goes, from the bridge's own per-phase histograms.
+        std::string metrics;
+        bridge.GetMetrics(metrics);
+        auto phases = json::parse(metrics)["commands"]["invokeStatic"];
+        std::printf("  phases (all cases, p50/p99 us):");
+        for (auto it = phases.begin(); it != phases.end(); ++it)
+        {
+            std::printf(" %s=%llu/%llu", it.key().c_str(), (unsigned long long)it.value()["p50Us"].get<uint64_t>(),
+                (unsigned long long)it.value()["p99Us"].get<uint64_t>());
+        }
+        std::printf("\n");
+        rows.push_back({ {"case", "phases"}, {"phases", phases} });
+        return rows;
+    }
+
+
+    // ---------------- Throughput vs caller threads ----------------
+
+    json BenchThroughput(const Settings& settings, const std::string& endpoint)
+    {
+        Header("throughput vs caller threads (one shared bridge)");
+        json rows = json::array();
+
+        // Pooled connections against a fresh connection for every call.
+        const int poolSizes[] = { 16, 0 };
+        const int threadCounts[] = { 1, 2, 4, 8, 16 };
+        for (int pool : poolSizes)
+        {
+            NM_Bridge::Options options;
+            options.maxIdleConnections = pool;
+            NM_Bridge bridge;
+            std::string domainId = "tp" + std::to_string(pool);
+            if (!Attach(bridge, endpoint, options, domainId.c_str())) return rows;
+
+            for (int threads : threadCounts)
+            {
+                NM_Histogram h;
+                std::atomic<bool> stop{ false };
+                std::vector<std::thread> callers;
+
+                for (int t = 0; t < threads; ++t)
+                {
+                    callers.emplace_back([&] {
+                        std::string response;
+                        std::wstring error;
+                        while (!stop.load(std::memory_order_relaxed))
+                        {
+                            auto t0 = Clock::now();
+                            if (!bridge.InvokeStatic(domainId, "Bench", "Bench.Target", "Echo", "[1]", response, error)) break;
+                            h.Record(MicrosBetween(t0, Clock::now()));
+                        }
+                    });
+                }
+
+                std::this_thread::sleep_for(std::chrono::duration<double>(settings.seconds));
+                stop = true;
+                for (auto& c : callers) c.join();
+
+                json row = Row(std::to_string(threads) + (pool ? " thread(s), pooled" : " thread(s), no pool"), h, settings.seconds);
+                row["threads"] = threads;
+                row["pooled"] = pool > 0;
+                rows.push_back(row);
+            }
+        }
+        return rows;
+    }
+
+
+    // ---------------- Overload ----------------
+
+    // 32 callers against a server with 2 workers and room for 8 queued requests: how many get
+    // "Overloaded", with the client backing off on those replies and without.
+    json BenchOverload(const Settings& settings)
+    {
+        Header("overload (32 callers, 2 workers, queue of 8)");
+        json rows = json::array();
+
+        NM_StandInServer server;
+        NM_StandInServer::Options serverOptions;
+        serverOptions.workers = 2;
+        serverOptions.maxQueueDepth = 8;
+        std::wstring error;
+        std::string endpoint = Endpoint() + "_overload";
+        if (!server.Start(endpoint, Token, serverOptions, error)) return rows;
+
+        const int clientLimits[] = { 64, 0 };
+        for (int limit : clientLimits)
+        {
+            NM_Bridge::Options options;
+            options.clientMaxInFlight = limit;
+            options.maxIdleConnections = 32;
+            NM_Bridge bridge;
+            if (!Attach(bridge, endpoint, options, "overload")) break;
+
+            NM_Histogram h;
+            std::atomic<uint64_t> rejected{ 0 };
+            std::atomic<bool> stop{ false };
+            std::vector<std::thread> callers;
+            for (int t = 0; t < 32; ++t)
+            {
+                callers.emplace_back([&] {
+                    std::string response;
+                    std::wstring error;
+                    while (!stop.load(std::memory_order_relaxed))
+                    {
+                        auto t0 = Clock::now();
+                        if (bridge.InvokeStatic("overload", "Bench", "Bench.Target", "Sleep", "[200]", response, error)) h.Record(MicrosBetween(t0, Clock::now()));
+                        else rejected.fetch_add(1, std::memory_order_relaxed);
+                    }
+                });
+            }
+
+            std::this_thread::sleep_for(std::chrono::duration<double>(settings.seconds));
+            stop = true;
+            for (auto& c : callers) c.join();
+
+            std::string metrics;
+            bridge.GetMetrics(metrics);
+            json pipe = json::parse(metrics)["pipes"][endpoint];
+
+            json row = Row(limit ? "client backs off" : "no client throttle", h, settings.seconds);
+            row["overloaded"] = rejected.load();
+            row["serverPeakQueue"] = pipe["serverPeakQueue"];
+            row["window"] = pipe["window"];
+            std::printf("    overloaded %llu, server peak queue %d, final window %.1f\n", (unsigned long long)rejected.load(),
+                pipe["serverPeakQueue"].get<int>(), pipe["window"].get<double>());
+            rows.push_back(row);
+            bridge.UnloadDomain("overload", metrics, error);
+        }
+        server.Stop();
+        return rows;
+    }
+
+
+    // ---------------- TCP ----------------
+
+    // The same stand-in over a Unix socket and over TCP on 127.0.0.1, with and without Nagle,
+    // and without the connection pool, where every call pays for a TCP connect.
+    json BenchTcp(const Settings& settings, const std::string& unixEndpoint)
+    {
+        Header("transport (Echo of 16 B and 16 KB)");
+        json rows = json::array();
+
+        NM_StandInServer server;
+        std::wstring error;
+        if (!server.Start("tcp://127.0.0.1:0", Token, NM_StandInServer::Options(), error))
+        {
+            std::printf("  skipped: %s\n", Narrow(error).c_str());
+            return rows;
+        }
+
+        struct Case { const char* name; bool tcp; bool noDelay; int idle; };
+        const Case cases[] = {
+            { "unix socket", false, true, 16 },
+            { "tcp, nodelay", true, true, 16 },
+            { "tcp, Nagle", true, false, 16 },
+            { "tcp, no pool", true, true, 0 }
+        };
+        const std::string payloads[] = { json::array({ std::string(16, 'x') }).dump(), json::array({ std::string(16384, 'x') }).dump() };
+
+        for (const auto& c : cases)
+        {
+            NM_Bridge::Options options;
+            options.tcpNoDelay = c.noDelay;
+            options.maxIdleConnections = c.idle;
+            NM_Bridge bridge;
+            if (!Attach(bridge, c.tcp ? server.Endpoint() : unixEndpoint, options, "transport")) break;
+
+            for (const auto& args : payloads)
+            {
+                NM_Histogram h;
+                std::string response;
+                int n = args.size() > 1024 ? settings.iterations / 4 : settings.iterations;
+                for (int i = 0; i < n; ++i)
+                {
+                    auto t0 = Clock::now();
+                    if (!bridge.InvokeStatic("transport", "Bench", "Bench.Target", "Echo", args, response, error)) break;
+                    h.Record(MicrosBetween(t0, Clock::now()));
+                }
+
+                json row = Row(std::string(c.name) + (args.size() > 1024 ? ", 16 KB" : ", 16 B"), h);
+                row["tcp"] = c.tcp;
+                row["noDelay"] = c.noDelay;
+                row["pooled"] = c.idle > 0;
+                rows.push_back(row);
+            }
+            std::string response;
+            bridge.UnloadDomain("transport", response, error);
+        }
+        server.Stop();
+        return rows;
+    }
+
+
+    // ---------------- Host processes ----------------
+
+    // Domains spread over host processes that each serve one request at a time, standing in for
+    // hosts bound by their own cores; then how long a killed host takes to come back.
+    json BenchHosts(const Settings& settings)
+    {
+        Header("host processes (Sleep of 500 us, 8 callers on 8 domains, 1 worker per host)");
+        json rows = json::array();
+        if (access(settings.hostPath.c_str(), X_OK) != 0)
+        {
+            std::printf("  skipped: %s not found\n", settings.hostPath.c_str());
+            return rows;
+        }
+
+        const int hostCounts[] = { 1, 4 };
+        for (int count : hostCounts)
+        {
+            NM_Bridge bridge;
+            std::wstring error;
+            auto t0 = Clock::now();
+            if (!bridge.Launch(settings.hostPath, { "--workers", "1" }, count, NM_Bridge::Options(), error))
+            {
+                std::printf("  launch failed: %s\n", Narrow(error).c_str());
+                return rows;
+            }
+            uint64_t launchUs = MicrosBetween(t0, Clock::now());
+
+            std::string response;
+            for (int d = 0; d < 8; ++d) bridge.CreateDomain("host" + std::to_string(d), response, error);
+
+            NM_Histogram h;
+            std::atomic<bool> stop{ false };
+            std::vector<std::thread> callers;
+            for (int d = 0; d < 8; ++d)
+            {
+                callers.emplace_back([&, d] {
+                    std::string domainId = "host" + std::to_string(d);
+                    std::string reply;
+                    std::wstring err;
+                    while (!stop.load(std::memory_order_relaxed))
+                    {
+                        auto c0 = Clock::now();
+                        if (!bridge.InvokeStatic(domainId, "Bench", "Bench.Target", "Sleep", "[500]", reply, err)) break;
+                        h.Record(MicrosBetween(c0, Clock::now()));
+                    }
+                });
+            }
+
+            std::this_thread::sleep_for(std::chrono::duration<double>(settings.seconds));
+            stop = true;
+            for (auto& c : callers) c.join();
+
+            json row = Row(std::to_string(count) + " host(s)", h, settings.seconds);
+            row["hosts"] = count;
+            row["launchUs"] = launchUs;
+            std::printf("    launch %llu us\n", (unsigned long long)launchUs);
+
+            if (count > 1)
+            {
+                // Kill the host that owns host0 and wait until the domain can be created there again.
+                bridge.GetStats(response, error);
+                // host0 was the first domain created, so it went to the first host.
+                int pid = json::parse(response)["hosts"][0]["pid"];
+
+                auto k0 = Clock::now();
+                kill(pid, SIGKILL);
+                while (!bridge.InvokeStatic("host0", "Bench", "Bench.Target", "Echo", "[1]", response, error) &&
+                       MicrosBetween(k0, Clock::now()) < 10000000)
+                {
+                    bridge.CreateDomain("host0", response, error);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                }
+                uint64_t recoveryUs = MicrosBetween(k0, Clock::now());
+
+                bridge.GetStats(response, error);
+                row["recoveryUs"] = recoveryUs;
+                row["restarts"] = json::parse(response)["hosts"][0]["restarts"];
+                std::printf("    host killed, domain served again after %llu us (restarts %llu)\n",
+                    (unsigned long long)recoveryUs, row["restarts"].get<unsigned long long>());
+            }
+            rows.push_back(row);
+        }
+        return rows;
+    }
+
+
+    // ---------------- Cancellation ----------------
+
+    // How long a caller stays blocked once its deadline passes or it cancels a long call.
+    json BenchCancel(const Settings& settings, const std::string& endpoint)
+    {
+        Header("cancellation (Sleep of 1 s cut short)");
+        json rows = json::array();
+
+        NM_Bridge bridge;
+        if (!Attach(bridge, endpoint, NM_Bridge::Options(), "cancel")) return rows;
+
+        int rounds = settings.quick ? 20 : 100;
+        NM_Histogram deadline, cancel;
+        for (int i = 0; i < rounds; ++i)
+        {
+            std::string response;
+            std::wstring error;
+            auto t0 = Clock::now();
+            bridge.InvokeStatic("cancel", "Bench", "Bench.Target", "Sleep", "[1000000]", response, error, 5);
+            deadline.Record(MicrosBetween(t0, Clock::now()));
+        }
+
+        for (int i = 0; i < rounds; ++i)
+        {
+            uint64_t id = bridge.NewCancelId();
+            Clock::time_point returned;
+            std::thread caller([&] {
+                std::string response;
+                std::wstring error;
+                bridge.InvokeStatic("cancel", "Bench", "Bench.Target", "Sleep", "[1000000]", response, error, 15000, id);
+                returned = Clock::now();
+            });
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            std::string response;
+            std::wstring error;
+            auto t0 = Clock::now();
+            bridge.Cancel("cancel", id, response, error);
+            caller.join();
+            cancel.Record(MicrosBetween(t0, returned));
+        }
+
+        rows.push_back(Row("5 ms deadline, call to return", deadline));
+        rows.push_back(Row("Cancel to caller return", cancel));
+        return rows;
+    }
+
+
+    // ---------------- Events ----------------
+
+    // One thread running handler calls in order, as an example of a custom executor.
+    class QueueExecutor {
+    public:
+        QueueExecutor() : worker([this] { Run(); }) {}
+        ~QueueExecutor()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            ready.notify_one();
+            worker.join();
+        }
+
+        void Post(std::function<void()> task)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push_back(std::move(task));
+            }
+            ready.notify_one();
+        }
+
+    private:
+        void Run()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;)
+            {
+                ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                auto task = std::move(tasks.front());
+                tasks.pop_front();
+                lock.unlock();
+                task();
+                lock.lock();
+            }
+        }
+
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<std::function<void()>> tasks;
+        bool stopping = false;
+        std::thread worker;
+    };
+
+    // From the call that raises an event to its handler running, instead of polling for it;
+    // then a burst of Posts of one name, which reaches the handler as a few coalesced events.
+    json BenchEvents(const Settings& settings, const std::string& endpoint)
+    {
+        Header("events (Raise to handler)");
+        json rows = json::array();
+        int rounds = settings.quick ? 500 : 5000;
+
+        for (int pooled = 0; pooled < 2; ++pooled)
+        {
+            // Declared first so it outlives the bridge that posts to it.
+            QueueExecutor executor;
+            NM_Bridge bridge;
+            const char* domainId = pooled ? "events_executor" : "events_inline";
+            if (!Attach(bridge, endpoint, NM_Bridge::Options(), domainId)) return rows;
+
+            if (pooled) bridge.SetEventExecutor([&executor](std::function<void()> task) { executor.Post(std::move(task)); });
+
+            std::mutex mutex;
+            std::condition_variable arrived;
+            uint64_t seen = 0, coalesced = 0;
+            std::wstring error;
+            std::string response;
+            uint64_t subscription = bridge.Subscribe(domainId, std::string(), [&](const NM_Bridge::Event& e) {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++seen;
+                coalesced += e.coalesced;
+                arrived.notify_one();
+            }, error);
+            if (!subscription)
+            {
+                std::fprintf(stderr, "subscribe failed: %s\n", Narrow(error).c_str());
+                return rows;
+            }
+
+            NM_Histogram h;
+            for (int i = 0; i < rounds; ++i)
+            {
+                uint64_t before;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    before = seen;
+                }
+                auto t0 = Clock::now();
+                bridge.InvokeStatic(domainId, "Bench", "Bench.Target", "Raise", "[\"tick\", 1, false]", response, error);
+
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!arrived.wait_for(lock, std::chrono::seconds(2), [&] { return seen > before; })) break;
+                h.Record(MicrosBetween(t0, Clock::now()));
+            }
+            json row = Row(pooled ? "handler on executor" : "handler inline", h);
+
+            // A burst of Posts: however many get coalesced, the last value always arrives.
+            const int burst = 10000;
+            uint64_t before;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                before = seen;
+                coalesced = 0;
+            }
+            bridge.InvokeStatic(domainId, "Bench", "Bench.Target", "Raise", "[\"state\", " + std::to_string(burst) + ", true]", response, error);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                arrived.wait_for(lock, std::chrono::seconds(2), [&] { return seen - before + coalesced >= static_cast<uint64_t>(burst); });
+                row["burst"] = { {"posted", burst}, {"delivered", seen - before}, {"coalesced", coalesced} };
+                std::printf("    %d Posts delivered as %llu events (%llu coalesced)\n", burst,
+                    (unsigned long long)(seen - before), (unsigned long long)coalesced);
+            }
+            bridge.Unsubscribe(subscription);
+            rows.push_back(row);
+        }
+        return rows;
+    }
+
+
+    // ---------------- Streaming ----------------
+
+    // A large sequence result as one reply against the same read through NM_Cursor: time to the
+    // first row, to the last one, and the largest reply either has to hold.
+    json BenchStreaming(const Settings& settings, const std::string& endpoint)
+    {
+        Header("streaming (Range of 100 B rows)");
+        json rows = json::array();
+
+        NM_Bridge bridge;
+        if (!Attach(bridge, endpoint, NM_Bridge::Options(), nullptr)) return rows;
+
+        std::wstring error;
+        NM_Domain domain;
+        NM_Assembly assembly;
+        if (!NM_Domain::Create(bridge, "stream", domain, error) || !domain.LoadFromFile(L"Bench.dll", "Bench", assembly, error))
+        {
+            std::fprintf(stderr, "streaming setup failed: %s\n", Narrow(error).c_str());
+            return rows;
+        }
+
+        const int64_t count = settings.quick ? 20000 : 200000;
+        const std::string args = "[" + std::to_string(count) + ", 100]";
+        int rounds = settings.quick ? 3 : 10;
+
+        for (int chunk : { 0, 256, 4096 })
+        {
+            NM_Histogram first, all;
+            size_t largest = 0;
+            uint64_t fetches = 0;
+            for (int i = 0; i < rounds; ++i)
+            {
+                auto t0 = Clock::now();
+                int64_t seen = 0;
+                if (chunk == 0)
+                {
+                    std::string response;
+                    if (!assembly.InvokeStatic("Bench.Target", "Range", args, response, error)) break;
+                    json rs = json::parse(response);
+                    first.Record(MicrosBetween(t0, Clock::now()));
+                    seen = static_cast<int64_t>(rs["result"].size());
+                    largest = (std::max)(largest, response.size());
+                }
+                else
+                {
+                    NM_Cursor cursor;
+                    if (!assembly.StreamStatic("Bench.Target", "Range", args, chunk, cursor, error)) break;
+                    // Rows of one chunk, as held in memory at once.
+                    std::string row;
+                    size_t held = 0;
+                    uint64_t fetch = cursor.Fetches();
+                    while (cursor.Next(row, error))
+                    {
+                        if (seen++ == 0) first.Record(MicrosBetween(t0, Clock::now()));
+                        if (cursor.Fetches() != fetch)
+                        {
+                            fetch = cursor.Fetches();
+                            held = 0;
+                        }
+                        held += row.size() + 1;
+                        largest = (std::max)(largest, held);
+                    }
+                    fetches = cursor.Fetches();
+                }
+                all.Record(MicrosBetween(t0, Clock::now()));
+                if (seen != count) std::fprintf(stderr, "streaming: %lld of %lld rows\n", (long long)seen, (long long)count);
+            }
+
+            std::string name = chunk == 0 ? "one reply" : std::to_string(chunk) + " rows per chunk";
+            json row = { {"case", name}, {"firstRow", Row(name + ", first row", first)}, {"lastRow", Row(name + ", last row", all)} };
+            row["largestReplyBytes"] = largest;
+            row["fetches"] = fetches;
+            std::printf("    largest reply %zu KB%s\n", largest >> 10,
+                chunk ? (", " + std::to_string(fetches) + " round-trips").c_str() : "");
+            rows.push_back(row);
+        }
+        return rows;
+    }
+
+
+    // ---------------- Reply buffers ----------------
+
+    // Heap allocations per call on the calling thread with a new string for every reply, one
+    // string kept across calls, one NM_CallBuffers kept across calls, and a lease from an
+    // NM_BufferPool. The last two also reuse the request buffers, so once warm they must not
+    // allocate at all.
+    json BenchBuffers(const Settings& settings, const std::string& endpoint)
+    {
+        Header("reply buffers (Echo of an int, Range of 500 rows of 100 B)");
+        json rows = json::array();
+
+        NM_Bridge bridge;
+        if (!Attach(bridge, endpoint, NM_Bridge::Options(), "buffers")) return rows;
+
+        struct Case { const char* name; const char* method; const char* args; };
+        const Case cases[] = { { "Echo", "Echo", "[42]" }, { "Range", "Range", "[500, 100]" } };
+        const char* const modes[] = { "new string", "reused string", "kept buffers", "pool lease" };
+        int n = settings.quick ? settings.iterations / 2 : settings.iterations;
+
+        NM_BufferPool pool;
+        for (const auto& c : cases)
+        {
+            for (int mode = 0; mode < 4; ++mode)
+            {
+                NM_Histogram h;
+                std::string kept;
+                NM_CallBuffers buffers;
+                std::wstring error;
+                uint64_t calls = 0, allocations = 0, bytes = 0;
+                size_t replyBytes = 0;
+
+                // One call first, so the connection is pooled and the kept buffers have grown.
+                for (int i = -1; i < n; ++i)
+                {
+                    auto t0 = Clock::now();
+                    uint64_t allocationsBefore = threadAllocations, bytesBefore = threadAllocatedBytes;
+                    bool ok;
+                    if (mode == 0)
+                    {
+                        std::string response;
+                        ok = bridge.InvokeStatic("buffers", "Bench", "Bench.Target", c.method, c.args, response, error);
+                        replyBytes = response.size();
+                    }
+                    else if (mode == 1)
+                    {
+                        ok = bridge.InvokeStatic("buffers", "Bench", "Bench.Target", c.method, c.args, kept, error);
+                        replyBytes = kept.size();
+                    }
+                    else if (mode == 2)
+                    {
+                        ok = bridge.InvokeStatic("buffers", "Bench", "Bench.Target", c.method, c.args, buffers, error);
+                        replyBytes = buffers.reply.size();
+                    }
+                    else
+                    {
+                        NM_BufferPool::Lease lease = pool.Acquire();
+                        ok = bridge.InvokeStatic("buffers", "Bench", "Bench.Target", c.method, c.args, lease, error);
+                        replyBytes = lease->size();
+                    }
+                    if (!ok) break;
+                    if (i < 0) continue;
+
+                    allocations += threadAllocations - allocationsBefore;
+                    bytes += threadAllocatedBytes - bytesBefore;
+                    ++calls;
+                    h.Record(MicrosBetween(t0, Clock::now()));
+                }
+                if (calls == 0)
+                {
+                    std::fprintf(stderr, "buffers: %s\n", Narrow(error).c_str());
+                    continue;
+                }
+
+                json row = Row(std::string(c.name) + ", " + modes[mode], h);
+                row["allocationsPerCall"] = static_cast<double>(allocations) / calls;
+                row["bytesPerCall"] = static_cast<double>(bytes) / calls;
+                row["replyBytes"] = replyBytes;
+                std::printf("    %.1f allocations, %.0f B allocated per call, reply of %zu B\n",
+                    row["allocationsPerCall"].get<double>(), row["bytesPerCall"].get<double>(), replyBytes);
+                if (mode >= 2) Check(allocations == 0, std::string(c.name) + ", " + modes[mode] + ": a warm call allocated");
+                rows.push_back(row);
+            }
+        }
+        return rows;
+    }
+
+
+    // ---------------- Instance release ----------------
+
+    // An instance that outlives its domain must not release anything in a domain created again
+    // under the same id: the new domain hands out the same handle values.
+    void StaleRelease(const std::string& endpoint)
+    {
+        NM_Bridge bridge;
+        if (!Attach(bridge, endpoint, NM_Bridge::Options(), nullptr)) return;
+
+        std::wstring error;
+        std::string response;
+        NM_Domain domain;
+        NM_Assembly assembly;
+        NM_Instance stale, live;
+        bool ok = NM_Domain::Create(bridge, "release_stale", domain, error) && domain.LoadFromFile(L"Bench.dll", "Bench", assembly, error) &&
+            assembly.CreateInstance("Bench.Target", "[]", stale, error) && domain.Unload(error) &&
+            NM_Domain::Create(bridge, "release_stale", domain, error) && domain.LoadFromFile(L"Bench.dll", "Bench", assembly, error) &&
+            assembly.CreateInstance("Bench.Target", "[]", live, error) && bridge.GetStats(response, error);
+        if (!Check(ok, "stale release setup: " + Narrow(error))) return;
+        int before = json::parse(response, nullptr, false).value("instances", -1);
+
+        stale.Release();
+        ok = bridge.FlushReleases(error) && live.Invoke("Echo", "[1]", response, error) && bridge.GetStats(response, error);
+        int after = json::parse(response, nullptr, false).value("instances", -1);
+        bridge.GetMetrics(response);
+        uint64_t dropped = json::parse(response)["releases"].value("stale", uint64_t(0));
+
+        std::printf("  stale release after re-create: %llu dropped, %d -> %d instances\n", (unsigned long long)dropped, before, after);
+        Check(ok && dropped == 1 && after == before, "a release queued after its domain was unloaded was sent to the new domain");
+    }
+
+    // Create, call once, drop: ReleaseInstance costs a round-trip per object, NM_Instance queues
+    // the release for the next request or the background flush.
+    json BenchRelease(const Settings& settings, const std::string& endpoint)
+    {
+        Header("instance release (CreateInstance, Invoke, release)");
+        json rows = json::array();
+        int rounds = settings.quick ? 2000 : settings.iterations;
+
+        for (int batched = 0; batched < 2; ++batched)
+        {
+            NM_Bridge bridge;
+            if (!Attach(bridge, endpoint, NM_Bridge::Options(), nullptr)) return rows;
+
+            std::wstring error;
+            std::string response;
+            NM_Domain domain;
+            NM_Assembly assembly;
+            if (!NM_Domain::Create(bridge, batched ? "release_batched" : "release_explicit", domain, error) ||
+                !domain.LoadFromFile(L"Bench.dll", "Bench", assembly, error))
+            {
+                std::fprintf(stderr, "release setup failed: %s\n", Narrow(error).c_str());
+                return rows;
+            }
+
+            NM_Histogram h;
+            auto start = Clock::now();
+            for (int i = 0; i < rounds; ++i)
+            {
+                auto t0 = Clock::now();
+                if (batched)
+                {
+                    NM_Instance instance;
+                    if (!assembly.CreateInstance("Bench.Target", "[]", instance, error)) break;
+                    instance.Invoke("Echo", "[1]", response, error);
+                }
+                else
+                {
+                    NM_Bridge::InstanceHandle handle;
+                    if (!bridge.CreateInstance(domain.Id(), "Bench", "Bench.Target", "[]", handle, response, error)) break;
+                    bridge.InvokeInstance(domain.Id(), "Bench", handle, "Bench.Target", "Echo", "[1]", response, error);
+                    bridge.ReleaseInstance(domain.Id(), handle, response, error);
+                }
+                h.Record(MicrosBetween(t0, Clock::now()));
+            }
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+            bridge.FlushReleases(error);
+            json row = Row(batched ? "NM_Instance (queued)" : "ReleaseInstance each", h, seconds);
+
+            bridge.GetMetrics(response);
+            json releases = json::parse(response)["releases"];
+            bridge.GetStats(response, error);
+            json stats = json::parse(response, nullptr, false);
+            row["releases"] = releases;
+            row["instancesLeft"] = stats.value("instances", 0);
+            std::printf("    %llu carried by requests, %llu in %llu batches, %d instances left\n",
+                releases["carried"].get<unsigned long long>(), releases["flushed"].get<unsigned long long>(),
+                releases["batches"].get<unsigned long long>(), row["instancesLeft"].get<int>());
+            rows.push_back(row);
+        }
+
+        StaleRelease(endpoint);
+        return rows;
+    }
+
+
+    // ---------------- Payload size ----------------
+
+    json BenchPayload(const Settings& settings, const std::string& endpoint)
+    {
+        Header("payload size (Echo of a string argument)");
+        json rows = json::array();
+
+        NM_Bridge bridge;
+        if (!Attach(bridge, endpoint, NM_Bridge::Options(), "payload")) return rows;
+
+        for (size_t size = 16; size <= (settings.quick ? 64 * 1024 : 4 * 1024 * 1024); size *= 4)
+        {
+            std::string args = json::array({ std::string(size, 'x') }).dump();
+            int n = (std::max)(20, static_cast<int>(settings.iterations / (1 + size / 1024)));
+
+            NM_Histogram h;
+            std::string response;
+            std::wstring error;
+            for (int i = 0; i < n; ++i)
+            {
+                auto t0 = Clock::now();
+                if (!bridge.InvokeStatic("payload", "Bench", "Bench.Target", "Echo", args, response, error)) break;
+                h.Record(MicrosBetween(t0, Clock::now()));
+            }
+
+            json row = Row(std::to_string(size) + " B", h);
+            row["bytes"] = size;
+            rows.push_back(row);
+        }
+        return rows;
+    }
+
+
+    // ---------------- LoadFromMemory size ----------------
+
+    json BenchLoadFromMemory(const Settings& settings, const std::string& endpoint)
+    {
+        Header("LoadFromMemory image size");
+        json rows = json::array();
+
+        NM_Bridge bridge;
+        if (!Attach(bridge, endpoint, NM_Bridge::Options(), "load")) return rows;
+
+        for (size_t size = 4 * 1024; size <= (settings.quick ? 256 * 1024 : 16 * 1024 * 1024); size *= 4)
+        {
+            std::vector<uint8_t> image(size);
+            for (size_t i = 0; i < size; ++i) image[i] = static_cast<uint8_t>(i * 131);
+            int n = (std::max)(5, static_cast<int>(settings.iterations / 10 / (1 + size / 65536)));
+
+            NM_Histogram h;
+            std::string response;
+            std::wstring error;
+            for (int i = 0; i < n; ++i)
+            {
+                auto t0 = Clock::now();
+                if (!bridge.LoadFromMemory("load", image, "Bench", response, error)) break;
+                h.Record(MicrosBetween(t0, Clock::now()));
+            }
+
+            json row = Row(std::to_string(size / 1024) + " KB", h);
+            row["bytes"] = size;
+            rows.push_back(row);
+        }
+        return rows;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    Settings settings;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--quick") { settings.quick = true; settings.iterations = 2000; settings.seconds = 0.5; }
+        else if (arg == "--iterations" && i + 1 < argc) settings.iterations = std::atoi(argv[++i]);
+        else if (arg == "--seconds" && i + 1 < argc) settings.seconds = std::atof(argv[++i]);
+        else if (arg == "--json" && i + 1 < argc) settings.jsonPath = argv[++i];
+        else if (arg == "--server-timing") settings.serverTiming = true;
+        else if (arg == "--capture" && i + 1 < argc) settings.capturePath = argv[++i];
+        else
+        {
+            std::fprintf(stderr, "usage: nm_bench [--quick] [--iterations N] [--seconds S] [--json FILE] [--server-timing] [--capture FILE]\n");
+            return 2;
+        }
+    }
+
+    std::string self = argv[0];
+    settings.hostPath = self.substr(0, self.find_last_of('/') + 1) + "nm_standin_host";
+
+    json report;
+    report["startup"] = BenchStartup(settings);
+
+    NM_StandInServer server;
+    NM_StandInServer::Options serverOptions;
+    serverOptions.serverTiming = settings.serverTiming;
+    std::wstring error;
+    std::string endpoint = Endpoint();
+    if (!server.Start(endpoint, Token, serverOptions, error))
+    {
+        std::fprintf(stderr, "stand-in server failed: %s\n", Narrow(error).c_str());
+        return 1;
+    }
+
+    report["latency"] = BenchLatency(settings, endpoint);
+    report["throughput"] = BenchThroughput(settings, endpoint);
+    report["transport"] = BenchTcp(settings, endpoint);
+    report["cancel"] = BenchCancel(settings, endpoint);
+    report["events"] = BenchEvents(settings, endpoint);
+    report["release"] = BenchRelease(settings, endpoint);
+    report["streaming"] = BenchStreaming(settings, endpoint);
+    report["buffers"] = BenchBuffers(settings, endpoint);
+    report["overload"] = BenchOverload(settings);
+    report["hosts"] = BenchHosts(settings);
+    report["payload"] = BenchPayload(settings, endpoint);
+    report["loadFromMemory"] = BenchLoadFromMemory(settings, endpoint);
+    server.Stop();
+
+    if (!settings.jsonPath.empty())
+    {
+        std::ofstream out(settings.jsonPath);
+        out << report.dump(2) << "\n";
+    }
+    return failedChecks == 0 ? 0 : 1;
+}
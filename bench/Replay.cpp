@@ -0,0 +1,245 @@
+// Replay.cpp
+
+#include "NM-Bridge.h"
+#include "NM-Capture.h"
+#include "NM-Metrics.h"
+#include "StandInServer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "include/json.hpp"
+using json = nlohmann::json;
+
+///////////////////////////////////////////////////////////////////////////////
+// Replays a capture written with NM_Bridge::Options::capturePath.
+//
+//   nm_replay CAPTURE [--endpoint NAME --token TOKEN] [--speed X] [--concurrency N] [--json FILE]
+//
+// Without --endpoint the traffic goes to an in-process NM_StandInServer. --speed 1 keeps the
+// recorded pacing, 10 plays it ten times faster, 0 sends as fast as the server answers.
+// Requests are spread over --concurrency bridges by domain, so each domain keeps its order.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    const int MaxOps = 32;
+    const int StopServer = 12;
+    const int CreateInstance = 5;
+
+    const char* OpName(int op)
+    {
+        static const char* names[] = {
+            "?", "createDomain", "unloadDomain", "loadFromFile", "loadFromMemory", "createInstance", "releaseInstance",
+            "invokeStatic", "invokeInstance", "runWpfApp", "stopWpfApp", "getStats", "stopServer", "registerCacheable"
+        };
+        return op > 0 && op < static_cast<int>(sizeof(names) / sizeof(names[0])) ? names[op] : "?";
+    }
+
+    struct Settings
+    {
+        std::string capturePath;
+        std::string endpoint;
+        std::string token = "replay-token";
+        double speed = 1.0;
+        int concurrency = 1;
+        std::string jsonPath;
+    };
+
+    struct Stats
+    {
+        NM_Histogram recorded[MaxOps];
+        NM_Histogram replayed[MaxOps];
+        std::atomic<uint64_t> mismatches[MaxOps] = {}; // succeeded where the capture failed, or the other way round
+        NM_Histogram lag;                       // how late each request went out against its schedule
+    };
+
+    uint64_t MicrosBetween(Clock::time_point from, Clock::time_point to)
+    {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+        return us > 0 ? static_cast<uint64_t>(us) : 0;
+    }
+
+    std::string Narrow(const std::wstring& ws)
+    {
+        return std::string(ws.begin(), ws.end());
+    }
+
+    uint64_t HandleOf(const std::string& message)
+    {
+        json j = json::parse(message, nullptr, false);
+        return j.is_object() ? j.value("instanceHandle", uint64_t(0)) : 0;
+    }
+
+    void Worker(const Settings& settings, const std::vector<const NM_CaptureRecord*>& records, Clock::time_point start, Stats& stats)
+    {
+        NM_Bridge bridge;
+        std::wstring error;
+        if (!bridge.Connect(settings.endpoint, settings.token, NM_Bridge::Options(), error))
+        {
+            std::fprintf(stderr, "connect failed: %s\n", Narrow(error).c_str());
+            return;
+        }
+
+        // Instance handles differ between runs: map the recorded ones to the ones handed out now.
+        std::map<std::pair<std::string, uint64_t>, uint64_t> handles;
+        std::string response;
+
+        for (const NM_CaptureRecord* r : records)
+        {
+            std::string request = r->request;
+            json rq = json::parse(request, nullptr, false);
+            std::string domainId = rq.is_object() ? rq.value("domainId", std::string()) : std::string();
+
+            if (rq.is_object() && rq.contains("instanceHandle"))
+            {
+                auto it = handles.find({ domainId, rq["instanceHandle"].get<uint64_t>() });
+                if (it != handles.end())
+                {
+                    rq["instanceHandle"] = it->second;
+                    request = rq.dump();
+                }
+            }
+
+            if (settings.speed > 0)
+            {
+                auto due = start + std::chrono::microseconds(static_cast<int64_t>(r->offsetUs / settings.speed));
+                std::this_thread::sleep_until(due);
+                stats.lag.Record(MicrosBetween(due, Clock::now()));
+            }
+
+            auto t0 = Clock::now();
+            bool ok = bridge.Replay(r->op, request, response, error);
+            uint64_t us = MicrosBetween(t0, Clock::now());
+
+            int op = r->op < MaxOps ? r->op : 0;
+            stats.recorded[op].Record(r->durationUs);
+            stats.replayed[op].Record(us);
+            if (ok != ((r->flags & NM_CaptureRecord::Ok) != 0)) stats.mismatches[op].fetch_add(1, std::memory_order_relaxed);
+
+            if (ok && r->op == CreateInstance)
+            {
+                handles[{ domainId, HandleOf(r->response) }] = HandleOf(response);
+            }
+        }
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    Settings settings;
+    bool usage = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--endpoint" && i + 1 < argc) settings.endpoint = argv[++i];
+        else if (arg == "--token" && i + 1 < argc) settings.token = argv[++i];
+        else if (arg == "--speed" && i + 1 < argc) settings.speed = std::atof(argv[++i]);
+        else if (arg == "--concurrency" && i + 1 < argc) settings.concurrency = (std::max)(1, std::atoi(argv[++i]));
+        else if (arg == "--json" && i + 1 < argc) settings.jsonPath = argv[++i];
+        else if (settings.capturePath.empty() && arg[0] != '-') settings.capturePath = arg;
+        else usage = true;
+    }
+
+    if (usage || settings.capturePath.empty())
+    {
+        std::fprintf(stderr, "usage: nm_replay CAPTURE [--endpoint NAME --token TOKEN] [--speed X] [--concurrency N] [--json FILE]\n");
+        return 2;
+    }
+
+    NM_CaptureReader reader;
+    std::wstring error;
+    if (!reader.Open(settings.capturePath, error))
+    {
+        std::fprintf(stderr, "%s: %s\n", settings.capturePath.c_str(), Narrow(error).c_str());
+        return 1;
+    }
+
+    std::vector<NM_CaptureRecord> records;
+    NM_CaptureRecord record;
+    while (reader.Next(record))
+    {
+        if (record.op != StopServer) records.push_back(record);
+    }
+
+    // Same domain, same worker: a domain's requests stay in recorded order.
+    std::vector<std::vector<const NM_CaptureRecord*>> partitions(settings.concurrency);
+    for (const auto& r : records)
+    {
+        json rq = json::parse(r.request, nullptr, false);
+        std::string domainId = rq.is_object() ? rq.value("domainId", std::string()) : std::string();
+        partitions[std::hash<std::string>()(domainId) % partitions.size()].push_back(&r);
+    }
+
+    NM_StandInServer server;
+    if (settings.endpoint.empty())
+    {
+        settings.endpoint = "nm_replay_" + std::to_string(getpid());
+        if (!server.Start(settings.endpoint, settings.token, NM_StandInServer::Options(), error))
+        {
+            std::fprintf(stderr, "stand-in server failed: %s\n", Narrow(error).c_str());
+            return 1;
+        }
+    }
+
+    Stats stats;
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (const auto& p : partitions)
+    {
+        workers.emplace_back(Worker, std::cref(settings), std::cref(p), start, std::ref(stats));
+    }
+    for (auto& w : workers) w.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    server.Stop();
+
+    uint64_t recordedUs = records.empty() ? 0 : records.back().offsetUs;
+    std::printf("%zu requests in %.3f s (recorded span %.3f s), %.0f req/s, %d worker(s)\n",
+        records.size(), seconds, recordedUs / 1e6, records.size() / (seconds > 0 ? seconds : 1), settings.concurrency);
+    std::printf("  %-18s %8s %8s %12s %12s %12s %12s\n", "op", "count", "mismatch", "rec p50", "rec p99", "replay p50", "replay p99");
+
+    json report = { {"requests", records.size()}, {"seconds", seconds}, {"speed", settings.speed}, {"concurrency", settings.concurrency} };
+    json ops = json::object();
+    for (int op = 0; op < MaxOps; ++op)
+    {
+        auto rec = stats.recorded[op].Snapshot();
+        auto rep = stats.replayed[op].Snapshot();
+        if (rep.count == 0) continue;
+
+        uint64_t mismatches = stats.mismatches[op].load();
+        std::printf("  %-18s %8llu %8llu %12llu %12llu %12llu %12llu\n", OpName(op), (unsigned long long)rep.count, (unsigned long long)mismatches,
+            (unsigned long long)rec.p50Us, (unsigned long long)rec.p99Us, (unsigned long long)rep.p50Us, (unsigned long long)rep.p99Us);
+        ops[OpName(op)] = {
+            {"count", rep.count}, {"mismatches", mismatches}, {"recordedP50Us", rec.p50Us}, {"recordedP99Us", rec.p99Us},
+            {"p50Us", rep.p50Us}, {"p99Us", rep.p99Us}, {"p999Us", rep.p999Us}, {"maxUs", rep.maxUs}
+        };
+    }
+    report["ops"] = ops;
+
+    if (settings.speed > 0)
+    {
+        auto lag = stats.lag.Snapshot();
+        std::printf("  schedule lag p50/p99/max: %llu/%llu/%llu us\n", (unsigned long long)lag.p50Us, (unsigned long long)lag.p99Us, (unsigned long long)lag.maxUs);
+        report["lag"] = { {"p50Us", lag.p50Us}, {"p99Us", lag.p99Us}, {"maxUs", lag.maxUs} };
+    }
+
+    if (!settings.jsonPath.empty())
+    {
+        std::ofstream out(settings.jsonPath);
+        out << report.dump(2) << "\n";
+    }
+    return 0;
+}
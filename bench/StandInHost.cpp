@@ -0,0 +1,58 @@
+// StandInHost.cpp
+
+#include "StandInServer.h"
+#include "NM-Bridge.h"
+#include "NM-Process.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "include/json.hpp"
+using json = nlohmann::json;
+
+///////////////////////////////////////////////////////////////////////////////
+// Host process for NM_Bridge::Launch on POSIX: an NM_StandInServer on the given endpoint.
+//
+//   nm_standin_host [--workers N] --endpoint NAME --options JSON
+//
+// The token comes in NM_Bridge::HostTokenVariable, as Launch passes it. Of the options only serverTiming and maxQueueDepth apply. Exits after StopServer.
+///////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    std::string endpoint;
+    std::string token = NM_Process::TakeVariable(NM_Bridge::HostTokenVariable);
+    json settings = json::object();
+    int workers = 0;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--endpoint") endpoint = argv[++i];
+        else if (arg == "--options") settings = json::parse(argv[++i], nullptr, false);
+        else if (arg == "--workers") workers = std::atoi(argv[++i]);
+    }
+
+    if (endpoint.empty() || token.empty() || !settings.is_object())
+    {
+        std::fprintf(stderr, "usage: nm_standin_host [--workers N] --endpoint NAME --options JSON, token in %s\n", NM_Bridge::HostTokenVariable);
+        return 2;
+    }
+
+    NM_StandInServer::Options options;
+    options.serverTiming = settings.value("serverTiming", false);
+    options.workers = workers;
+    options.maxQueueDepth = workers > 0 ? settings.value("maxQueueDepth", 0) : 0;
+
+    NM_StandInServer server;
+    std::wstring error;
+    if (!server.Start(endpoint, token, options, error))
+    {
+        std::fprintf(stderr, "nm_standin_host: %s\n", std::string(error.begin(), error.end()).c_str());
+        return 1;
+    }
+
+    server.Wait();
+    server.Stop();
+    return 0;
+}
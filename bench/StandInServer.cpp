@@ -0,0 +1,555 @@
+// StandInServer.cpp
+
+#include "StandInServer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include "include/json.hpp"
+using json = nlohmann::json;
+
+namespace
+{
+    // Must match MANAGED_Bridge.Opcode.
+    enum Opcode
+    {
+        CreateDomain = 1,
+        UnloadDomain = 2,
+        LoadFromFile = 3,
+        LoadFromMemory = 4,
+        CreateInstance = 5,
+        ReleaseInstance = 6,
+        InvokeStatic = 7,
+        InvokeInstance = 8,
+        RunWpfApp = 9,
+        StopWpfApp = 10,
+        GetStats = 11,
+        StopServer = 12,
+        RegisterCacheable = 13,
+        Cancel = 14,
+        ReleaseInstances = 15,
+        Subscribe = 16,
+        ReadCursor = 17
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    const size_t MaxPendingCancels = 1024;
+
+    int64_t UnixMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    uint64_t MicrosSince(Clock::time_point& mark)
+    {
+        auto now = Clock::now();
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - mark).count();
+        mark = now;
+        return static_cast<uint64_t>(us);
+    }
+
+    const size_t MaxChunkBytes = 256 << 10;
+
+    // Rows of Range from next on, bounded like a managed chunk: chunk rows or about maxBytes.
+    json RangeRows(int64_t& next, int64_t count, size_t bytes, int64_t chunk, size_t maxBytes = MaxChunkBytes)
+    {
+        json rows = json::array();
+        size_t size = 0;
+        for (int64_t n = 0; n < chunk && next < count && size < maxBytes; ++n, ++next)
+        {
+            std::string row(bytes, 'x');
+            size += bytes + 3;
+            rows.push_back(std::move(row));
+        }
+        return rows;
+    }
+
+    std::string Failure(const std::string& message)
+    {
+        return json{ {"success", false}, {"error", message} }.dump();
+    }
+
+    // Decodes like Convert.FromBase64String so LoadFromMemory costs what it does on the real server.
+    bool base64_decode(const std::string& in, std::vector<uint8_t>& out)
+    {
+        static int8_t table[256];
+        static bool ready = [] {
+            const char* chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            for (auto& t : table) t = -1;
+            for (int i = 0; i < 64; ++i) table[static_cast<unsigned char>(chars[i])] = static_cast<int8_t>(i);
+            return true;
+        }();
+        (void)ready;
+
+        if (in.size() % 4 != 0) return false;
+
+        out.clear();
+        out.reserve(in.size() / 4 * 3);
+        uint32_t acc = 0;
+        int bits = 0;
+        for (char ch : in)
+        {
+            if (ch == '=') break;
+            int v = table[static_cast<unsigned char>(ch)];
+            if (v < 0) return false;
+            acc = (acc << 6) | static_cast<uint32_t>(v);
+            bits += 6;
+            if (bits >= 8)
+            {
+                bits -= 8;
+                out.push_back(static_cast<uint8_t>(acc >> bits));
+            }
+        }
+        return true;
+    }
+}
+
+
+NM_StandInServer::~NM_StandInServer()
+{
+    Stop();
+}
+
+bool NM_StandInServer::Start(const std::string& endpointName, const std::string& authToken, const Options& opts, std::wstring& error)
+{
+    if (!listener.Listen(endpointName, error)) return false;
+
+    endpoint = listener.Endpoint();
+    token = authToken;
+    options = opts;
+
+    acceptor = std::thread(&NM_StandInServer::AcceptLoop, this);
+    return true;
+}
+
+void NM_StandInServer::Stop()
+{
+    listener.Close();
+    if (acceptor.joinable()) acceptor.join();
+
+    {
+        std::lock_guard<std::mutex> lock(eventLock);
+        eventsStopped = true;
+    }
+    eventSignal.notify_all();
+
+    {
+        std::lock_guard<std::mutex> lock(sessionLock);
+        for (auto& s : sessions) s->connection->Interrupt();
+        for (auto& s : sessions) s->thread.join();
+        sessions.clear();
+    }
+
+    std::lock_guard<std::mutex> lock(domainLock);
+    domains.clear();
+    instances.clear();
+}
+
+void NM_StandInServer::Wait()
+{
+    if (acceptor.joinable()) acceptor.join();
+}
+
+void NM_StandInServer::AcceptLoop()
+{
+    while (auto connection = listener.Accept())
+    {
+        std::lock_guard<std::mutex> lock(sessionLock);
+
+        for (auto it = sessions.begin(); it != sessions.end();)
+        {
+            if ((*it)->done.load())
+            {
+                (*it)->thread.join();
+                it = sessions.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        sessions.emplace_back(new Session());
+        Session* session = sessions.back().get();
+        session->connection = std::move(connection);
+        session->thread = std::thread(&NM_StandInServer::Serve, this, session);
+    }
+}
+
+void NM_StandInServer::Serve(Session* session)
+{
+    // A connection may carry any number of messages; the client decides when to hang up.
+    std::string message;
+    std::wstring error;
+    while (session->connection->Read(message, -1, error))
+    {
+        std::string reply, subscribeTo;
+        if (Admit())
+        {
+            reply = Handle(message, &subscribeTo);
+            Leave();
+        }
+        else
+        {
+            reply = json{ {"success", false}, {"error", "Overloaded"}, {"overloaded", true}, {"queue", options.maxQueueDepth} }.dump();
+        }
+        served.fetch_add(1, std::memory_order_relaxed);
+        if (!session->connection->Write(reply.data(), reply.size(), error)) break;
+        if (!subscribeTo.empty())
+        {
+            PushEvents(session, subscribeTo);
+            break;
+        }
+    }
+    session->done = true;
+}
+
+// Like EventChannel's sender: everything queued goes out as one batch, an empty one after 5 s of quiet.
+void NM_StandInServer::PushEvents(Session* session, const std::string& domainId)
+{
+    Subscriber self;
+    self.domainId = domainId;
+    {
+        std::lock_guard<std::mutex> lock(eventLock);
+        if (eventsStopped) return;
+        subscribers.push_back(&self);
+    }
+
+    std::wstring error;
+    for (;;)
+    {
+        std::vector<PendingEvent> batch;
+        {
+            std::unique_lock<std::mutex> lock(eventLock);
+            eventSignal.wait_for(lock, std::chrono::seconds(5), [&] { return eventsStopped || self.ended || !self.events.empty(); });
+            if (eventsStopped || self.ended) break;
+            batch.swap(self.events);
+            self.posted.clear();
+        }
+
+        json events = json::array();
+        for (const auto& e : batch)
+        {
+            json item = { {"name", e.name}, {"payload", e.payload} };
+            if (e.coalesced > 0) item["coalesced"] = e.coalesced;
+            events.push_back(std::move(item));
+        }
+        std::string message = json{ {"events", std::move(events)} }.dump();
+        if (!session->connection->Write(message.data(), message.size(), error)) break;
+    }
+
+    std::lock_guard<std::mutex> lock(eventLock);
+    subscribers.remove(&self);
+}
+
+bool NM_StandInServer::Admit()
+{
+    if (options.workers <= 0) return true;
+
+    std::unique_lock<std::mutex> lock(admitLock);
+    if (busy >= options.workers)
+    {
+        if (options.maxQueueDepth > 0 && waiting >= options.maxQueueDepth) return false;
+        ++waiting;
+        workerFree.wait(lock, [this] { return busy < options.workers; });
+        --waiting;
+    }
+    ++busy;
+    return true;
+}
+
+void NM_StandInServer::Leave()
+{
+    if (options.workers <= 0) return;
+
+    {
+        std::lock_guard<std::mutex> lock(admitLock);
+        --busy;
+    }
+    workerFree.notify_one();
+}
+
+std::string NM_StandInServer::Handle(const std::string& message, std::string* subscribeTo)
+{
+    auto mark = Clock::now();
+    uint64_t parseUs = 0, invokeUs = 0;
+
+    json rq = json::parse(message, nullptr, false);
+    if (!rq.is_object()) return Failure("Invalid request");
+    if (rq.value("authToken", std::string()) != token) return Failure("Unauthorized");
+    parseUs = MicrosSince(mark);
+
+    int op = rq.value("op", 0);
+    int64_t deadline = rq.value("deadline", int64_t(0));
+    uint64_t cancelId = rq.value("cancelId", uint64_t(0));
+    if (deadline != 0 && UnixMs() >= deadline) return Failure("Deadline exceeded");
+
+    std::string domainId = rq.value("domainId", std::string());
+    json rs = { {"success", true} };
+
+    if (op != CreateDomain && op != UnloadDomain && op != GetStats && op != StopServer)
+    {
+        if (domainId.empty()) return Failure("Unknown op: " + std::to_string(op));
+
+        std::lock_guard<std::mutex> lock(domainLock);
+        if (!domains.count(domainId)) return Failure("domain not found");
+
+        // Releases ride on whatever request goes to the domain next; applied before the op itself.
+        if (rq.contains("release") && rq["release"].is_array())
+        {
+            for (const auto& h : rq["release"])
+            {
+                if (!h.is_number_unsigned()) continue;
+                batchReleased += instances.erase(h.get<uint64_t>());
+                cursors.erase(h.get<uint64_t>());
+            }
+        }
+    }
+
+    if (op != Cancel && cancelId != 0)
+    {
+        // Cancelled before it got here: dropped like a queued request on the managed server.
+        std::lock_guard<std::mutex> lock(cancelLock);
+        if (cancelled.erase(cancelId)) return Failure("Cancelled");
+    }
+
+    switch (op)
+    {
+    case CreateDomain:
+    {
+        if (domainId.empty()) domainId = "standin" + std::to_string(nextHandle.fetch_add(1) + 1);
+
+        std::lock_guard<std::mutex> lock(domainLock);
+        if (!domains.insert(domainId).second) return Failure("Domain already exists: " + domainId);
+        rs["domainId"] = domainId;
+        rs["pipeName"] = endpoint;
+        rs["eventPipe"] = endpoint;
+        break;
+    }
+
+    case UnloadDomain:
+    {
+        if (domainId.empty()) return Failure("domainId missing");
+
+        {
+            std::lock_guard<std::mutex> lock(domainLock);
+            if (!domains.erase(domainId)) return Failure("domain not found");
+        }
+
+        std::lock_guard<std::mutex> lock(eventLock);
+        for (auto* s : subscribers)
+        {
+            if (s->domainId == domainId) s->ended = true;
+        }
+        eventSignal.notify_all();
+        break;
+    }
+
+    case LoadFromFile:
+    {
+        std::string path = rq.value("path", std::string());
+        if (path.empty()) return Failure("path required");
+        rs["assemblyName"] = rq.value("assemblyAlias", path.substr(path.find_last_of("/\\") + 1));
+        break;
+    }
+
+    case LoadFromMemory:
+    {
+        std::string bytesBase64 = rq.value("bytesBase64", std::string());
+        if (bytesBase64.empty()) return Failure("bytesBase64 required");
+
+        std::vector<uint8_t> raw;
+        if (!base64_decode(bytesBase64, raw)) return Failure("Invalid base64");
+        invokeUs = MicrosSince(mark);
+        rs["assemblyName"] = rq.value("assemblyAlias", std::string("InMemory"));
+        break;
+    }
+
+    case CreateInstance:
+    {
+        if (rq.value("typeName", std::string()).empty()) return Failure("typeName required");
+        uint64_t handle = nextHandle.fetch_add(1) + 1;
+
+        std::lock_guard<std::mutex> lock(domainLock);
+        instances.insert(handle);
+        rs["instanceHandle"] = handle;
+        break;
+    }
+
+    case ReleaseInstance:
+    {
+        if (!rq.contains("instanceHandle")) return Failure("instanceHandle required");
+
+        std::lock_guard<std::mutex> lock(domainLock);
+        instances.erase(rq.value("instanceHandle", uint64_t(0)));
+        cursors.erase(rq.value("instanceHandle", uint64_t(0)));
+        break;
+    }
+
+    case ReadCursor:
+    {
+        uint64_t handle = rq.value("instanceHandle", uint64_t(0));
+        std::lock_guard<std::mutex> lock(domainLock);
+        auto it = cursors.find(handle);
+        if (it == cursors.end()) return Failure("Cursor not found: " + std::to_string(handle));
+
+        rs["rows"] = RangeRows(it->second.next, it->second.count, it->second.bytes, (std::max)(rq.value("chunk", int64_t(1)), int64_t(1)));
+        rs["done"] = it->second.next >= it->second.count;
+        if (it->second.next >= it->second.count)
+        {
+            cursors.erase(it);
+            instances.erase(handle);
+        }
+        invokeUs = MicrosSince(mark);
+        break;
+    }
+
+    case ReleaseInstances:
+        break;
+
+    case InvokeStatic:
+    case InvokeInstance:
+    {
+        std::string typeName = rq.value("typeName", std::string());
+        std::string methodName = rq.value("methodName", std::string());
+        if (methodName.empty()) return Failure("typeName/methodName required");
+
+        const json& args = rq.contains("args") ? rq["args"] : json::array();
+        json first = args.is_array() && !args.empty() ? args[0] : json();
+
+        if (methodName == "Echo")
+        {
+            rs["result"] = std::move(first);
+        }
+        else if (methodName == "Sleep")
+        {
+            auto until = Clock::now() + std::chrono::microseconds(first.is_number() ? first.get<int64_t>() : 0);
+            if (deadline != 0) until = (std::min)(until, Clock::now() + std::chrono::milliseconds(deadline - UnixMs()));
+
+            std::unique_lock<std::mutex> lock(cancelLock);
+            if (cancelId != 0) sleeping.insert(cancelId);
+            bool stopped = cancelSignal.wait_until(lock, until, [&] { return cancelId != 0 && cancelled.count(cancelId) > 0; });
+            sleeping.erase(cancelId);
+            cancelled.erase(cancelId);
+            lock.unlock();
+
+            if (stopped) return Failure("System.OperationCanceledException: Cancelled");
+            if (deadline != 0 && UnixMs() >= deadline) return Failure("System.OperationCanceledException: Deadline exceeded");
+            rs["result"] = nullptr;
+        }
+        else if (methodName == "Range")
+        {
+            int64_t count = first.is_number() ? first.get<int64_t>() : 0;
+            size_t bytes = args.size() > 1 && args[1].is_number() ? args[1].get<size_t>() : 0;
+            int64_t chunk = rq.value("chunk", int64_t(0));
+            int64_t next = 0;
+            if (chunk <= 0)
+            {
+                rs["result"] = RangeRows(next, count, bytes, count, SIZE_MAX);
+            }
+            else
+            {
+                rs["rows"] = RangeRows(next, count, bytes, chunk);
+                rs["done"] = next >= count;
+                if (next < count)
+                {
+                    uint64_t handle = nextHandle.fetch_add(1) + 1;
+                    std::lock_guard<std::mutex> lock(domainLock);
+                    instances.insert(handle);
+                    cursors[handle] = Cursor{ next, count, bytes };
+                    rs["cursor"] = handle;
+                }
+            }
+        }
+        else if (methodName == "Raise")
+        {
+            std::string name = first.is_string() ? first.get<std::string>() : std::string();
+            int64_t count = args.size() > 1 && args[1].is_number() ? args[1].get<int64_t>() : 1;
+            bool post = args.size() > 2 && args[2].is_boolean() && args[2].get<bool>();
+            if (name.empty()) return Failure("Raise(name, count, post): name required");
+
+            std::lock_guard<std::mutex> lock(eventLock);
+            size_t listening = 0;
+            for (auto* s : subscribers)
+            {
+                if (s->domainId != domainId) continue;
+                ++listening;
+                for (int64_t i = 0; i < count; ++i)
+                {
+                    auto it = post ? s->posted.find(name) : s->posted.end();
+                    if (it != s->posted.end())
+                    {
+                        s->events[it->second].payload = i;
+                        ++s->events[it->second].coalesced;
+                        continue;
+                    }
+                    if (post) s->posted[name] = s->events.size();
+                    s->events.push_back(PendingEvent{ name, i, 0 });
+                }
+            }
+            eventSignal.notify_all();
+            rs["result"] = listening > 0;
+        }
+        else
+        {
+            return Failure("Static method " + typeName + "." + methodName + " not found");
+        }
+        invokeUs = MicrosSince(mark);
+        break;
+    }
+
+    case RegisterCacheable:
+        break;
+
+    case Subscribe:
+        if (subscribeTo) *subscribeTo = domainId;
+        else return Failure("Subscribe needs its own connection");
+        break;
+
+    case Cancel:
+    {
+        // Ids are handed out in increasing order, so the smallest pending one is the oldest.
+        std::lock_guard<std::mutex> lock(cancelLock);
+        rs["cancelled"] = sleeping.count(cancelId) > 0;
+        if (cancelled.size() >= MaxPendingCancels) cancelled.erase(cancelled.begin());
+        cancelled.insert(cancelId);
+        cancelSignal.notify_all();
+        break;
+    }
+
+    case RunWpfApp:
+    case StopWpfApp:
+        return Failure("Not supported by the stand-in server");
+
+    case GetStats:
+    {
+        std::lock_guard<std::mutex> lock(domainLock);
+        rs["domains"] = domains.size();
+        rs["instances"] = instances.size();
+        rs["batchReleased"] = batchReleased;
+        rs["served"] = Served();
+        break;
+    }
+
+    case StopServer:
+        // Sessions cannot join themselves; closing the listener ends the accept loop, Stop() the rest.
+        listener.Close();
+        break;
+
+    default:
+        return Failure("Unknown op: " + std::to_string(op));
+    }
+
+    if (options.workers > 0)
+    {
+        std::lock_guard<std::mutex> lock(admitLock);
+        rs["queue"] = waiting;
+    }
+    if (options.serverTiming)
+    {
+        rs["timing"] = { {"queued", 0}, {"parse", parseUs}, {"invoke", invokeUs} };
+    }
+    return rs.dump();
+}
@@ -0,0 +1,122 @@
+// StandInServer.h
+
+#pragma once
+
+#include "NM-Transport.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Native stand-in for Managed_Bridge: speaks the same JSON protocol over NM_Listener, so the
+// client stack can be measured without a CLR. Domains and instances are bookkeeping only.
+// Built-in methods on any type: Echo(x) returns x, Sleep(us) blocks for us microseconds and
+// behaves like a method taking a CancellationToken (it ends early at the deadline or on Cancel);
+// Range(count, bytes) returns count strings of that many bytes, a chunk at a time when the request
+// asks for streaming, like a method returning IEnumerable; ReadCursor reads on.
+// Raise(name, count, post) queues count events named name for the domain's subscribers, through
+// Post when post is true, the way NativeEvents does; a Subscribe connection then only receives.
+// Anything else fails the way an unresolved method does on the real server.
+// Every connection gets its own thread, so idle pooled client connections never starve others;
+// Options::workers caps how many of them run a request at once, like the managed worker pool.
+class NM_StandInServer {
+
+public:
+    struct Options
+    {
+        bool serverTiming = false;  // append a "timing" block like the managed server does
+        int workers = 0;            // requests handled at once; 0 means no limit and no queue
+        int maxQueueDepth = 0;      // with workers, requests allowed to wait before "Overloaded"
+    };
+
+    NM_StandInServer() = default;
+    ~NM_StandInServer();
+    NM_StandInServer(const NM_StandInServer&) = delete;
+    NM_StandInServer& operator=(const NM_StandInServer&) = delete;
+
+    bool Start(const std::string& endpoint, const std::string& token, const Options& options, std::wstring& error);
+    void Stop();
+    // Returns once StopServer or Stop() has closed the listener.
+    void Wait();
+
+    // For tcp://host:0, the port that was bound.
+    const std::string& Endpoint() const { return endpoint; }
+    uint64_t Served() const { return served.load(std::memory_order_relaxed); }
+
+private:
+    struct Session
+    {
+        std::unique_ptr<NM_Connection> connection;
+        std::thread thread;
+        std::atomic<bool> done{ false };
+    };
+
+    void AcceptLoop();
+    void Serve(Session* session);
+    // subscribeTo receives the domain of a successful Subscribe; the session then only pushes events.
+    std::string Handle(const std::string& message, std::string* subscribeTo = nullptr);
+    void PushEvents(Session* session, const std::string& domainId);
+    bool Admit();   // waits for a free worker; false when the queue is full
+    void Leave();
+
+    NM_Listener listener;
+    std::thread acceptor;
+    std::mutex sessionLock;
+    std::list<std::unique_ptr<Session>> sessions;
+    std::string endpoint;
+    std::string token;
+    Options options;
+
+    std::mutex domainLock;
+    std::set<std::string> domains;
+    std::set<uint64_t> instances;       // live handles, so leaks show up in GetStats
+
+    struct Cursor
+    {
+        int64_t next = 0;
+        int64_t count = 0;
+        size_t bytes = 0;
+    };
+
+    std::map<uint64_t, Cursor> cursors;    // also in instances, as on the managed server
+    uint64_t batchReleased = 0;
+    std::mutex admitLock;
+    std::condition_variable workerFree;
+    int busy = 0;
+    int waiting = 0;
+
+    std::mutex cancelLock;
+    std::condition_variable cancelSignal;
+    std::set<uint64_t> sleeping;        // cancel ids of Sleep calls in progress
+    std::set<uint64_t> cancelled;       // including ids whose request has not arrived yet
+
+    struct PendingEvent
+    {
+        std::string name;
+        int64_t payload = 0;
+        uint64_t coalesced = 0;
+    };
+
+    struct Subscriber
+    {
+        std::string domainId;
+        std::vector<PendingEvent> events;
+        std::unordered_map<std::string, size_t> posted;    // name -> index of its unsent Post
+        bool ended = false;                                 // domain unloaded
+    };
+
+    std::mutex eventLock;
+    std::condition_variable eventSignal;
+    std::list<Subscriber*> subscribers;
+    bool eventsStopped = false;
+    std::atomic<uint64_t> nextHandle{ 0 };
+    std::atomic<uint64_t> served{ 0 };
+};
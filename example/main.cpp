@@ -145,11 +145,9 @@ int main() {
     ///////////////////////////////////////////////////////////////////////////////
 
     std::string ctorArgs = "[\"SuperCalc_9000\"]";
-    std::string instanceId;
-    if (bridge.CreateInstance(domainId, asmAlias, "TestLib.Calculator", ctorArgs, response, error)) {
-        json jRes = json::parse(response);
-        instanceId = jRes["instanceId"];
-        std::cout << "[+] Instance created. ID: " << instanceId << std::endl;
+    NM_Bridge::InstanceHandle instance = NM_Bridge::InstanceHandle::Invalid;
+    if (bridge.CreateInstance(domainId, asmAlias, "TestLib.Calculator", ctorArgs, instance, response, error)) {
+        std::cout << "[+] Instance created. Handle: " << static_cast<uint64_t>(instance) << std::endl;
     }
     else {
         std::wcout << L"[-] Error CreateInstance: " << error << std::endl;
@@ -164,13 +162,13 @@ int main() {
     // 6.  
     ///////////////////////////////////////////////////////////////////////////////
 
-    if (!instanceId.empty()) {
+    if (instance != NM_Bridge::InstanceHandle::Invalid) {
 
         // The method doesn't take any arguments, so we pass an empty array.
         //     ,     .
 
         std::string instArgs = "[]";
-        if (bridge.InvokeInstance(domainId, asmAlias, instanceId, "TestLib.Calculator", "GetInfo", instArgs, response, error)) {
+        if (bridge.InvokeInstance(domainId, asmAlias, instance, "TestLib.Calculator", "GetInfo", instArgs, response, error)) {
             json jRes = json::parse(response);
             std::cout << "[+] InvokeInstance (GetInfo): " << jRes["result"] << std::endl;
         }
@@ -189,8 +187,8 @@ int main() {
         //  ,    C#   
         ///////////////////////////////////////////////////////////////////////////////
 
-        if (bridge.ReleaseInstance(domainId, instanceId, response, error)) {
-            std::cout << "[+] Instance " << instanceId << " has been deallocated." << std::endl;
+        if (bridge.ReleaseInstance(domainId, instance, response, error)) {
+            std::cout << "[+] Instance " << static_cast<uint64_t>(instance) << " has been deallocated." << std::endl;
         }
     }
 
@@ -0,0 +1,159 @@
+﻿// ArgumentReader.cs
+
+using Newtonsoft.Json;
+using System;
+using System.IO;
+using System.Text;
+
+
+namespace MANAGED_Bridge
+{
+    // Arguments arrive as the raw UTF-8 "args" range of the request and are only
+    // decoded here, against the parameter types of the selected target.
+    internal static class ArgumentReader
+    {
+        private static readonly JsonSerializer serializer = JsonSerializer.CreateDefault();
+
+        public static bool IsEmpty(ArraySegment<byte> args)
+        {
+            int i = args.Offset;
+            int end = args.Offset + args.Count;
+            while (i < end && args.Array[i] <= ' ')
+            {
+                i++;
+            }
+            return i == end || (end - i >= 4 && args.Array[i] == 'n' && args.Array[i + 1] == 'u' && args.Array[i + 2] == 'l' && args.Array[i + 3] == 'l');
+        }
+
+
+        public static int Count(ArraySegment<byte> args)
+        {
+            int depth = 0;
+            int count = 0;
+            bool pending = false;
+            bool inString = false;
+            bool escaped = false;
+
+            int end = args.Offset + args.Count;
+            for (int i = args.Offset; i < end; i++)
+            {
+                char c = (char)args.Array[i];
+
+                if (inString)
+                {
+                    if (escaped)
+                    {
+                        escaped = false;
+                    }
+                    else if (c == '\\')
+                    {
+                        escaped = true;
+                    }
+                    else if (c == '"')
+                    {
+                        inString = false;
+                    }
+                    continue;
+                }
+
+                switch (c)
+                {
+                    case '"':
+                        inString = true;
+                        if (depth == 1) pending = true;
+                        break;
+
+                    case '[':
+                    case '{':
+                        if (depth == 1) pending = true;
+                        depth++;
+                        break;
+
+                    case ']':
+                    case '}':
+                        depth--;
+                        if (depth == 0 && pending)
+                        {
+                            count++;
+                            pending = false;
+                        }
+                        break;
+
+                    case ',':
+                        if (depth == 1)
+                        {
+                            count++;
+                            pending = false;
+                        }
+                        break;
+
+                    default:
+                        if (depth == 1 && !char.IsWhiteSpace(c)) pending = true;
+                        break;
+                }
+            }
+            return count;
+        }
+
+
+        // extraSlots leaves room at the end for arguments supplied by the server, not the caller.
+        public static object[] Read(ArraySegment<byte> argsJson, Type[] parameterTypes, int extraSlots = 0)
+        {
+            var args = new object[parameterTypes.Length + extraSlots];
+
+            if (IsEmpty(argsJson))
+            {
+                if (parameterTypes.Length != 0)
+                {
+                    throw new JsonReaderException($"Expected {parameterTypes.Length} arguments, got 0");
+                }
+                return args;
+            }
+
+            using (var reader = Open(argsJson))
+            {
+                if (!reader.Read() || reader.TokenType != JsonToken.StartArray)
+                {
+                    throw new JsonReaderException("Arguments must be a JSON array");
+                }
+
+                for (int i = 0; i < parameterTypes.Length; i++)
+                {
+                    if (!reader.Read() || reader.TokenType == JsonToken.EndArray)
+                    {
+                        throw new JsonReaderException($"Expected {parameterTypes.Length} arguments, got {i}");
+                    }
+
+                    args[i] = reader.TokenType == JsonToken.Null ? null : serializer.Deserialize(reader, parameterTypes[i]);
+                }
+
+                if (!reader.Read() || reader.TokenType != JsonToken.EndArray)
+                {
+                    throw new JsonReaderException($"Expected {parameterTypes.Length} arguments, got more");
+                }
+            }
+            return args;
+        }
+
+
+        public static T ReadAs<T>(ArraySegment<byte> json)
+        {
+            if (IsEmpty(json))
+            {
+                return default(T);
+            }
+
+            using (var reader = Open(json))
+            {
+                return serializer.Deserialize<T>(reader);
+            }
+        }
+
+
+        private static JsonTextReader Open(ArraySegment<byte> json)
+        {
+            var stream = new MemoryStream(json.Array, json.Offset, json.Count, writable: false);
+            return new JsonTextReader(new StreamReader(stream, Encoding.UTF8, false, Math.Max(128, Math.Min(json.Count, 4096))));
+        }
+    }
+}
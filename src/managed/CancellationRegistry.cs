@@ -0,0 +1,158 @@
+﻿// CancellationRegistry.cs
+
+using Newtonsoft.Json.Linq;
+using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Threading;
+
+
+namespace MANAGED_Bridge
+{
+    // Token sources of the running invocations that take a CancellationToken, by the caller's
+    // cancel id. Each source fires at the request deadline or on an explicit Cancel command.
+    internal sealed class CancellationRegistry
+    {
+        // Cancel travels on the control pipe and can overtake the request it names, which may
+        // still be queued on the domain pipe. Such ids are remembered for a while and honored on arrival.
+        private const int EarlyLimit = 1024;
+        private const long EarlyTtlMs = 60000;
+
+        private readonly ConcurrentDictionary<long, CancellationTokenSource> running = new ConcurrentDictionary<long, CancellationTokenSource>();
+        private readonly ConcurrentDictionary<long, long> early = new ConcurrentDictionary<long, long>();
+        private int earlyCount;
+        private long cancelRequests;
+        private long cancelledInvocations;
+
+        public CancellationTokenSource Begin(long cancelId, long deadline)
+        {
+            var cts = new CancellationTokenSource();
+            if (deadline != 0)
+            {
+                long remaining = deadline - DateTimeOffset.UtcNow.ToUnixTimeMilliseconds();
+                if (remaining <= 0)
+                {
+                    cts.Cancel();
+                }
+                else
+                {
+                    cts.CancelAfter((int)Math.Min(remaining, int.MaxValue));
+                }
+            }
+
+            if (cancelId != 0)
+            {
+                running[cancelId] = cts;
+                if (TakeEarly(cancelId))
+                {
+                    cts.Cancel();
+                }
+            }
+            return cts;
+        }
+
+
+        public void End(long cancelId, CancellationTokenSource cts)
+        {
+            if (cancelId != 0)
+            {
+                ((ICollection<KeyValuePair<long, CancellationTokenSource>>)running).Remove(new KeyValuePair<long, CancellationTokenSource>(cancelId, cts));
+            }
+
+            if (cts.IsCancellationRequested)
+            {
+                Interlocked.Increment(ref cancelledInvocations);
+            }
+            cts.Dispose();
+        }
+
+
+        // True when the invocation was running and has been signalled; otherwise the id is
+        // kept so the request is dropped or cancelled as soon as it shows up.
+        public bool Cancel(long cancelId)
+        {
+            if (cancelId == 0)
+            {
+                return false;
+            }
+
+            Interlocked.Increment(ref cancelRequests);
+            if (Signal(cancelId))
+            {
+                return true;
+            }
+
+            long now = DateTimeOffset.UtcNow.ToUnixTimeMilliseconds();
+            if (Volatile.Read(ref earlyCount) >= EarlyLimit)
+            {
+                Prune(now);
+            }
+
+            if (early.TryAdd(cancelId, now + EarlyTtlMs))
+            {
+                Interlocked.Increment(ref earlyCount);
+            }
+
+            // Begin may have registered between the first look and the add above.
+            if (Signal(cancelId))
+            {
+                TakeEarly(cancelId);
+                return true;
+            }
+            return false;
+        }
+
+
+        // Consumes a Cancel that arrived before its request.
+        public bool TakeEarly(long cancelId)
+        {
+            if (cancelId == 0 || Volatile.Read(ref earlyCount) == 0 || !early.TryRemove(cancelId, out _))
+            {
+                return false;
+            }
+
+            Interlocked.Decrement(ref earlyCount);
+            return true;
+        }
+
+
+        public JObject Snapshot()
+        {
+            return new JObject
+            {
+                ["running"] = running.Count,
+                ["cancelRequests"] = Interlocked.Read(ref cancelRequests),
+                ["cancelledInvocations"] = Interlocked.Read(ref cancelledInvocations),
+                ["pendingCancels"] = Volatile.Read(ref earlyCount)
+            };
+        }
+
+
+        private bool Signal(long cancelId)
+        {
+            if (!running.TryGetValue(cancelId, out var cts))
+            {
+                return false;
+            }
+
+            try
+            {
+                cts.Cancel();
+            }
+            catch (ObjectDisposedException) { }
+            return true;
+        }
+
+
+        private void Prune(long now)
+        {
+            foreach (var entry in early)
+            {
+                if (entry.Value <= now && early.TryRemove(entry.Key, out _))
+                {
+                    Interlocked.Decrement(ref earlyCount);
+                }
+            }
+        }
+    }
+}
@@ -2,7 +2,10 @@
 
 using Newtonsoft.Json.Linq;
 using System;
+using System.Collections;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
+using System.Diagnostics;
 using System.IO;
 using System.IO.Pipes;
 using System.Linq;
@@ -21,13 +24,23 @@ namespace MANAGED_Bridge
     public class Managed_Bridge
     {
         private static string authToken;
-        private static Thread serverThread;
-        private static volatile bool serverRunning = false;
+        private static byte[] authTokenBytes;
+        private static PipeServer server;
         private static string serverPipeName;
+        private static int controlWorkers = 2;
+        private static int domainWorkers = 1;
+        private static bool shareAssemblies;
+        private static int resultCacheEntries = 1024;
+        private static long resultCacheBytes = 16 << 20;
+        private static bool serverTiming;
+        private static int maxQueueDepth = 1024;
+        private static int maxInFlight;
         private static readonly object sync = new object();
 
-        class DomainRecord { public string Id; public AppDomain Domain; public DomainProxy Proxy; }
-        static Dictionary<string, DomainRecord> domains = new Dictionary<string, DomainRecord>(StringComparer.OrdinalIgnoreCase);
+        // Each record is locked only by the control operation that creates or unloads it,
+        // so work on one domain never waits for another domain's create/unload.
+        class DomainRecord { public string Id; public AppDomain Domain; public DomainProxy Proxy; public string PipeName; }
+        static ConcurrentDictionary<string, DomainRecord> domains = new ConcurrentDictionary<string, DomainRecord>(StringComparer.OrdinalIgnoreCase);
 
         public static int StartServer(string initJson)
         {
@@ -48,25 +61,36 @@ namespace MANAGED_Bridge
 
                 string pipeName = (string)j["pipeName"];
                 authToken = (string)j["authToken"];
+                authTokenBytes = authToken == null ? null : Encoding.UTF8.GetBytes(authToken);
                 string ManagedBridgePath = (string)j["ManagedBridgePath"] ?? "";
+                controlWorkers = (int?)j["controlWorkers"] ?? controlWorkers;
+                domainWorkers = (int?)j["domainWorkers"] ?? domainWorkers;
+                GcScheduler.Configure((string)j["gcPolicy"], (int?)j["gcEveryN"] ?? 4, (int?)j["gcMemoryLoadPercent"] ?? 0);
+                poolSize = (int?)j["domainPoolSize"] ?? 0;
+                shareAssemblies = (bool?)j["shareAssemblies"] ?? false;
+                resultCacheEntries = (int?)j["resultCacheEntries"] ?? resultCacheEntries;
+                resultCacheBytes = ((long?)j["resultCacheMB"] ?? 16) << 20;
+                serverTiming = (bool?)j["serverTiming"] ?? false;
+                maxQueueDepth = (int?)j["maxQueueDepth"] ?? maxQueueDepth;
+                maxInFlight = (int?)j["maxInFlight"] ?? 0;
 
                 if (string.IsNullOrEmpty(pipeName))
                 {
-                    pipeName = $"managedbridge_server_{System.Diagnostics.Process.GetCurrentProcess().Id}";
+                    pipeName = $"managedbridge_server_{Process.GetCurrentProcess().Id}";
                 }
                     
                 serverPipeName = pipeName;
 
                 lock (sync)
                 {
-                    if (serverRunning)
+                    if (server != null)
                     {
                         return 1;
                     }
 
-                    serverRunning = true;
-                    serverThread = new Thread(ServerLoop) { IsBackground = true };
-                    serverThread.Start();
+                    server = new PipeServer(serverPipeName, controlWorkers, ProcessRequest, serverTiming, maxQueueDepth, maxInFlight);
+                    server.Start();
+                    StartPool();
                 }
                 return 1;
             }
@@ -82,30 +106,25 @@ namespace MANAGED_Bridge
         {
             try
             {
+                PipeServer running;
                 lock (sync) 
                 {
-                    serverRunning = false;
+                    running = server;
+                    server = null;
                 }
 
-                if (serverThread != null && serverThread.IsAlive && Thread.CurrentThread.ManagedThreadId != serverThread.ManagedThreadId)
-                {
-                    serverThread.Join(2000);
-                }             
+                running?.Stop(2000);
+                StopPool();
 
-                lock (sync)
+                foreach (var id in domains.Keys.ToArray())
                 {
-                    foreach (var kv in domains.ToArray())
-                    {
-                        try 
-                        { 
-                            AppDomain.Unload(kv.Value.Domain);
-                        } 
-                        catch { }
-                    }
-                    domains.Clear();
+                    try 
+                    { 
+                        UnloadDomain(id);
+                    } 
+                    catch { }
                 }
-                GC.Collect(GC.MaxGeneration, GCCollectionMode.Forced, true);
-                GC.WaitForPendingFinalizers();
+                GcScheduler.OnStop();
                 return 1;
             }
             catch (Exception) 
@@ -115,477 +134,873 @@ namespace MANAGED_Bridge
         }
 
 
-        private static void ServerLoop()
+        private static void ProcessRequest(Request req, ResponseWriter w)
         {
-            // Идеальный Zero-Allocation: выделяем память 1 раз на всю жизнь моста!
-            byte[] buffer = new byte[32768];
-            using (var ms = new MemoryStream(32768))
+            try
             {
-                while (serverRunning)
+                if (!req.TokenMatches(authTokenBytes))
                 {
-                    NamedPipeServerStream pipe = null;
-                    try
-                    {
-                        var ps = new PipeSecurity();
-                        var sid = WindowsIdentity.GetCurrent().User;
-                        ps.AddAccessRule(new PipeAccessRule(sid, PipeAccessRights.FullControl, AccessControlType.Allow));
-
-                        pipe = new NamedPipeServerStream(serverPipeName, PipeDirection.InOut, 1, PipeTransmissionMode.Message, PipeOptions.None, 32768, 32768, ps);
-                        pipe.WaitForConnection();
-
-                        ms.SetLength(0);
-
-                        int bytesRead;
-                        do
-                        {
-                            bytesRead = pipe.Read(buffer, 0, buffer.Length);
-                            if (bytesRead > 0)
-                            {
-                                ms.Write(buffer, 0, bytesRead);
-                            }
-                        }
-                        while (!pipe.IsMessageComplete && bytesRead > 0);
+                    w.Failure("Unauthorized");
+                    return;
+                }
 
-                        string requestJson = Encoding.UTF8.GetString(ms.GetBuffer(), 0, (int)ms.Length);
+                switch (req.Op)
+                {
+                    case Opcode.CreateDomain: Cmd_CreateDomain(req, w); break;
+                    case Opcode.UnloadDomain: Cmd_UnloadDomain(req, w); break;
+                    case Opcode.GetStats: Cmd_GetStats(req, w); break;
+                    case Opcode.Cancel: Cmd_Cancel(req, w); break;
+                    case Opcode.StopServer: StopServer(); w.Success().End(); break;
+                    default: RouteToDomain(req, w); break;
+                }
+            }
+            catch (Exception ex)
+            {
+                w.Failure(ex.ToString());
+            }
+        }
 
-                        if (string.IsNullOrWhiteSpace(requestJson))
-                        {
-                            requestJson = "{}";
-                        }
 
-                        string responseJson = ProcessRequest(requestJson);
+        // Domain-scoped commands normally arrive on the domain's own pipe. Requests that still
+        // reach the default pipe are handed over as the raw request bytes and handled inside the domain.
+        private static void RouteToDomain(Request req, ResponseWriter w)
+        {
+            string domainId = req.DomainId;
+            if (string.IsNullOrEmpty(domainId))
+            {
+                w.Failure("Unknown op: " + (int)req.Op);
+                return;
+            }
 
-                        if (!string.IsNullOrEmpty(responseJson))
-                        {
-                            byte[] resp = Encoding.UTF8.GetBytes(responseJson);
-                            pipe.Write(resp, 0, resp.Length);
-                            pipe.Flush();
-                        }
-                        pipe?.Dispose();
-                    }
+            var proxy = FindProxy(domainId);
+            if (proxy == null)
+            {
+                w.Failure("domain not found");
+                return;
+            }
+            w.Raw(proxy.ProcessRequest(req.ToArray()));
+        }
 
-                    catch (OperationCanceledException) 
-                    { 
-                        break;
-                    }
 
-                    catch (ObjectDisposedException) 
-                    { 
-                        break; 
-                    }
+        private static DomainProxy FindProxy(string domainId)
+        {
+            if (!domains.TryGetValue(domainId, out var rec))
+            {
+                return null;
+            }
 
-                    catch (Exception)
-                    {
-                        try 
-                        { 
-                            pipe?.Dispose(); 
-                        } 
-                        catch { }
-                        Thread.Sleep(50);
-                    }
+            var proxy = rec.Proxy;
+            if (proxy == null)
+            {
+                // Still being created: wait for that domain only.
+                lock (rec)
+                {
+                    proxy = rec.Proxy;
                 }
             }
+            return proxy;
         }
 
 
-        private static string ProcessRequest(string reqJson)
+        private static bool UnloadDomain(string domainId)
         {
-            try
+            if (!domains.TryGetValue(domainId, out var rec))
             {
-                var req = JObject.Parse(reqJson);
-                string token = (string)req["authToken"];
-
-                if (authToken != null && token != authToken)
-                {
-                    return new JObject
-                    {
-                        ["success"] = false,
-                        ["error"] = "Unauthorized"
-                    }.ToString(Newtonsoft.Json.Formatting.None);
-                }
-                string cmd = (string)req["cmd"] ?? "";
-
-                JObject resp;
-                switch (cmd)
-                {
-                    case "createDomain": resp = Cmd_CreateDomain(req); break;
-                    case "unloadDomain": resp = Cmd_UnloadDomain(req); break;
-                    case "loadFromFile": resp = Cmd_LoadFromFile(req); break;
-                    case "loadFromMemory": resp = Cmd_LoadFromMemory(req); break;
-                    case "createInstance": resp = Cmd_CreateInstance(req); break;
-                    case "invokeStatic": resp = Cmd_InvokeStatic(req); break;
-                    case "invokeInstance": resp = Cmd_InvokeInstance(req); break;; 
-                    case "releaseInstance": resp = Cmd_ReleaseInstance(req); break;
-                    case "runWpfApp": resp = Cmd_RunWpfApp(req); break;
-                    case "stopWpfApp": resp = Cmd_StopWpfApp(req); break;
-                    case "stopServer": resp = new JObject { ["success"] = true }; StopServer(); break;
-                    default: resp = new JObject { ["success"] = false, ["error"] = "Unknown cmd: " + cmd }; break;
-                }
-                return resp.ToString(Newtonsoft.Json.Formatting.None);
+                return false;
             }
-            catch (Exception ex)
+
+            lock (rec)
             {
-                var j = new JObject { ["success"] = false, ["error"] = ex.ToString() };
-                return j.ToString(Newtonsoft.Json.Formatting.None);
+                if (rec.Proxy == null)
+                {
+                    return false;
+                }
+
+                rec.Proxy.StopServer();
+                AppDomain.Unload(rec.Domain);
+                rec.Proxy = null;
+                domains.TryRemove(domainId, out _);
+                return true;
             }
         }
 
 
         #region Command implementations
 
-        private static JObject Cmd_CreateDomain(JObject req)
+        private static void Cmd_CreateDomain(Request req, ResponseWriter w)
         {
-            string requestedId = (string)req["domainId"];
+            string requestedId = req.DomainId;
             string domainId = string.IsNullOrEmpty(requestedId) ? Guid.NewGuid().ToString("N") : requestedId;
 
-            lock (sync)
+            var rec = new DomainRecord { Id = domainId };
+            lock (rec)
             {
-                if (domains.ContainsKey(domainId))
+                if (!domains.TryAdd(domainId, rec))
                 {
-                    return JObject.FromObject(new { success = false, error = "Domain already exists: " + domainId });
+                    w.Failure("Domain already exists: " + domainId);
+                    return;
                 }
-                    
-                var setup = new AppDomainSetup { ApplicationBase = AppDomain.CurrentDomain.SetupInformation.ApplicationBase };
-                var evidence = AppDomain.CurrentDomain.Evidence;
-                PermissionSet permSet = new PermissionSet(PermissionState.Unrestricted);
 
-                string domName = "ManagedBridgeDomain_" + domainId;
-                var domain = AppDomain.CreateDomain(domName, evidence, setup, permSet);
+                try
+                {
+                    CreateDomain(rec);
+                }
+                catch
+                {
+                    domains.TryRemove(domainId, out _);
+                    throw;
+                }
+                w.Success()
+                    .Field("domainId", domainId)
+                    .Field("pipeName", rec.PipeName)
+                    .Field("eventPipe", EventChannel.PipeFor(rec.PipeName))
+                    .End();
+            }
+        }
+
+
+        private static void CreateDomain(DomainRecord rec)
+        {
+            var spawned = ClaimPooled() ?? SpawnDomain("ManagedBridgeDomain_" + rec.Id);
+
+            rec.Domain = spawned.Domain;
+            rec.PipeName = spawned.PipeName;
+            rec.Proxy = spawned.Proxy;
+        }
+
+
+        private static DomainRecord SpawnDomain(string friendlyName)
+        {
+            var setup = new AppDomainSetup { ApplicationBase = AppDomain.CurrentDomain.SetupInformation.ApplicationBase };
+            // Lets strong-named GAC assemblies load domain-neutral; LoadFromFile does the rest.
+            if (shareAssemblies)
+            {
+                setup.LoaderOptimization = LoaderOptimization.MultiDomainHost;
+            }
+
+            var evidence = AppDomain.CurrentDomain.Evidence;
+            PermissionSet permSet = new PermissionSet(PermissionState.Unrestricted);
+
+            var domain = AppDomain.CreateDomain(friendlyName, evidence, setup, permSet);
+            try
+            {
                 string clrHelperPath = typeof(DomainProxy).Assembly.Location;
                 object proxyObj = domain.CreateInstanceFromAndUnwrap(clrHelperPath, typeof(DomainProxy).FullName);
 
                 var proxy = (DomainProxy)proxyObj;
-                var rec = new DomainRecord { Id = domainId, Domain = domain, Proxy = proxy };
-                domains[domainId] = rec;
-                return JObject.FromObject(new { success = true, domainId = domainId });
+                string pipeName = serverPipeName + "_" + Guid.NewGuid().ToString("N");
+                proxy.StartServer(new DomainSettings
+                {
+                    PipeName = pipeName,
+                    AuthToken = authToken,
+                    Workers = domainWorkers,
+                    ShareAssemblies = shareAssemblies,
+                    ResultCacheEntries = resultCacheEntries,
+                    ResultCacheBytes = resultCacheBytes,
+                    Epoch = Guid.NewGuid().ToString("N"),
+                    Timing = serverTiming,
+                    MaxQueueDepth = maxQueueDepth,
+                    MaxInFlight = maxInFlight
+                });
+
+                return new DomainRecord { Domain = domain, PipeName = pipeName, Proxy = proxy };
+            }
+            catch
+            {
+                AppDomain.Unload(domain);
+                throw;
             }
         }
 
 
-        private static JObject Cmd_UnloadDomain(JObject req)
+        private static void Cmd_UnloadDomain(Request req, ResponseWriter w)
         {
-            string domainId = (string)req["domainId"];
+            string domainId = req.DomainId;
             if (string.IsNullOrEmpty(domainId))
             {
-                return JObject.FromObject(new { success = false, error = "domainId missing" });
+                w.Failure("domainId missing");
+                return;
             }          
 
-            lock (sync)
+            try
             {
-                if (!domains.TryGetValue(domainId, out var rec))
+                if (!UnloadDomain(domainId))
                 {
-                    return JObject.FromObject(new { success = false, error = "domain not found" });
+                    w.Failure("domain not found");
+                    return;
                 }
-                    
+            }
+
+            catch (Exception ex)
+            {
+                w.Failure("Unload failed: " + ex.Message);
+                return;
+            }
+
+            GcScheduler.OnUnload();
+            w.Success().End();
+        }
+
+
+        private static void Cmd_GetStats(Request req, ResponseWriter w)
+        {
+            var perDomain = new JObject();
+            foreach (var rec in domains.Values)
+            {
+                var proxy = rec.Proxy;
+                if (proxy == null)
+                {
+                    continue;
+                }
+
                 try
                 {
+                    perDomain[rec.Id] = JObject.Parse(proxy.GetStats());
+                }
+                catch { }
+            }
+
+            w.Success()
+                .Field("domains", domains.Count)
+                .Field("domainStats", perDomain)
+                .Field("pool", PoolSnapshot())
+                .Field("gc", GcScheduler.Snapshot())
+                .Field("queue", server?.Snapshot() ?? new JObject())
+                .End();
+        }
+
+
+        // Served here rather than on the domain pipe, where it would queue behind the very call it cancels.
+        private static void Cmd_Cancel(Request req, ResponseWriter w)
+        {
+            var proxy = string.IsNullOrEmpty(req.DomainId) ? null : FindProxy(req.DomainId);
+            if (proxy == null)
+            {
+                w.Failure("domain not found");
+                return;
+            }
+            w.Success().Field("cancelled", proxy.Cancel(req.CancelId)).End();
+        }
+        #endregion
+
+
+        #region Domain pool
+
+        private static int poolSize;
+        private static int poolSerial;
+        private static volatile bool poolRunning;
+        private static Thread poolThread;
+        private static readonly ConcurrentQueue<DomainRecord> pool = new ConcurrentQueue<DomainRecord>();
+        private static readonly AutoResetEvent poolRefill = new AutoResetEvent(false);
+
+        private static long poolHits;
+        private static long poolMisses;
+        private static long poolWarmed;
+        private static long poolWarmupTicks;
+        private static long poolLastWarmupTicks;
+
+        private static void StartPool()
+        {
+            if (poolSize <= 0)
+            {
+                return;
+            }
+
+            poolRunning = true;
+            poolThread = new Thread(PoolLoop) { IsBackground = true, Priority = ThreadPriority.BelowNormal };
+            poolThread.Start();
+            poolRefill.Set();
+        }
+
+
+        private static void StopPool()
+        {
+            if (poolThread == null)
+            {
+                return;
+            }
+
+            poolRunning = false;
+            poolRefill.Set();
+            poolThread.Join(5000);
+            poolThread = null;
+
+            while (pool.TryDequeue(out var rec))
+            {
+                try
+                {
+                    rec.Proxy.StopServer();
                     AppDomain.Unload(rec.Domain);
                 }
+                catch { }
+            }
+        }
 
-                catch (Exception ex)
+
+        private static void PoolLoop()
+        {
+            while (poolRunning)
+            {
+                poolRefill.WaitOne();
+
+                while (poolRunning && pool.Count < poolSize)
                 {
-                    return JObject.FromObject(new { success = false, error = "Unload failed: " + ex.Message });
+                    long start = Stopwatch.GetTimestamp();
+                    DomainRecord rec;
+                    try
+                    {
+                        rec = SpawnDomain("ManagedBridgeDomain_pool_" + Interlocked.Increment(ref poolSerial));
+                    }
+                    catch
+                    {
+                        Thread.Sleep(1000);
+                        break;
+                    }
+
+                    long elapsed = Stopwatch.GetTimestamp() - start;
+                    Interlocked.Increment(ref poolWarmed);
+                    Interlocked.Add(ref poolWarmupTicks, elapsed);
+                    Interlocked.Exchange(ref poolLastWarmupTicks, elapsed);
+                    pool.Enqueue(rec);
                 }
+            }
+        }
+
+
+        private static DomainRecord ClaimPooled()
+        {
+            if (poolSize <= 0)
+            {
+                return null;
+            }
+
+            poolRefill.Set();
+            if (pool.TryDequeue(out var rec))
+            {
+                Interlocked.Increment(ref poolHits);
+                return rec;
+            }
+
+            Interlocked.Increment(ref poolMisses);
+            return null;
+        }
+
+
+        private static JObject PoolSnapshot()
+        {
+            long warmed = Interlocked.Read(ref poolWarmed);
+            return new JObject
+            {
+                ["size"] = poolSize,
+                ["available"] = pool.Count,
+                ["hits"] = Interlocked.Read(ref poolHits),
+                ["misses"] = Interlocked.Read(ref poolMisses),
+                ["warmed"] = warmed,
+                ["avgWarmupMs"] = warmed == 0 ? 0.0 : Interlocked.Read(ref poolWarmupTicks) * 1000.0 / Stopwatch.Frequency / warmed,
+                ["lastWarmupMs"] = Interlocked.Read(ref poolLastWarmupTicks) * 1000.0 / Stopwatch.Frequency
+            };
+        }
+        #endregion
+    }
+
+    [Serializable]
+    public class DomainSettings
+    {
+        public string PipeName;
+        public string AuthToken;
+        public int Workers;
+        public bool ShareAssemblies;
+        public int ResultCacheEntries;
+        public long ResultCacheBytes;
+        public string Epoch;
+        public bool Timing;
+        public int MaxQueueDepth;
+        public int MaxInFlight;
+    }
+
+    public class DomainProxy : MarshalByRefObject
+    {
+        static DomainProxy()
+        {
+            AppDomain.CurrentDomain.AssemblyResolve += CurrentDomain_AssemblyResolve;
+        }
 
-                domains.Remove(domainId);
-                GC.Collect();
-                return JObject.FromObject(new { success = true });
+        private static Assembly CurrentDomain_AssemblyResolve(object sender, ResolveEventArgs args)
+        {
+            if (args.Name.StartsWith("Managed_Bridge,") || args.RequestingAssembly?.FullName.StartsWith("Managed_Bridge,") == true)
+            {
+                Assembly executingAsm = Assembly.GetExecutingAssembly();
+
+                if (executingAsm.FullName.StartsWith("Managed_Bridge,"))
+                {
+                    return executingAsm;
+                }
+                    
+                foreach (Assembly asm in AppDomain.CurrentDomain.GetAssemblies())
+                {
+                    if (asm.FullName.StartsWith("Managed_Bridge,"))
+                    {
+                        return asm;
+                    }
+                }
             }
+            return null;
+        }
+
+        public override object InitializeLifetimeService() => null;
+        ConcurrentDictionary<string, Assembly> assemblies = new ConcurrentDictionary<string, Assembly>(StringComparer.OrdinalIgnoreCase);
+        HandleTable<object> instances = new HandleTable<object>();
+        ConcurrentDictionary<string, InvokeTarget> methodCache = new ConcurrentDictionary<string, InvokeTarget>(StringComparer.OrdinalIgnoreCase);
+        ConcurrentDictionary<string, Dictionary<string, Type>> typeIndex = new ConcurrentDictionary<string, Dictionary<string, Type>>(StringComparer.OrdinalIgnoreCase);
+        ConcurrentDictionary<string, Type> resolvedTypes = new ConcurrentDictionary<string, Type>(StringComparer.Ordinal);
+        ConcurrentDictionary<string, bool> cacheableMethods = new ConcurrentDictionary<string, bool>(StringComparer.Ordinal);
+        CancellationRegistry cancellations = new CancellationRegistry();
+        private long batchReleased;
+        ResultCache results;
+        string epoch;
+        long version;
+
+        private const BindingFlags StaticFlags = BindingFlags.Public | BindingFlags.NonPublic | BindingFlags.Static;
+        private const BindingFlags InstanceFlags = BindingFlags.Public | BindingFlags.NonPublic | BindingFlags.Instance;
+
+        private PipeServer server;
+        private EventChannel events;
+        private byte[] authTokenBytes;
+        private bool shareAssemblies;
+        private bool timingEnabled;
+
+        public void StartServer(DomainSettings settings)
+        {
+            authTokenBytes = settings.AuthToken == null ? null : Encoding.UTF8.GetBytes(settings.AuthToken);
+            shareAssemblies = settings.ShareAssemblies;
+            results = new ResultCache(settings.ResultCacheEntries, settings.ResultCacheBytes);
+            epoch = settings.Epoch;
+            timingEnabled = settings.Timing;
+            server = new PipeServer(settings.PipeName, settings.Workers, ProcessRequest, timingEnabled, settings.MaxQueueDepth, settings.MaxInFlight);
+            server.Start();
+
+            // NativeEvents is static per AppDomain, so code loaded here raises into this channel.
+            events = new EventChannel(EventChannel.PipeFor(settings.PipeName), authTokenBytes);
+            events.Start();
+            NativeEvents.Channel = events;
+        }
+
+
+        public void StopServer()
+        {
+            NativeEvents.Channel = null;
+            events?.Stop(1000);
+            events = null;
+            server?.Stop(1000);
+            server = null;
         }
 
 
-        private static JObject Cmd_LoadFromFile(JObject req)
+        public string GetStats()
         {
-            string domainId = (string)req["domainId"];
-            string path = (string)req["path"];
-            string alias = (string)req["assemblyAlias"];
+            return new JObject
+            {
+                ["instances"] = instances.Count,
+                ["results"] = results.Snapshot(),
+                ["cancellation"] = cancellations.Snapshot(),
+                ["batchReleased"] = Interlocked.Read(ref batchReleased),
+                ["events"] = events?.Snapshot() ?? new JObject(),
+                ["queue"] = server?.Snapshot() ?? new JObject(),
+                ["etag"] = ETag()
+            }.ToString(Newtonsoft.Json.Formatting.None);
+        }
+
+
+        public bool Cancel(long cancelId)
+        {
+            return cancellations.Cancel(cancelId);
+        }
+
+
+        [ThreadStatic]
+        private static ResponseWriter routedWriter;
+        [ThreadStatic]
+        private static Request routedRequest;
 
-            if (string.IsNullOrEmpty(domainId) || string.IsNullOrEmpty(path))
+        // Entry point for requests routed from the default domain; both directions cross as raw bytes.
+        public byte[] ProcessRequest(byte[] request)
+        {
+            var w = routedWriter ?? (routedWriter = new ResponseWriter());
+            var req = routedRequest ?? (routedRequest = new Request());
+
+            req.Timing = w.Timing = timingEnabled ? (req.Timing ?? new RequestTiming()) : null;
+            req.Timing?.Reset();
+
+            try
             {
-                return JObject.FromObject(new { success = false, error = "domainId/path required" });
+                RequestReader.Parse(request, request.Length, req);
             }
-                
-            lock (sync) {
-                if (!domains.TryGetValue(domainId, out var rec))
+            catch (FormatException ex)
+            {
+                w.Failure(ex.Message);
+                return w.ToArray();
+            }
+
+            ProcessRequest(req, w);
+            return w.ToArray();
+        }
+
+
+        private void ProcessRequest(Request req, ResponseWriter w)
+        {
+            try
+            {
+                if (!req.TokenMatches(authTokenBytes))
+                {
+                    w.Failure("Unauthorized");
+                    return;
+                }
+
+                // Releases the client queued up ride along on whatever request goes to the domain next.
+                if (req.Release != null)
+                {
+                    ReleaseBatch(req.Release);
+                }
+
+                if (cancellations.TakeEarly(req.CancelId))
+                {
+                    w.Failure("Cancelled");
+                    return;
+                }
+
+                switch (req.Op)
                 {
-                    return JObject.FromObject(new { success = false, error = "domain not found" });
+                    case Opcode.LoadFromFile: Cmd_LoadFromFile(req, w); break;
+                    case Opcode.LoadFromMemory: Cmd_LoadFromMemory(req, w); break;
+                    case Opcode.CreateInstance: Cmd_CreateInstance(req, w); break;
+                    case Opcode.InvokeStatic: Cmd_InvokeStatic(req, w); break;
+                    case Opcode.InvokeInstance: Cmd_InvokeInstance(req, w); break;
+                    case Opcode.ReleaseInstance: Cmd_ReleaseInstance(req, w); break;
+                    case Opcode.ReleaseInstances: w.Success().End(); break;
+                    case Opcode.ReadCursor: Cmd_ReadCursor(req, w); break;
+                    case Opcode.RunWpfApp: Cmd_RunWpfApp(req, w); break;
+                    case Opcode.StopWpfApp: Cmd_StopWpfApp(req, w); break;
+                    case Opcode.RegisterCacheable: Cmd_RegisterCacheable(req, w); break;
+                    default: w.Failure("Unknown op: " + (int)req.Op); break;
                 }
             }
-                    
+            catch (Exception ex)
+            {
+                w.Failure(ex.ToString());
+            }
+        }
+
+
+        #region Command implementations
+
+        private void Cmd_LoadFromFile(Request req, ResponseWriter w)
+        {
+            string path = req.Path;
+            string alias = req.AssemblyAlias;
+
+            if (string.IsNullOrEmpty(path))
+            {
+                w.Failure("path required");
+                return;
+            }
+
             try
             {
-                string asmName = domains[domainId].Proxy.LoadFromFile(path, alias);
-                return JObject.FromObject(new { success = true, assemblyName = asmName });
+                string asmName = LoadFromFile(path, alias);
+                w.Success().Field("assemblyName", asmName).End();
             }
 
             catch (Exception ex) 
             { 
-                return JObject.FromObject(new { success = false, error = ex.ToString() }); 
+                w.Failure(ex.ToString());
             }
         }
 
 
-        private static JObject Cmd_LoadFromMemory(JObject req)
+        private void Cmd_LoadFromMemory(Request req, ResponseWriter w)
         {
-            string domainId = (string)req["domainId"];
-            string bytesBase64 = (string)req["bytesBase64"];
-            string assemblySimpleName = (string)req["assemblySimpleName"] ?? (string)req["assemblyAlias"];
+            string bytesBase64 = req.BytesBase64;
+            string assemblySimpleName = req.AssemblyAlias;
 
-            if (string.IsNullOrEmpty(domainId) || string.IsNullOrEmpty(bytesBase64))
+            if (string.IsNullOrEmpty(bytesBase64))
             {
-                return JObject.FromObject(new { success = false, error = "domainId/bytesBase64 required" });
+                w.Failure("bytesBase64 required");
+                return;
             }        
 
-            lock (sync) 
-            { 
-                if (!domains.TryGetValue(domainId, out var rec))
-                {
-                    return JObject.FromObject(new { success = false, error = "domain not found" });
-                }
-                    
-            }
-
             try
             {
                 byte[] raw = Convert.FromBase64String(bytesBase64);
-                string asmName = domains[domainId].Proxy.LoadFromMemory(raw, assemblySimpleName);
-                return JObject.FromObject(new { success = true, assemblyName = asmName });
+                string asmName = LoadFromMemory(raw, assemblySimpleName);
+                w.Success().Field("assemblyName", asmName).End();
             }
 
             catch (Exception ex) 
             {
-                return JObject.FromObject(new { success = false, error = ex.ToString() }); 
+                w.Failure(ex.ToString());
             }
         }
 
 
-        private static JObject Cmd_CreateInstance(JObject req)
+        private void Cmd_CreateInstance(Request req, ResponseWriter w)
         {
-            string domainId = (string)req["domainId"];
-            string typeName = (string)req["typeName"];
-            string ctorArgsJson = (string)req["ctorArgsJson"] ?? "null";
+            string assemblyName = req.AssemblyName;
+            string typeName = req.TypeName;
 
-            if (string.IsNullOrEmpty(domainId) || string.IsNullOrEmpty(typeName))
+            if (string.IsNullOrEmpty(typeName))
             {
-                return JObject.FromObject(new { success = false, error = "domainId/typeName required" });
-            }
-                
-            lock (sync) 
-            { 
-                if (!domains.TryGetValue(domainId, out var rec))
-                {
-                    return JObject.FromObject(new { success = false, error = "domain not found" });
-                }                   
+                w.Failure("typeName required");
+                return;
             }
 
             try 
             { 
-                string instId = domains[domainId].Proxy.CreateInstance(typeName, ctorArgsJson); 
-                return JObject.FromObject(new { success = true, instanceId = instId }); 
+                long handle = CreateInstance(assemblyName, typeName, req.Args); 
+                w.Success().Field("instanceHandle", handle).End();
             } 
 
             catch (Exception ex) 
             { 
-                return JObject.FromObject(new { success = false, error = ex.ToString() }); 
+                w.Failure(ex.ToString());
             }
         }
 
 
-        private static JObject Cmd_InvokeStatic(JObject req)
+        private void Cmd_InvokeStatic(Request req, ResponseWriter w)
         {
-            string domainId = (string)req["domainId"];
-            string typeName = (string)req["typeName"];
-            string methodName = (string)req["methodName"];
-            string argsJson = (string)req["argsJson"] ?? "null";
+            string assemblyName = req.AssemblyName;
+            string typeName = req.TypeName;
+            string methodName = req.MethodName;
 
-            if (string.IsNullOrEmpty(domainId) || string.IsNullOrEmpty(typeName) || string.IsNullOrEmpty(methodName))
+            if (string.IsNullOrEmpty(typeName) || string.IsNullOrEmpty(methodName))
             {
-                return JObject.FromObject(new { success = false, error = "domainId/typeName/methodName required" });
-            }
-                
-            lock (sync) 
-            { 
-                if (!domains.TryGetValue(domainId, out var rec))
-                {
-                    return JObject.FromObject(new { success = false, error = "domain not found" });
-                }                    
+                w.Failure("typeName/methodName required");
+                return;
             }
 
             try 
             {
-                object result = domains[domainId].Proxy.InvokeStatic(typeName, methodName, argsJson); 
-                return JObject.FromObject(new { success = true, result = result });             
+                var timing = req.Timing;
+                timing?.Start();
+
+                Type type = ResolveType(assemblyName, typeName) ?? throw new TypeLoadException("Type not found: " + typeName);
+                var target = FindTarget(type, methodName, ArgumentReader.Count(req.Args), StaticFlags);
+                if (timing != null)
+                {
+                    timing.Resolve = timing.Lap();
+                }
+
+                // A streamed result is never memoized: that would materialize it.
+                if (!IsCacheable(target) || req.Chunk > 0)
+                {
+                    WriteResult(req, w, Invoke(target, null, req));
+                    return;
+                }
+
+                // Taken before invoking, so a load racing with this call can only make the tag older.
+                string etag = ETag();
+                if (req.IfNoneMatch == etag)
+                {
+                    w.Success().Field("notModified", true).Field("etag", etag).End();
+                    return;
+                }
+
+                if (!results.TryGet(target.Key, req.Args, out string cached))
+                {
+                    object result = Invoke(target, null, req);
+                    cached = ResultCache.Serialize(result);
+                    results.Add(target.Key, req.Args, cached);
+                    if (timing != null)
+                    {
+                        timing.Serialize = timing.Lap();
+                    }
+                }
+                w.Success().Field("etag", etag).RawResult(cached).End();
             }
 
             catch (Exception ex) 
             { 
-                return JObject.FromObject(new { success = false, error = ex.ToString() }); 
+                w.Failure(ex.ToString());
             }
         }
 
-        private static JObject Cmd_InvokeInstance(JObject req)
+
+        private void Cmd_InvokeInstance(Request req, ResponseWriter w)
         {
-            string domainId = (string)req["domainId"];
-            string instanceId = (string)req["instanceId"];
-            string methodName = (string)req["methodName"];
-            string argsJson = (string)req["argsJson"] ?? "null";
+            long instanceHandle = req.InstanceHandle;
+            string methodName = req.MethodName;
 
-            if (string.IsNullOrEmpty(domainId) || string.IsNullOrEmpty(instanceId) || string.IsNullOrEmpty(methodName))
+            if (instanceHandle == 0 || string.IsNullOrEmpty(methodName))
             {
-                return JObject.FromObject(new { success = false, error = "domainId/instanceId/methodName required" });
+                w.Failure("instanceHandle/methodName required");
+                return;
             }          
 
-            lock (sync) 
-            { 
-                if (!domains.TryGetValue(domainId, out var rec))
+            try 
+            {
+                var timing = req.Timing;
+                timing?.Start();
+
+                if (!instances.TryGet(instanceHandle, out object instance))
                 {
-                    return JObject.FromObject(new { success = false, error = "domain not found" });
-                }              
-            }
+                    throw new ArgumentException("Instance handle not found: " + instanceHandle);
+                }
+                if (timing != null)
+                {
+                    timing.Lookup = timing.Lap();
+                }
 
-            try 
-            { 
-                object result = domains[domainId].Proxy.InvokeInstance(instanceId, methodName, argsJson); 
-                return JObject.FromObject(new { success = true, result = result }); 
+                var target = FindTarget(instance.GetType(), methodName, ArgumentReader.Count(req.Args), InstanceFlags);
+                if (timing != null)
+                {
+                    timing.Resolve = timing.Lap();
+                }
+
+                WriteResult(req, w, Invoke(target, instance, req));
             }
 
             catch (Exception ex) 
             { 
-                return JObject.FromObject(new { success = false, error = ex.ToString() }); 
+                w.Failure(ex.ToString());
             }
         }
 
-        private static JObject Cmd_ReleaseInstance(JObject req)
+
+        private void Cmd_ReleaseInstance(Request req, ResponseWriter w)
         {
-            string domainId = (string)req["domainId"];
-            string instanceId = (string)req["instanceId"];
-            if (string.IsNullOrEmpty(domainId) || string.IsNullOrEmpty(instanceId))
+            long instanceHandle = req.InstanceHandle;
+            if (instanceHandle == 0)
             {
-                return JObject.FromObject(new { success = false, error = "domainId/instanceId required" });
-            }
-                
-            lock (sync) 
-            { 
-                if (!domains.TryGetValue(domainId, out var rec))
-                {
-                    return JObject.FromObject(new { success = false, error = "domain not found" });
-                }
-                    
+                w.Failure("instanceHandle required");
+                return;
             }
 
             try 
             { 
-                bool ok = domains[domainId].Proxy.ReleaseInstance(instanceId); 
-                return JObject.FromObject(new { success = ok }); 
+                bool ok = ReleaseInstance(instanceHandle); 
+                w.Start(ok).End();
             } 
 
             catch (Exception ex) 
             { 
-                return JObject.FromObject(new { success = false, error = ex.ToString() }); 
+                w.Failure(ex.ToString());
             }
         }
 
 
-        private static JObject Cmd_RunWpfApp(JObject req)
+        // Next rows of a streamed result. The cursor lives in the instance table, so releasing
+        // its handle (one by one or in a batch) abandons the sequence.
+        private void Cmd_ReadCursor(Request req, ResponseWriter w)
         {
-            string domainId = (string)req["domainId"];
-            string assemblyName = (string)req["assemblyName"];
-            string typeName = (string)req["typeName"] ?? "Main.Program";
-            string methodName = (string)req["methodName"] ?? "main";
-            JArray argsArr = (JArray)req["argsJson"];
-
-            if (string.IsNullOrEmpty(domainId) || string.IsNullOrEmpty(assemblyName))
+            long handle = req.InstanceHandle;
+            if (!instances.TryGet(handle, out object item) || !(item is Cursor cursor))
             {
-                return JObject.FromObject(new { success = false, error = "domainId/assemblyName required" });
+                w.Failure("Cursor not found: " + handle);
+                return;
             }
-                
-            lock (sync) 
+
+            lock (cursor)
             {
-                if (!domains.TryGetValue(domainId, out var rec))
+                try
+                {
+                    w.Success();
+                    bool done = w.Rows(cursor.Rows, req.Chunk > 0 ? req.Chunk : cursor.Chunk, MaxChunkBytes);
+                    if (done)
+                    {
+                        ReleaseInstance(handle);
+                    }
+                    w.Field("done", done).End();
+                }
+                catch (Exception ex)
                 {
-                    return JObject.FromObject(new { success = false, error = "domain not found" });
-                }                  
+                    ReleaseInstance(handle);
+                    w.Failure(ex.ToString());
+                }
+            }
+        }
+
+
+        private void Cmd_RunWpfApp(Request req, ResponseWriter w)
+        {
+            string assemblyName = req.AssemblyName;
+            string typeName = req.TypeName ?? "Main.Program";
+            string methodName = req.MethodName ?? "main";
+
+            if (string.IsNullOrEmpty(assemblyName))
+            {
+                w.Failure("assemblyName required");
+                return;
             }
 
             try
             {
                 string asmName = assemblyName;
-                string[] args = argsArr?.Select(a => (string)a).ToArray() ?? new string[0];
-                domains[domainId].Proxy.RunWpfApp(asmName, typeName, methodName, args);
-                return JObject.FromObject(new { success = true, assemblyName = asmName, message = "WPF application started" });
+                string[] args = ArgumentReader.ReadAs<string[]>(req.Args) ?? new string[0];
+                RunWpfApp(asmName, typeName, methodName, args);
+                w.Success().Field("assemblyName", asmName).Field("message", "WPF application started").End();
             }
 
             catch (Exception ex) 
             { 
-                return JObject.FromObject(new { success = false, error = ex.ToString() }); 
+                w.Failure(ex.ToString());
             }
         }
 
-        private static JObject Cmd_StopWpfApp(JObject req)
+
+        private void Cmd_StopWpfApp(Request req, ResponseWriter w)
         {
-            string domainId = (string)req["domainId"];
-            string alias = (string)req["assemblyAlias"];
+            string alias = req.AssemblyAlias;
 
-            if (string.IsNullOrEmpty(domainId) || string.IsNullOrEmpty(alias))
+            if (string.IsNullOrEmpty(alias))
             {
-                return JObject.FromObject(new { success = false, error = "domainId/assemblyAlias required" });
+                w.Failure("assemblyAlias required");
+                return;
             }        
 
-            lock (sync)
+            try
             {
-                if (!domains.TryGetValue(domainId, out var rec))
-                {
-                    return JObject.FromObject(new { success = false, error = "domain not found" });
-                }                   
-
-                try
-                {
-                    rec.Proxy.StopWpfApp(alias);
-                    return JObject.FromObject(new { success = true });
-                }
+                StopWpfApp(alias);
+                w.Success().End();
+            }
 
-                catch (Exception ex)
-                {
-                    return JObject.FromObject(new { success = false, error = ex.ToString() });
-                }
+            catch (Exception ex)
+            {
+                w.Failure(ex.ToString());
             }
         }
-        #endregion
-    }
 
-    public class DomainProxy : MarshalByRefObject
-    {
-        static DomainProxy()
-        {
-            AppDomain.CurrentDomain.AssemblyResolve += CurrentDomain_AssemblyResolve;
-        }
 
-        private static Assembly CurrentDomain_AssemblyResolve(object sender, ResolveEventArgs args)
+        private void Cmd_RegisterCacheable(Request req, ResponseWriter w)
         {
-            if (args.Name.StartsWith("Managed_Bridge,") || args.RequestingAssembly?.FullName.StartsWith("Managed_Bridge,") == true)
+            string typeName = req.TypeName;
+            string methodName = req.MethodName;
+
+            if (string.IsNullOrEmpty(typeName) || string.IsNullOrEmpty(methodName))
             {
-                Assembly executingAsm = Assembly.GetExecutingAssembly();
+                w.Failure("typeName/methodName required");
+                return;
+            }
 
-                if (executingAsm.FullName.StartsWith("Managed_Bridge,"))
-                {
-                    return executingAsm;
-                }
-                    
-                foreach (Assembly asm in AppDomain.CurrentDomain.GetAssemblies())
+            try
+            {
+                Type type = ResolveType(req.AssemblyName, typeName) ?? throw new TypeLoadException("Type not found: " + typeName);
+                if (!type.GetMethods(StaticFlags).Any(m => m.Name == methodName))
                 {
-                    if (asm.FullName.StartsWith("Managed_Bridge,"))
-                    {
-                        return asm;
-                    }
+                    w.Failure($"Static method {typeName}.{methodName} not found");
+                    return;
                 }
+
+                cacheableMethods[type.FullName + "." + methodName] = true;
+                w.Success().End();
+            }
+
+            catch (Exception ex)
+            {
+                w.Failure(ex.ToString());
             }
-            return null;
         }
+        #endregion
 
-        public override object InitializeLifetimeService() => null;
-        Dictionary<string, Assembly> assemblies = new Dictionary<string, Assembly>(StringComparer.OrdinalIgnoreCase);
-        Dictionary<string, object> instances = new Dictionary<string, object>();
-        Dictionary<string, MethodInfo> methodCache = new Dictionary<string, MethodInfo>(StringComparer.OrdinalIgnoreCase);
 
         public string LoadFromFile(string path, string alias = null)
         {
@@ -593,11 +1008,18 @@ namespace MANAGED_Bridge
             {
                 throw new FileNotFoundException("File not found: " + path);
             }
-                
-            byte[] raw = File.ReadAllBytes(path);
-            Assembly asm = Assembly.Load(raw);
+
+            // Shared mode loads through Assembly.LoadFrom: the image is mapped from the file, so the
+            // domains share its pages rather than each holding a byte[] copy, but each domain still
+            // JIT-compiles it and builds its own type state. Only strong-named GAC assemblies are
+            // loaded domain-neutral under MultiDomainHost. LoadFrom also locks the file while the
+            // domain lives, binds in the LoadFrom context (its dependencies resolve from the same
+            // directory), and returns an assembly of the same identity already loaded in the
+            // domain instead of the file's contents. Otherwise every domain loads its own copy.
+            Assembly asm = shareAssemblies ? Assembly.LoadFrom(path) : Assembly.Load(File.ReadAllBytes(path));
             string name = !string.IsNullOrEmpty(alias) ? alias : asm.GetName().Name;
             assemblies[name] = asm;
+            IndexAssembly(name, asm);
             return name;
         }
 
@@ -613,35 +1035,27 @@ namespace MANAGED_Bridge
             }
                 
             assemblies[name] = asm;
+            IndexAssembly(name, asm);
             return name;
         }
 
 
-        public string CreateInstance(string typeName, string ctorArgsJson)
+        public long CreateInstance(string assemblyAlias, string typeName, ArraySegment<byte> ctorArgsJson)
         {
-            Type t = ResolveType(typeName) ?? throw new TypeLoadException("Type not found: " + typeName);
+            Type t = ResolveType(assemblyAlias, typeName) ?? throw new TypeLoadException("Type not found: " + typeName);
 
-            if (string.IsNullOrWhiteSpace(ctorArgsJson) || ctorArgsJson == "null")
-            {
-                ctorArgsJson = "[]";
-            }
-                
-            var objArr = Newtonsoft.Json.JsonConvert.DeserializeObject<object[]>(ctorArgsJson) ?? new object[0];
+            int argCount = ArgumentReader.Count(ctorArgsJson);
             ConstructorInfo targetCtor = null;
             object[] finalArgs = null;
 
             foreach (var ctor in t.GetConstructors(BindingFlags.Public | BindingFlags.NonPublic | BindingFlags.Instance))
             {
                 var pInfos = ctor.GetParameters();
-                if (pInfos.Length == objArr.Length)
+                if (pInfos.Length == argCount)
                 {
                     try
                     {
-                        finalArgs = new object[pInfos.Length];
-                        for (int i = 0; i < pInfos.Length; i++)
-                        {
-                            finalArgs[i] = Newtonsoft.Json.JsonConvert.DeserializeObject(Newtonsoft.Json.JsonConvert.SerializeObject(objArr[i]),pInfos[i].ParameterType);
-                        }
+                        finalArgs = ArgumentReader.Read(ctorArgsJson, pInfos.Select(p => p.ParameterType).ToArray());
                         targetCtor = ctor;
                         break;
                     }
@@ -651,69 +1065,133 @@ namespace MANAGED_Bridge
 
             if (targetCtor == null)
             {
-                throw new MissingMethodException($"Constructor for {typeName} with argument count {objArr.Length} not found");
+                throw new MissingMethodException($"Constructor for {typeName} with argument count {argCount} not found");
             }
                 
             object inst = targetCtor.Invoke(finalArgs);
-            string id = "inst_" + Guid.NewGuid().ToString("N");
-            instances[id] = inst;
-            return id;
+            return instances.Add(inst);
         }
 
 
-        public bool ReleaseInstance(string id)
+        public bool ReleaseInstance(long handle)
         {
-            if (instances.ContainsKey(id))
+            if (!instances.Remove(handle, out object item))
             {
-                instances.Remove(id);
-                return true;
+                return false;
+            }
+            (item as Cursor)?.Dispose();
+            return true;
+        }
+
+
+        // Handles already gone (released twice, or from before a restart) are skipped.
+        private void ReleaseBatch(long[] handles)
+        {
+            int released = 0;
+            foreach (long handle in handles)
+            {
+                if (handle != 0 && ReleaseInstance(handle))
+                {
+                    released++;
+                }
             }
-            return false;
+            Interlocked.Add(ref batchReleased, released);
         }
 
 
-        public object InvokeStatic(string typeName, string methodName, string argsJson)
+        public object InvokeStatic(string assemblyAlias, string typeName, string methodName, ArraySegment<byte> argsJson)
         {
-            Type type = ResolveType(typeName) ?? throw new TypeLoadException("Type not found: " + typeName);
-            var flags = BindingFlags.Public | BindingFlags.NonPublic | BindingFlags.Static;
-            return CoreInvoke(type, null, methodName, argsJson, flags);
+            Type type = ResolveType(assemblyAlias, typeName) ?? throw new TypeLoadException("Type not found: " + typeName);
+            return CoreInvoke(type, null, methodName, argsJson, StaticFlags);
         }
 
 
-        public object InvokeInstance(string instanceId, string methodName, string argsJson)
+        public object InvokeInstance(long instanceHandle, string methodName, ArraySegment<byte> argsJson)
         {
-            if (!instances.TryGetValue(instanceId, out object target))
+            if (!instances.TryGet(instanceHandle, out object target))
             {
-                throw new ArgumentException("InstanceId not found: " + instanceId);
+                throw new ArgumentException("Instance handle not found: " + instanceHandle);
             }
                 
-            Type type = target.GetType();
-            var flags = BindingFlags.Public | BindingFlags.NonPublic | BindingFlags.Instance;
-            return CoreInvoke(type, target, methodName, argsJson, flags);
+            return CoreInvoke(target.GetType(), target, methodName, argsJson, InstanceFlags);
+        }
+
+
+        private object CoreInvoke(Type type, object target, string methodName, ArraySegment<byte> argsJson, BindingFlags flags)
+        {
+            return Invoke(FindTarget(type, methodName, ArgumentReader.Count(argsJson), flags), target, argsJson);
+        }
+
+
+        // Methods taking a CancellationToken get one that fires at the request deadline or on Cancel.
+        private object Invoke(InvokeTarget method, object target, Request req)
+        {
+            if (method.TokenIndex < 0)
+            {
+                return Invoke(method, target, req.Args, req.Timing);
+            }
+
+            var cts = cancellations.Begin(req.CancelId, req.Deadline);
+            try
+            {
+                return Invoke(method, target, req.Args, req.Timing, cts.Token);
+            }
+            catch (TargetInvocationException ex) when (ex.InnerException is OperationCanceledException && cts.IsCancellationRequested)
+            {
+                throw new OperationCanceledException(req.Expired() ? "Deadline exceeded" : "Cancelled");
+            }
+            finally
+            {
+                cancellations.End(req.CancelId, cts);
+            }
         }
 
 
-        private object CoreInvoke(Type type, object target, string methodName, string argsJson, BindingFlags flags)
+        private static object Invoke(InvokeTarget method, object target, ArraySegment<byte> argsJson, RequestTiming timing = null, CancellationToken token = default(CancellationToken))
         {
-            if (string.IsNullOrWhiteSpace(argsJson) || argsJson == "null")
+            timing?.Start();
+            object[] finalArgs = ArgumentReader.Read(argsJson, method.ParameterTypes, method.TokenIndex < 0 ? 0 : 1);
+            if (method.TokenIndex >= 0)
+            {
+                finalArgs[method.TokenIndex] = token;
+            }
+            if (timing != null)
             {
-                argsJson = "[]";
+                timing.Decode = timing.Lap();
             }
 
-            var objArr = Newtonsoft.Json.JsonConvert.DeserializeObject<object[]>(argsJson) ?? new object[0];
+            object result = method.Method.Invoke(target, finalArgs);
+            if (timing != null)
+            {
+                timing.Invoke = timing.Lap();
+            }
+            return result;
+        }
 
-            string cacheKey = $"{type.FullName}.{methodName}_{objArr.Length}_{flags}";
-            MethodInfo targetMethod = null;
+
+        private InvokeTarget FindTarget(Type type, string methodName, int argCount, BindingFlags flags)
+        {
+            string cacheKey = $"{type.FullName}.{methodName}_{argCount}_{flags}";
+            InvokeTarget targetMethod = null;
 
             if (!methodCache.TryGetValue(cacheKey, out targetMethod))
             {
                 foreach (var method in type.GetMethods(flags).Where(m => m.Name == methodName))
                 {
+                    // A trailing CancellationToken is supplied by the server and not counted.
                     var pInfos = method.GetParameters();
-                    if (pInfos.Length == objArr.Length)
+                    bool takesToken = pInfos.Length == argCount + 1 && pInfos[argCount].ParameterType == typeof(CancellationToken);
+                    if (pInfos.Length == argCount || takesToken)
                     {
-                        targetMethod = method;
-                        methodCache[cacheKey] = method;
+                        targetMethod = new InvokeTarget
+                        {
+                            Method = method,
+                            ParameterTypes = pInfos.Take(argCount).Select(p => p.ParameterType).ToArray(),
+                            TokenIndex = takesToken ? argCount : -1,
+                            Key = type.FullName + "." + methodName,
+                            Cacheable = method.IsStatic && method.GetCustomAttributes(false).Any(a => a.GetType().Name == nameof(CacheableAttribute))
+                        };
+                        methodCache[cacheKey] = targetMethod;
                         break;
                     }
                 }
@@ -721,30 +1199,77 @@ namespace MANAGED_Bridge
 
             if (targetMethod == null)
             {
-                throw new MissingMethodException($"Method {methodName} with {objArr.Length} arguments not found.");
+                throw new MissingMethodException($"Method {methodName} with {argCount} arguments not found.");
             }
+            return targetMethod;
+        }
+
 
-            object[] finalArgs = new object[objArr.Length];
-            var targetParams = targetMethod.GetParameters();
+        private bool IsCacheable(InvokeTarget target)
+        {
+            return target.Cacheable || cacheableMethods.ContainsKey(target.Key);
+        }
+
+
+        // Validator for cacheable results: unique per domain instance, bumped on every assembly load.
+        private string ETag()
+        {
+            return epoch + "." + Interlocked.Read(ref version);
+        }
+
+
+        // Up to req.Chunk rows per reply; the byte bound keeps a reply of wide rows from growing unchecked.
+        private const int MaxChunkBytes = 256 << 10;
 
-            for (int i = 0; i < objArr.Length; i++)
+        // With "chunk" set, a sequence result goes out as its first rows plus, unless that was all
+        // of it, a cursor handle for ReadCursor. Strings, dictionaries and JSON values keep their shape.
+        private void WriteResult(Request req, ResponseWriter w, object result)
+        {
+            if (req.Chunk <= 0 || !(result is IEnumerable sequence) || result is string || result is IDictionary || result is JToken)
             {
-                if (objArr[i] == null)
-                {
-                    finalArgs[i] = null;
-                }
+                w.Success().Result(result).End();
+                return;
+            }
 
-                else if (objArr[i] is JToken jToken)
+            var cursor = new Cursor { Rows = sequence.GetEnumerator(), Chunk = req.Chunk };
+            try
+            {
+                w.Success();
+                if (w.Rows(cursor.Rows, cursor.Chunk, MaxChunkBytes))
                 {
-                    finalArgs[i] = jToken.ToObject(targetParams[i].ParameterType);
+                    cursor.Dispose();
+                    w.Field("done", true).End();
+                    return;
                 }
+                w.Field("done", false).Field("cursor", instances.Add(cursor)).End();
+            }
+            catch
+            {
+                cursor.Dispose();
+                throw;
+            }
+        }
 
-                else
-                {
-                    finalArgs[i] = Convert.ChangeType(objArr[i], targetParams[i].ParameterType);
-                }
+
+        private sealed class Cursor : IDisposable
+        {
+            public IEnumerator Rows;
+            public int Chunk;
+
+            public void Dispose()
+            {
+                (Rows as IDisposable)?.Dispose();
             }
-            return targetMethod.Invoke(target, finalArgs);
+        }
+
+
+        private class InvokeTarget
+        {
+            public MethodInfo Method;
+            public Type[] ParameterTypes;   // the ones bound from the JSON arguments
+            public int TokenIndex = -1;     // position of a trailing CancellationToken, or -1
+            public string Key;
+            public bool Cacheable;
         }
 
 
@@ -755,7 +1280,7 @@ namespace MANAGED_Bridge
             public string Alias;
         }
 
-        private Dictionary<string, WpfInfo> wpfMap = new Dictionary<string, WpfInfo>(StringComparer.OrdinalIgnoreCase);
+        private ConcurrentDictionary<string, WpfInfo> wpfMap = new ConcurrentDictionary<string, WpfInfo>(StringComparer.OrdinalIgnoreCase);
         public void RunWpfApp(string assemblyAlias, string typeName, string methodName, string[] args)
         {
             if (!assemblies.TryGetValue(assemblyAlias, out var asm))
@@ -766,7 +1291,7 @@ namespace MANAGED_Bridge
             var t = asm.GetType(typeName) ?? throw new Exception($"Type not found: {typeName}");
             var mi = t.GetMethod(methodName, BindingFlags.Public | BindingFlags.Static) ?? throw new Exception($"Method not found: {typeName}.{methodName}");
 
-            if (wpfMap.ContainsKey(assemblyAlias) && wpfMap[assemblyAlias].Running)
+            if (wpfMap.TryGetValue(assemblyAlias, out var existing) && existing.Running)
             {
                 throw new InvalidOperationException($"WPF for alias '{assemblyAlias}' already running");
             }
@@ -863,43 +1388,90 @@ namespace MANAGED_Bridge
                 } 
                 catch { }
             }
-            wpfMap.Remove(alias);
+            wpfMap.TryRemove(alias, out _);
+        }
+
+
+        private void IndexAssembly(string alias, Assembly asm)
+        {
+            Type[] types;
+            try
+            {
+                types = asm.GetTypes();
+            }
+            catch (ReflectionTypeLoadException ex)
+            {
+                types = ex.Types;
+            }
+
+            var index = new Dictionary<string, Type>(types.Length, StringComparer.Ordinal);
+            foreach (var t in types)
+            {
+                if (t != null && t.FullName != null)
+                {
+                    index[t.FullName] = t;
+                }
+            }
+
+            typeIndex[alias] = index;
+            resolvedTypes.Clear();
+            results.Clear();
+            Interlocked.Increment(ref version);
         }
 
 
-        private Type ResolveType(string fullName)
+        private Type ResolveType(string assemblyAlias, string fullName)
         {
             if (string.IsNullOrEmpty(fullName))
             {
                 return null;
             }
 
+            if (!string.IsNullOrEmpty(assemblyAlias) && typeIndex.TryGetValue(assemblyAlias, out var index) && index.TryGetValue(fullName, out var indexed))
+            {
+                return indexed;
+            }
+
+            if (resolvedTypes.TryGetValue(fullName, out var cached))
+            {
+                return cached;
+            }
+
+            Type found = null;
             foreach (var asm in assemblies.Values)
             {
                 try
                 {
-                    var t = asm.GetType(fullName, throwOnError: false, ignoreCase: false);
-                    if (t != null)
+                    found = asm.GetType(fullName, throwOnError: false, ignoreCase: false);
+                    if (found != null)
                     {
-                        return t;
+                        break;
                     }
                 }
                 catch { }
             }
 
-            foreach (var asm in AppDomain.CurrentDomain.GetAssemblies())
+            if (found == null)
             {
-                try
+                foreach (var asm in AppDomain.CurrentDomain.GetAssemblies())
                 {
-                    var t = asm.GetType(fullName, throwOnError: false, ignoreCase: false);
-                    if (t != null)
+                    try
                     {
-                        return t;
+                        found = asm.GetType(fullName, throwOnError: false, ignoreCase: false);
+                        if (found != null)
+                        {
+                            break;
+                        }
                     }
+                    catch { }
                 }
-                catch { }
             }
-            return null;
+
+            if (found != null)
+            {
+                resolvedTypes[fullName] = found;
+            }
+            return found;
         }
 
 
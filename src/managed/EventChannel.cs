@@ -0,0 +1,386 @@
+﻿// EventChannel.cs
+
+using Newtonsoft.Json;
+using Newtonsoft.Json.Linq;
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.Pipes;
+using System.Security.AccessControl;
+using System.Security.Principal;
+using System.Text;
+using System.Threading;
+
+
+namespace MANAGED_Bridge
+{
+    // Events for the native subscribers of the current domain (NM_Bridge::Subscribe). Raise
+    // delivers every event in order; Post keeps only the latest payload of a name whose previous
+    // Post has not gone out yet, for state that only matters as its last value.
+    public static class NativeEvents
+    {
+        internal static volatile EventChannel Channel;
+
+        // False when nobody is subscribed or the queue is full: the event is dropped.
+        public static bool Raise(string name, object payload = null)
+        {
+            return Channel?.Enqueue(name, payload, false) ?? false;
+        }
+
+
+        public static bool Post(string name, object payload = null)
+        {
+            return Channel?.Enqueue(name, payload, true) ?? false;
+        }
+    }
+
+
+    // The domain's event pipe. A subscriber connects, sends one Subscribe request and gets a reply;
+    // from then on it only reads messages of the form {"events":[{name, payload, coalesced}], "dropped":n}.
+    // One sender thread writes each batch to every subscriber, and an empty batch after
+    // HeartbeatMs of quiet, so subscribers that went away are noticed.
+    internal sealed class EventChannel
+    {
+        private const int MaxPending = 4096;
+        private const int HeartbeatMs = 5000;
+
+        private sealed class Pending
+        {
+            public string Name;
+            public string Payload;
+            public long Coalesced;
+        }
+
+        private readonly string pipeName;
+        private readonly byte[] authTokenBytes;
+        private readonly object sync = new object();
+        private List<Pending> pending = new List<Pending>();
+        private readonly Dictionary<string, Pending> posted = new Dictionary<string, Pending>(StringComparer.Ordinal);
+        private readonly List<NamedPipeServerStream> subscribers = new List<NamedPipeServerStream>();
+        private readonly AutoResetEvent wake = new AutoResetEvent(false);
+        private PipeSecurity security;
+        private Thread acceptor;
+        private Thread sender;
+        private volatile bool running;
+
+        private long raised;
+        private long coalesced;
+        private long dropped;
+        private long droppedUnsent;     // reported with the next batch
+        private long batches;
+
+        public EventChannel(string pipeName, byte[] authTokenBytes)
+        {
+            this.pipeName = pipeName;
+            this.authTokenBytes = authTokenBytes;
+        }
+
+        public static string PipeFor(string domainPipe) => domainPipe + "_events";
+
+
+        public JObject Snapshot()
+        {
+            lock (sync)
+            {
+                return new JObject
+                {
+                    ["subscribers"] = subscribers.Count,
+                    ["pending"] = pending.Count,
+                    ["raised"] = raised,
+                    ["coalesced"] = coalesced,
+                    ["dropped"] = dropped,
+                    ["batches"] = batches
+                };
+            }
+        }
+
+
+        public void Start()
+        {
+            security = new PipeSecurity();
+            var sid = WindowsIdentity.GetCurrent().User;
+            security.AddAccessRule(new PipeAccessRule(sid, PipeAccessRights.FullControl, AccessControlType.Allow));
+
+            running = true;
+            sender = new Thread(SendLoop) { IsBackground = true };
+            sender.Start();
+            acceptor = new Thread(AcceptLoop) { IsBackground = true };
+            acceptor.Start();
+        }
+
+
+        public void Stop(int timeoutMs)
+        {
+            if (!running)
+            {
+                return;
+            }
+
+            running = false;
+            wake.Set();
+
+            // Wake the acceptor out of WaitForConnection so it can observe the flag.
+            try
+            {
+                using (var client = new NamedPipeClientStream(".", pipeName, PipeDirection.InOut))
+                {
+                    client.Connect(100);
+                }
+            }
+            catch { }
+
+            DateTime deadline = DateTime.UtcNow.AddMilliseconds(timeoutMs);
+            acceptor.Join((int)Math.Max(0, (deadline - DateTime.UtcNow).TotalMilliseconds));
+            sender.Join((int)Math.Max(0, (deadline - DateTime.UtcNow).TotalMilliseconds));
+
+            lock (sync)
+            {
+                foreach (var pipe in subscribers)
+                {
+                    Close(pipe);
+                }
+                subscribers.Clear();
+            }
+        }
+
+
+        public bool Enqueue(string name, object payload, bool coalesce)
+        {
+            if (name == null)
+            {
+                throw new ArgumentNullException(nameof(name));
+            }
+
+            // Serialized now: the object may change before the batch goes out.
+            string json = JsonConvert.SerializeObject(payload);
+            lock (sync)
+            {
+                if (subscribers.Count == 0)
+                {
+                    return false;
+                }
+
+                if (coalesce && posted.TryGetValue(name, out var previous))
+                {
+                    previous.Payload = json;
+                    previous.Coalesced++;
+                    coalesced++;
+                    return true;
+                }
+
+                if (pending.Count >= MaxPending)
+                {
+                    dropped++;
+                    droppedUnsent++;
+                    return false;
+                }
+
+                var e = new Pending { Name = name, Payload = json };
+                pending.Add(e);
+                if (coalesce)
+                {
+                    posted[name] = e;
+                }
+                raised++;
+            }
+
+            wake.Set();
+            return true;
+        }
+
+
+        private void AcceptLoop()
+        {
+            while (running)
+            {
+                NamedPipeServerStream pipe = null;
+                try
+                {
+                    pipe = new NamedPipeServerStream(pipeName, PipeDirection.InOut, NamedPipeServerStream.MaxAllowedServerInstances, PipeTransmissionMode.Message, PipeOptions.None, 4096, 65536, security);
+                    pipe.WaitForConnection();
+
+                    if (!running)
+                    {
+                        pipe.Dispose();
+                        break;
+                    }
+
+                    if (Admit(pipe))
+                    {
+                        lock (sync)
+                        {
+                            subscribers.Add(pipe);
+                        }
+                    }
+                    else
+                    {
+                        Close(pipe);
+                    }
+                }
+
+                catch (ObjectDisposedException)
+                {
+                    break;
+                }
+
+                catch (InvalidOperationException)
+                {
+                    pipe?.Dispose();
+                    break;
+                }
+
+                catch (Exception)
+                {
+                    Close(pipe);
+                    Thread.Sleep(50);
+                }
+            }
+        }
+
+
+        // Reads the Subscribe request and answers it; only a subscriber with the right token is kept.
+        private bool Admit(NamedPipeServerStream pipe)
+        {
+            var ms = new MemoryStream();
+            byte[] buffer = new byte[4096];
+            do
+            {
+                int bytesRead = pipe.Read(buffer, 0, buffer.Length);
+                if (bytesRead == 0)
+                {
+                    return false;
+                }
+                ms.Write(buffer, 0, bytesRead);
+            }
+            while (!pipe.IsMessageComplete);
+
+            string error = null;
+            var req = new Request();
+            try
+            {
+                RequestReader.Parse(ms.GetBuffer(), (int)ms.Length, req);
+                if (!req.TokenMatches(authTokenBytes))
+                {
+                    error = "Unauthorized";
+                }
+                else if (req.Op != Opcode.Subscribe)
+                {
+                    error = "Unknown op: " + (int)req.Op;
+                }
+            }
+            catch (FormatException ex)
+            {
+                error = ex.Message;
+            }
+
+            var w = new ResponseWriter();
+            if (error == null)
+            {
+                w.Success().End();
+            }
+            else
+            {
+                w.Failure(error);
+            }
+            pipe.Write(w.Buffer, 0, w.Length);
+            pipe.Flush();
+            return error == null;
+        }
+
+
+        // A subscriber that stops reading holds up the others once its pipe buffer is full.
+        private void SendLoop()
+        {
+            var next = new List<Pending>();
+            while (running)
+            {
+                wake.WaitOne(HeartbeatMs);
+
+                List<Pending> batch;
+                long lost;
+                NamedPipeServerStream[] targets;
+                lock (sync)
+                {
+                    batch = pending;
+                    pending = next;
+                    posted.Clear();
+                    lost = droppedUnsent;
+                    droppedUnsent = 0;
+                    targets = subscribers.ToArray();
+                    if (batch.Count > 0)
+                    {
+                        batches++;
+                    }
+                }
+
+                if (targets.Length > 0 && running)
+                {
+                    byte[] message = Encode(batch, lost);
+                    foreach (var pipe in targets)
+                    {
+                        try
+                        {
+                            pipe.Write(message, 0, message.Length);
+                            pipe.Flush();
+                        }
+                        catch (Exception)
+                        {
+                            lock (sync)
+                            {
+                                subscribers.Remove(pipe);
+                            }
+                            Close(pipe);
+                        }
+                    }
+                }
+
+                batch.Clear();
+                next = batch;
+            }
+        }
+
+
+        private static byte[] Encode(List<Pending> batch, long lost)
+        {
+            var text = new StringWriter();
+            using (var json = new JsonTextWriter(text) { Formatting = Formatting.None })
+            {
+                json.WriteStartObject();
+                json.WritePropertyName("events");
+                json.WriteStartArray();
+                foreach (var e in batch)
+                {
+                    json.WriteStartObject();
+                    json.WritePropertyName("name");
+                    json.WriteValue(e.Name);
+                    json.WritePropertyName("payload");
+                    json.WriteRawValue(e.Payload);
+                    if (e.Coalesced > 0)
+                    {
+                        json.WritePropertyName("coalesced");
+                        json.WriteValue(e.Coalesced);
+                    }
+                    json.WriteEndObject();
+                }
+                json.WriteEndArray();
+                if (lost > 0)
+                {
+                    json.WritePropertyName("dropped");
+                    json.WriteValue(lost);
+                }
+                json.WriteEndObject();
+            }
+            return Encoding.UTF8.GetBytes(text.ToString());
+        }
+
+
+        private static void Close(NamedPipeServerStream pipe)
+        {
+            try
+            {
+                pipe?.Dispose();
+            }
+            catch { }
+        }
+    }
+}
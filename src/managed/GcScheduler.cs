@@ -0,0 +1,241 @@
+﻿// GcScheduler.cs
+
+using Newtonsoft.Json.Linq;
+using System;
+using System.Diagnostics;
+using System.Runtime;
+using System.Runtime.InteropServices;
+using System.Threading;
+
+
+namespace MANAGED_Bridge
+{
+    internal enum GcPolicy
+    {
+        None,
+        Deferred,
+        EveryN
+    }
+
+
+    // Collections requested by domain unloads and server stop run on a pool thread, so the
+    // command that triggered them is acknowledged without waiting for the GC. They are asked for
+    // as background collections: with concurrent GC enabled, the default, managed threads keep
+    // running while it marks. memoryLoadPercent, if set, skips them unless that much physical
+    // memory is in use.
+    //
+    // A collection that ran blocking (concurrent GC disabled) is over when GC.Collect returns,
+    // and its elapsed time is the pause. A background one is watched from a timer until the
+    // gen-2 count moves; its reclaimed bytes are taken then, and its run time is reported apart
+    // from the pauses, which are not visible from here.
+    internal static class GcScheduler
+    {
+        [StructLayout(LayoutKind.Sequential)]
+        private struct MemoryStatusEx
+        {
+            public uint Length;
+            public uint MemoryLoad;
+            public ulong TotalPhys;
+            public ulong AvailPhys;
+            public ulong TotalPageFile;
+            public ulong AvailPageFile;
+            public ulong TotalVirtual;
+            public ulong AvailVirtual;
+            public ulong AvailExtendedVirtual;
+        }
+
+        [DllImport("kernel32.dll", SetLastError = true)]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        private static extern bool GlobalMemoryStatusEx(ref MemoryStatusEx status);
+
+        private static GcPolicy policy = GcPolicy.Deferred;
+        private static int everyN = 4;
+        private static int memoryLoadPercent;
+        private static int unloadsSinceCollect;
+        private static int scheduled;
+
+        private const int SampleMs = 50;
+        private const int MaxSamples = 200;
+
+        private static long collections;
+        private static long skipped;
+        private static long blocking;
+        private static long pauseTicksTotal;
+        private static long lastPauseTicks;
+        private static long background;
+        private static long lastBackgroundTicks;
+        private static long reclaimedBytesTotal;
+        private static long lastReclaimedBytes;
+        private static int lastMemoryLoad = -1;
+        private static Timer sampler;
+
+        public static void Configure(string policyName, int unloadsPerCollection, int memoryLoadThreshold)
+        {
+            if (!string.IsNullOrEmpty(policyName))
+            {
+                policy = (GcPolicy)Enum.Parse(typeof(GcPolicy), policyName, ignoreCase: true);
+            }
+            everyN = Math.Max(1, unloadsPerCollection);
+            memoryLoadPercent = Math.Max(0, Math.Min(100, memoryLoadThreshold));
+        }
+
+
+        public static void OnUnload()
+        {
+            switch (policy)
+            {
+                case GcPolicy.Deferred:
+                    Schedule();
+                    break;
+
+                case GcPolicy.EveryN:
+                    if (Interlocked.Increment(ref unloadsSinceCollect) >= everyN)
+                    {
+                        Interlocked.Exchange(ref unloadsSinceCollect, 0);
+                        Schedule();
+                    }
+                    break;
+            }
+        }
+
+
+        public static void OnStop()
+        {
+            if (policy != GcPolicy.None)
+            {
+                Schedule();
+            }
+        }
+
+
+        public static JObject Snapshot()
+        {
+            return new JObject
+            {
+                ["policy"] = policy.ToString(),
+                ["everyN"] = everyN,
+                ["pendingUnloads"] = Volatile.Read(ref unloadsSinceCollect),
+                ["scheduled"] = Volatile.Read(ref scheduled) != 0,
+                ["memoryLoadPercent"] = memoryLoadPercent,
+                ["lastMemoryLoad"] = Volatile.Read(ref lastMemoryLoad),
+                ["concurrent"] = GCSettings.LatencyMode != GCLatencyMode.Batch,
+                ["collections"] = Interlocked.Read(ref collections),
+                ["skipped"] = Interlocked.Read(ref skipped),
+                ["blocking"] = Interlocked.Read(ref blocking),
+                ["pauseMsTotal"] = TicksToMs(Interlocked.Read(ref pauseTicksTotal)),
+                ["lastPauseMs"] = TicksToMs(Interlocked.Read(ref lastPauseTicks)),
+                ["background"] = Interlocked.Read(ref background),
+                ["lastBackgroundMs"] = TicksToMs(Interlocked.Read(ref lastBackgroundTicks)),
+                ["reclaimedBytesTotal"] = Interlocked.Read(ref reclaimedBytesTotal),
+                ["lastReclaimedBytes"] = Interlocked.Read(ref lastReclaimedBytes),
+                ["gen2Collections"] = GC.CollectionCount(2)
+            };
+        }
+
+
+        private static void Schedule()
+        {
+            if (Interlocked.Exchange(ref scheduled, 1) == 0)
+            {
+                ThreadPool.QueueUserWorkItem(_ => Collect());
+            }
+        }
+
+
+        private static void Collect()
+        {
+            Interlocked.Exchange(ref scheduled, 0);
+
+            if (!UnderPressure())
+            {
+                Interlocked.Increment(ref skipped);
+                return;
+            }
+
+            long before = GC.GetTotalMemory(false);
+            int gen2 = GC.CollectionCount(2);
+            long start = Stopwatch.GetTimestamp();
+            GC.Collect(GC.MaxGeneration, GCCollectionMode.Forced, blocking: false, compacting: false);
+            long elapsed = Stopwatch.GetTimestamp() - start;
+
+            Interlocked.Increment(ref collections);
+            if (GC.CollectionCount(2) != gen2)
+            {
+                Interlocked.Increment(ref blocking);
+                Interlocked.Add(ref pauseTicksTotal, elapsed);
+                Interlocked.Exchange(ref lastPauseTicks, elapsed);
+                RecordReclaimed(before);
+                return;
+            }
+
+            var pending = new PendingCollection { Before = before, Gen2 = gen2, Start = start };
+            pending.Timer = new Timer(Sample, pending, Timeout.Infinite, Timeout.Infinite);
+            Interlocked.Exchange(ref sampler, pending.Timer)?.Dispose();
+            pending.Timer.Change(SampleMs, SampleMs);
+        }
+
+
+        private sealed class PendingCollection
+        {
+            public long Before;
+            public int Gen2;
+            public long Start;
+            public int Samples;
+            public Timer Timer;
+        }
+
+
+        private static void Sample(object state)
+        {
+            var pending = (PendingCollection)state;
+            bool done = GC.CollectionCount(2) != pending.Gen2;
+            if (!done && ++pending.Samples < MaxSamples)
+            {
+                return;
+            }
+
+            if (Interlocked.CompareExchange(ref sampler, null, pending.Timer) == pending.Timer)
+            {
+                pending.Timer.Dispose();
+            }
+            if (done)
+            {
+                Interlocked.Increment(ref background);
+                Interlocked.Exchange(ref lastBackgroundTicks, Stopwatch.GetTimestamp() - pending.Start);
+                RecordReclaimed(pending.Before);
+            }
+        }
+
+
+        private static void RecordReclaimed(long before)
+        {
+            long reclaimed = Math.Max(0, before - GC.GetTotalMemory(false));
+            Interlocked.Add(ref reclaimedBytesTotal, reclaimed);
+            Interlocked.Exchange(ref lastReclaimedBytes, reclaimed);
+        }
+
+
+        private static bool UnderPressure()
+        {
+            if (memoryLoadPercent == 0)
+            {
+                return true;
+            }
+
+            var status = new MemoryStatusEx { Length = (uint)Marshal.SizeOf(typeof(MemoryStatusEx)) };
+            if (!GlobalMemoryStatusEx(ref status))
+            {
+                return false;
+            }
+
+            Volatile.Write(ref lastMemoryLoad, (int)status.MemoryLoad);
+            return status.MemoryLoad >= memoryLoadPercent;
+        }
+
+
+        private static double TicksToMs(long ticks)
+        {
+            return ticks * 1000.0 / Stopwatch.Frequency;
+        }
+    }
+}
@@ -0,0 +1,117 @@
+﻿// HandleTable.cs
+
+using System;
+
+
+namespace MANAGED_Bridge
+{
+    // Slab of objects addressed by 64-bit handles: the low 32 bits are the slot index,
+    // the high 32 bits the slot generation, so a released handle never aliases a new object.
+    internal sealed class HandleTable<T> where T : class
+    {
+        private struct Slot
+        {
+            public T Item;
+            public int Generation;
+            public int NextFree;
+        }
+
+        private readonly object sync = new object();
+        private Slot[] slots;
+        private int used;
+        private int freeHead = -1;
+        private int live;
+
+        public HandleTable(int capacity = 64)
+        {
+            slots = new Slot[Math.Max(1, capacity)];
+        }
+
+        public int Count
+        {
+            get { lock (sync) { return live; } }
+        }
+
+
+        public long Add(T item)
+        {
+            if (item == null)
+            {
+                throw new ArgumentNullException(nameof(item));
+            }
+
+            lock (sync)
+            {
+                int index;
+                if (freeHead >= 0)
+                {
+                    index = freeHead;
+                    freeHead = slots[index].NextFree;
+                }
+                else
+                {
+                    if (used == slots.Length)
+                    {
+                        Array.Resize(ref slots, slots.Length * 2);
+                    }
+                    index = used++;
+                    slots[index].Generation = 1;
+                }
+
+                slots[index].Item = item;
+                slots[index].NextFree = -1;
+                live++;
+                return ((long)slots[index].Generation << 32) | (uint)index;
+            }
+        }
+
+
+        public bool TryGet(long handle, out T item)
+        {
+            int index = (int)(handle & 0xFFFFFFFF);
+            int generation = (int)(handle >> 32);
+
+            lock (sync)
+            {
+                if ((uint)index < (uint)used && slots[index].Generation == generation && slots[index].Item != null)
+                {
+                    item = slots[index].Item;
+                    return true;
+                }
+            }
+
+            item = null;
+            return false;
+        }
+
+
+        public bool Remove(long handle)
+        {
+            return Remove(handle, out _);
+        }
+
+
+        public bool Remove(long handle, out T item)
+        {
+            item = null;
+            int index = (int)(handle & 0xFFFFFFFF);
+            int generation = (int)(handle >> 32);
+
+            lock (sync)
+            {
+                if ((uint)index >= (uint)used || slots[index].Generation != generation || slots[index].Item == null)
+                {
+                    return false;
+                }
+
+                item = slots[index].Item;
+                slots[index].Item = null;
+                slots[index].Generation = generation == int.MaxValue ? 1 : generation + 1;
+                slots[index].NextFree = freeHead;
+                freeHead = index;
+                live--;
+                return true;
+            }
+        }
+    }
+}
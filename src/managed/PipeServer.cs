@@ -0,0 +1,383 @@
+﻿// PipeServer.cs
+
+using Newtonsoft.Json.Linq;
+using System;
+using System.Collections.Concurrent;
+using System.Diagnostics;
+using System.IO;
+using System.IO.Pipes;
+using System.Security.AccessControl;
+using System.Security.Principal;
+using System.Text;
+using System.Threading;
+
+
+namespace MANAGED_Bridge
+{
+    internal sealed class PipeServer
+    {
+        private readonly string pipeName;
+        private readonly int workerCount;
+        private readonly Action<Request, ResponseWriter> handler;
+        private readonly bool timing;
+        private readonly int maxQueueDepth;
+        private readonly int maxInFlight;
+        private readonly BlockingCollection<Connection> queue = new BlockingCollection<Connection>();
+        private readonly ConcurrentDictionary<Connection, bool> parked = new ConcurrentDictionary<Connection, bool>();
+        private PipeSecurity security;
+        private Thread acceptor;
+        private Thread[] workers;
+        private volatile bool running;
+
+        private int inFlight;               // queued plus being served
+        private int peakInFlight;
+        private int peakQueueDepth;
+        private long rejected;
+
+        // Clients keep connections open between calls. Between messages a connection waits in an
+        // overlapped read instead of a worker; the first chunk of the next message travels in Head.
+        private sealed class Connection
+        {
+            public NamedPipeServerStream Pipe;
+            public readonly byte[] Head = new byte[4096];
+            public int HeadLength;
+            public long At;
+        }
+
+        // maxQueueDepth bounds the requests waiting for a worker, maxInFlight those waiting or
+        // being served; 0 means no bound. Past either one a request is answered "Overloaded" at once.
+        public PipeServer(string pipeName, int workerCount, Action<Request, ResponseWriter> handler, bool timing = false, int maxQueueDepth = 0, int maxInFlight = 0)
+        {
+            this.pipeName = pipeName;
+            this.workerCount = Math.Max(1, workerCount);
+            this.handler = handler;
+            this.timing = timing;
+            this.maxQueueDepth = Math.Max(0, maxQueueDepth);
+            this.maxInFlight = Math.Max(0, maxInFlight);
+        }
+
+        public string PipeName => pipeName;
+
+
+        public JObject Snapshot()
+        {
+            return new JObject
+            {
+                ["queued"] = queue.Count,
+                ["peakQueued"] = Volatile.Read(ref peakQueueDepth),
+                ["inFlight"] = Volatile.Read(ref inFlight),
+                ["peakInFlight"] = Volatile.Read(ref peakInFlight),
+                ["rejected"] = Interlocked.Read(ref rejected),
+                ["maxQueueDepth"] = maxQueueDepth,
+                ["maxInFlight"] = maxInFlight
+            };
+        }
+
+
+        public void Start()
+        {
+            security = new PipeSecurity();
+            var sid = WindowsIdentity.GetCurrent().User;
+            security.AddAccessRule(new PipeAccessRule(sid, PipeAccessRights.FullControl, AccessControlType.Allow));
+
+            running = true;
+            workers = new Thread[workerCount];
+            for (int i = 0; i < workers.Length; i++)
+            {
+                workers[i] = new Thread(WorkerLoop) { IsBackground = true };
+                workers[i].Start();
+            }
+
+            acceptor = new Thread(AcceptLoop) { IsBackground = true };
+            acceptor.Start();
+        }
+
+
+        public void Stop(int timeoutMs)
+        {
+            if (!running)
+            {
+                return;
+            }
+
+            running = false;
+            queue.CompleteAdding();
+
+            foreach (var connection in parked.Keys)
+            {
+                Close(connection);
+            }
+
+            // Wake the acceptor out of WaitForConnection so it can observe the flag.
+            try
+            {
+                using (var wake = new NamedPipeClientStream(".", pipeName, PipeDirection.InOut))
+                {
+                    wake.Connect(100);
+                }
+            }
+            catch { }
+
+            int self = Thread.CurrentThread.ManagedThreadId;
+            DateTime deadline = DateTime.UtcNow.AddMilliseconds(timeoutMs);
+
+            Join(acceptor, self, deadline);
+            foreach (var worker in workers)
+            {
+                Join(worker, self, deadline);
+            }
+        }
+
+
+        private static void Join(Thread thread, int self, DateTime deadline)
+        {
+            if (thread == null || thread.ManagedThreadId == self || !thread.IsAlive)
+            {
+                return;
+            }
+
+            int remaining = (int)Math.Max(0, (deadline - DateTime.UtcNow).TotalMilliseconds);
+            thread.Join(remaining);
+        }
+
+
+        private void AcceptLoop()
+        {
+            while (running)
+            {
+                NamedPipeServerStream pipe = null;
+                try
+                {
+                    pipe = new NamedPipeServerStream(pipeName, PipeDirection.InOut, NamedPipeServerStream.MaxAllowedServerInstances, PipeTransmissionMode.Message, PipeOptions.Asynchronous, 32768, 32768, security);
+                    pipe.WaitForConnection();
+
+                    if (!running)
+                    {
+                        pipe.Dispose();
+                        break;
+                    }
+
+                    Park(new Connection { Pipe = pipe });
+                }
+
+                catch (ObjectDisposedException)
+                {
+                    break;
+                }
+
+                catch (InvalidOperationException)
+                {
+                    pipe?.Dispose();
+                    break;
+                }
+
+                catch (Exception)
+                {
+                    try
+                    {
+                        pipe?.Dispose();
+                    }
+                    catch { }
+                    Thread.Sleep(50);
+                }
+            }
+        }
+
+
+        private void Park(Connection connection)
+        {
+            parked[connection] = true;
+            try
+            {
+                connection.Pipe.BeginRead(connection.Head, 0, connection.Head.Length, OnReadable, connection);
+            }
+            catch (Exception)
+            {
+                parked.TryRemove(connection, out _);
+                Close(connection);
+            }
+        }
+
+
+        private void OnReadable(IAsyncResult ar)
+        {
+            var connection = (Connection)ar.AsyncState;
+            parked.TryRemove(connection, out _);
+
+            try
+            {
+                connection.HeadLength = connection.Pipe.EndRead(ar);
+                if (connection.HeadLength > 0 && running)
+                {
+                    connection.At = Stopwatch.GetTimestamp();
+                    Admit(connection);
+                    return;
+                }
+            }
+            catch (Exception) { }
+
+            // Zero bytes: the client hung up.
+            Close(connection);
+        }
+
+
+        private void Admit(Connection connection)
+        {
+            int now = Interlocked.Increment(ref inFlight);
+            int depth = queue.Count;
+            if ((maxInFlight > 0 && now > maxInFlight) || (maxQueueDepth > 0 && depth >= maxQueueDepth))
+            {
+                Interlocked.Decrement(ref inFlight);
+                Interlocked.Increment(ref rejected);
+                Reject(connection, depth);
+                return;
+            }
+
+            RaisePeak(ref peakInFlight, now);
+            RaisePeak(ref peakQueueDepth, depth + 1);
+            queue.Add(connection);
+        }
+
+
+        // Runs on the I/O thread that saw the message arrive: the rest of it is read and dropped,
+        // then the connection goes back to waiting for the next one.
+        private void Reject(Connection connection, int depth)
+        {
+            try
+            {
+                var pipe = connection.Pipe;
+                int bytesRead = connection.HeadLength;
+                while (!pipe.IsMessageComplete && bytesRead > 0)
+                {
+                    bytesRead = pipe.Read(connection.Head, 0, connection.Head.Length);
+                }
+
+                byte[] reply = Encoding.ASCII.GetBytes("{\"success\":false,\"error\":\"Overloaded\",\"overloaded\":true,\"queue\":" + depth + "}");
+                pipe.Write(reply, 0, reply.Length);
+                pipe.Flush();
+            }
+            catch (Exception)
+            {
+                Close(connection);
+                return;
+            }
+
+            Park(connection);
+        }
+
+
+        private static void RaisePeak(ref int peak, int value)
+        {
+            int seen;
+            while (value > (seen = Volatile.Read(ref peak)) && Interlocked.CompareExchange(ref peak, value, seen) != seen)
+            {
+            }
+        }
+
+
+        private static void Close(Connection connection)
+        {
+            try
+            {
+                connection.Pipe.Dispose();
+            }
+            catch { }
+        }
+
+
+        private void WorkerLoop()
+        {
+            byte[] buffer = new byte[32768];
+            var request = new Request { Timing = timing ? new RequestTiming() : null };
+            var response = new ResponseWriter { Timing = request.Timing };
+            using (var ms = new MemoryStream(32768))
+            {
+                foreach (var connection in queue.GetConsumingEnumerable())
+                {
+                    bool keep = false;
+                    try
+                    {
+                        if (request.Timing != null)
+                        {
+                            request.Timing.AcceptedAt = connection.At;
+                            request.Timing.DequeuedAt = Stopwatch.GetTimestamp();
+                        }
+                        response.QueueDepth = maxQueueDepth > 0 || maxInFlight > 0 ? queue.Count : -1;
+                        Serve(connection, buffer, ms, request, response);
+                        keep = running;
+                    }
+                    catch (Exception) { }
+                    Interlocked.Decrement(ref inFlight);
+
+                    if (keep)
+                    {
+                        Park(connection);
+                    }
+                    else
+                    {
+                        Close(connection);
+                    }
+                }
+            }
+        }
+
+
+        private void Serve(Connection connection, byte[] buffer, MemoryStream ms, Request request, ResponseWriter response)
+        {
+            var pipe = connection.Pipe;
+            ms.SetLength(0);
+            ms.Write(connection.Head, 0, connection.HeadLength);
+
+            int bytesRead = connection.HeadLength;
+            while (!pipe.IsMessageComplete && bytesRead > 0)
+            {
+                bytesRead = pipe.Read(buffer, 0, buffer.Length);
+                if (bytesRead > 0)
+                {
+                    ms.Write(buffer, 0, bytesRead);
+                }
+            }
+
+            response.Clear();
+            var timing = request.Timing;
+            if (timing != null)
+            {
+                timing.Reset();
+                timing.Start();
+                timing.Queued = timing.DequeuedAt - timing.AcceptedAt;
+            }
+
+            bool parsed = false;
+            try
+            {
+                RequestReader.Parse(ms.GetBuffer(), (int)ms.Length, request);
+                parsed = true;
+                if (timing != null)
+                {
+                    timing.Parse = timing.Lap();
+                }
+            }
+            catch (FormatException ex)
+            {
+                response.Failure(ex.Message);
+            }
+
+            // A request that outlived its deadline in the queue is answered without being run:
+            // the caller has already given up on it.
+            if (parsed && request.Expired())
+            {
+                response.Failure("Deadline exceeded");
+            }
+            else if (parsed)
+            {
+                handler(request, response);
+            }
+
+            if (response.Length > 0)
+            {
+                pipe.Write(response.Buffer, 0, response.Length);
+                pipe.Flush();
+            }
+        }
+    }
+}
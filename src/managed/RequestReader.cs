@@ -0,0 +1,540 @@
+﻿// RequestReader.cs
+
+using Newtonsoft.Json;
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Text;
+
+
+namespace MANAGED_Bridge
+{
+    internal enum Opcode
+    {
+        None = 0,
+        CreateDomain = 1,
+        UnloadDomain = 2,
+        LoadFromFile = 3,
+        LoadFromMemory = 4,
+        CreateInstance = 5,
+        ReleaseInstance = 6,
+        InvokeStatic = 7,
+        InvokeInstance = 8,
+        RunWpfApp = 9,
+        StopWpfApp = 10,
+        GetStats = 11,
+        StopServer = 12,
+        RegisterCacheable = 13,
+        Cancel = 14,
+        ReleaseInstances = 15,
+        Subscribe = 16,
+        ReadCursor = 17
+    }
+
+
+    // Server-side time spent on one request, in Stopwatch ticks. Only allocated when the
+    // server runs with timing enabled; the reply then carries it as a "timing" block (microseconds).
+    internal sealed class RequestTiming
+    {
+        public long AcceptedAt;
+        public long DequeuedAt;
+        public long Queued;
+        public long Parse;
+        public long Lookup;
+        public long Resolve;
+        public long Decode;
+        public long Invoke;
+        public long Serialize;
+        private long mark;
+
+        public void Reset()
+        {
+            Queued = Parse = Lookup = Resolve = Decode = Invoke = Serialize = 0;
+        }
+
+
+        public void Start()
+        {
+            mark = Stopwatch.GetTimestamp();
+        }
+
+
+        // Ticks since Start or the previous Lap.
+        public long Lap()
+        {
+            long now = Stopwatch.GetTimestamp();
+            long elapsed = now - mark;
+            mark = now;
+            return elapsed;
+        }
+
+
+        public void WriteTo(JsonWriter json)
+        {
+            json.WritePropertyName("timing");
+            json.WriteStartObject();
+            Write(json, "queued", Queued);
+            Write(json, "parse", Parse);
+            Write(json, "lookup", Lookup);
+            Write(json, "resolve", Resolve);
+            Write(json, "decode", Decode);
+            Write(json, "invoke", Invoke);
+            Write(json, "serialize", Serialize);
+            json.WriteEndObject();
+        }
+
+
+        private static void Write(JsonWriter json, string name, long ticks)
+        {
+            json.WritePropertyName(name);
+            json.WriteValue(ticks * 1000000 / Stopwatch.Frequency);
+        }
+    }
+
+
+    // Header of one request. The reader fills it in place from the UTF-8 message bytes;
+    // "args" is kept as a byte range into the message and decoded later against the target signature.
+    internal sealed class Request
+    {
+        public Opcode Op;
+        public string DomainId;
+        public long InstanceHandle;
+        public string AssemblyName;
+        public string AssemblyAlias;
+        public string TypeName;
+        public string MethodName;
+        public string Path;
+        public string BytesBase64;
+        public string IfNoneMatch;
+        public long Deadline;           // Unix milliseconds; 0 when the caller set none
+        public long CancelId;
+        public long[] Release;          // instance handles to release before the request itself
+        public int Chunk;               // rows per reply for a streamed sequence; 0 sends the whole result
+        public ArraySegment<byte> Args;
+        public RequestTiming Timing;
+
+        internal byte[] Buffer;
+        internal int Length;
+        internal int TokenOffset = -1;
+        internal int TokenLength;
+        internal bool TokenEscaped;
+
+        public void Reset(byte[] buffer, int length)
+        {
+            Op = Opcode.None;
+            DomainId = null;
+            InstanceHandle = 0;
+            AssemblyName = null;
+            AssemblyAlias = null;
+            TypeName = null;
+            MethodName = null;
+            Path = null;
+            BytesBase64 = null;
+            IfNoneMatch = null;
+            Deadline = 0;
+            CancelId = 0;
+            Release = null;
+            Chunk = 0;
+            Args = default(ArraySegment<byte>);
+            Buffer = buffer;
+            Length = length;
+            TokenOffset = -1;
+            TokenLength = 0;
+            TokenEscaped = false;
+        }
+
+
+        public bool TokenMatches(byte[] expected)
+        {
+            if (expected == null)
+            {
+                return true;
+            }
+
+            if (TokenOffset < 0 || TokenEscaped || TokenLength != expected.Length)
+            {
+                return false;
+            }
+
+            for (int i = 0; i < expected.Length; i++)
+            {
+                if (Buffer[TokenOffset + i] != expected[i])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+
+        public bool Expired()
+        {
+            return Deadline != 0 && DateTimeOffset.UtcNow.ToUnixTimeMilliseconds() >= Deadline;
+        }
+
+
+        public byte[] ToArray()
+        {
+            var copy = new byte[Length];
+            System.Buffer.BlockCopy(Buffer, 0, copy, 0, Length);
+            return copy;
+        }
+    }
+
+
+    internal static class RequestReader
+    {
+        private static readonly byte[] KeyOp = Encoding.ASCII.GetBytes("op");
+        private static readonly byte[] KeyAuthToken = Encoding.ASCII.GetBytes("authToken");
+        private static readonly byte[] KeyDomainId = Encoding.ASCII.GetBytes("domainId");
+        private static readonly byte[] KeyInstanceHandle = Encoding.ASCII.GetBytes("instanceHandle");
+        private static readonly byte[] KeyAssemblyName = Encoding.ASCII.GetBytes("assemblyName");
+        private static readonly byte[] KeyAssemblyAlias = Encoding.ASCII.GetBytes("assemblyAlias");
+        private static readonly byte[] KeyTypeName = Encoding.ASCII.GetBytes("typeName");
+        private static readonly byte[] KeyMethodName = Encoding.ASCII.GetBytes("methodName");
+        private static readonly byte[] KeyPath = Encoding.ASCII.GetBytes("path");
+        private static readonly byte[] KeyBytesBase64 = Encoding.ASCII.GetBytes("bytesBase64");
+        private static readonly byte[] KeyIfNoneMatch = Encoding.ASCII.GetBytes("ifNoneMatch");
+        private static readonly byte[] KeyArgs = Encoding.ASCII.GetBytes("args");
+        private static readonly byte[] KeyDeadline = Encoding.ASCII.GetBytes("deadline");
+        private static readonly byte[] KeyCancelId = Encoding.ASCII.GetBytes("cancelId");
+        private static readonly byte[] KeyRelease = Encoding.ASCII.GetBytes("release");
+        private static readonly byte[] KeyChunk = Encoding.ASCII.GetBytes("chunk");
+
+        public static void Parse(byte[] buf, int length, Request req)
+        {
+            req.Reset(buf, length);
+
+            int pos = SkipWhitespace(buf, 0, length);
+            Expect(buf, pos++, length, (byte)'{');
+
+            while (true)
+            {
+                pos = SkipWhitespace(buf, pos, length);
+                if (pos < length && buf[pos] == '}')
+                {
+                    return;
+                }
+
+                int keyStart = pos + 1;
+                pos = SkipString(buf, pos, length, out bool keyEscaped);
+                int keyLength = pos - keyStart - 1;
+
+                pos = SkipWhitespace(buf, pos, length);
+                Expect(buf, pos++, length, (byte)':');
+                pos = SkipWhitespace(buf, pos, length);
+
+                if (keyEscaped)
+                {
+                    pos = SkipValue(buf, pos, length);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyOp))
+                {
+                    pos = ReadLong(buf, pos, length, out long op);
+                    req.Op = (Opcode)op;
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyAuthToken))
+                {
+                    req.TokenOffset = pos + 1;
+                    pos = SkipString(buf, pos, length, out req.TokenEscaped);
+                    req.TokenLength = pos - req.TokenOffset - 1;
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyDomainId))
+                {
+                    pos = ReadString(buf, pos, length, out req.DomainId);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyInstanceHandle))
+                {
+                    pos = ReadLong(buf, pos, length, out req.InstanceHandle);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyAssemblyName))
+                {
+                    pos = ReadString(buf, pos, length, out req.AssemblyName);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyAssemblyAlias))
+                {
+                    pos = ReadString(buf, pos, length, out req.AssemblyAlias);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyTypeName))
+                {
+                    pos = ReadString(buf, pos, length, out req.TypeName);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyMethodName))
+                {
+                    pos = ReadString(buf, pos, length, out req.MethodName);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyPath))
+                {
+                    pos = ReadString(buf, pos, length, out req.Path);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyBytesBase64))
+                {
+                    pos = ReadString(buf, pos, length, out req.BytesBase64);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyIfNoneMatch))
+                {
+                    pos = ReadString(buf, pos, length, out req.IfNoneMatch);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyDeadline))
+                {
+                    pos = ReadLong(buf, pos, length, out req.Deadline);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyCancelId))
+                {
+                    pos = ReadLong(buf, pos, length, out req.CancelId);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyRelease))
+                {
+                    pos = ReadLongArray(buf, pos, length, out req.Release);
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyChunk))
+                {
+                    pos = ReadLong(buf, pos, length, out long chunk);
+                    req.Chunk = (int)Math.Max(0, Math.Min(chunk, int.MaxValue));
+                }
+                else if (KeyIs(buf, keyStart, keyLength, KeyArgs))
+                {
+                    int start = pos;
+                    pos = SkipValue(buf, pos, length);
+                    req.Args = new ArraySegment<byte>(buf, start, pos - start);
+                }
+                else
+                {
+                    pos = SkipValue(buf, pos, length);
+                }
+
+                pos = SkipWhitespace(buf, pos, length);
+                if (pos < length && buf[pos] == ',')
+                {
+                    pos++;
+                    continue;
+                }
+                Expect(buf, pos, length, (byte)'}');
+                return;
+            }
+        }
+
+
+        private static bool KeyIs(byte[] buf, int offset, int length, byte[] key)
+        {
+            if (length != key.Length)
+            {
+                return false;
+            }
+
+            for (int i = 0; i < length; i++)
+            {
+                if (buf[offset + i] != key[i])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+
+        private static void Expect(byte[] buf, int pos, int length, byte c)
+        {
+            if (pos >= length || buf[pos] != c)
+            {
+                throw new FormatException($"Malformed request: expected '{(char)c}' at {pos}");
+            }
+        }
+
+
+        private static int SkipWhitespace(byte[] buf, int pos, int length)
+        {
+            while (pos < length && (buf[pos] == ' ' || buf[pos] == '\t' || buf[pos] == '\r' || buf[pos] == '\n'))
+            {
+                pos++;
+            }
+            return pos;
+        }
+
+
+        // Returns the position just past the closing quote.
+        private static int SkipString(byte[] buf, int pos, int length, out bool escaped)
+        {
+            Expect(buf, pos++, length, (byte)'"');
+            escaped = false;
+
+            while (pos < length)
+            {
+                byte c = buf[pos++];
+                if (c == '\\')
+                {
+                    escaped = true;
+                    pos++;
+                }
+                else if (c == '"')
+                {
+                    return pos;
+                }
+            }
+            throw new FormatException("Malformed request: unterminated string");
+        }
+
+
+        private static int SkipValue(byte[] buf, int pos, int length)
+        {
+            if (pos >= length)
+            {
+                throw new FormatException("Malformed request: missing value");
+            }
+
+            byte c = buf[pos];
+            if (c == '"')
+            {
+                return SkipString(buf, pos, length, out _);
+            }
+
+            if (c != '{' && c != '[')
+            {
+                while (pos < length && buf[pos] != ',' && buf[pos] != '}' && buf[pos] != ']' && buf[pos] != ' ' && buf[pos] != '\t' && buf[pos] != '\r' && buf[pos] != '\n')
+                {
+                    pos++;
+                }
+                return pos;
+            }
+
+            int depth = 0;
+            while (pos < length)
+            {
+                c = buf[pos];
+                if (c == '"')
+                {
+                    pos = SkipString(buf, pos, length, out _);
+                    continue;
+                }
+
+                pos++;
+                if (c == '{' || c == '[')
+                {
+                    depth++;
+                }
+                else if (c == '}' || c == ']')
+                {
+                    if (--depth == 0)
+                    {
+                        return pos;
+                    }
+                }
+            }
+            throw new FormatException("Malformed request: unterminated value");
+        }
+
+
+        private static int ReadLong(byte[] buf, int pos, int length, out long value)
+        {
+            value = 0;
+            if (pos < length && buf[pos] == 'n')
+            {
+                return SkipValue(buf, pos, length);
+            }
+
+            bool negative = pos < length && buf[pos] == '-';
+            if (negative)
+            {
+                pos++;
+            }
+
+            int start = pos;
+            while (pos < length && buf[pos] >= '0' && buf[pos] <= '9')
+            {
+                value = value * 10 + (buf[pos++] - '0');
+            }
+
+            if (pos == start)
+            {
+                throw new FormatException($"Malformed request: expected number at {start}");
+            }
+
+            if (negative)
+            {
+                value = -value;
+            }
+            return pos;
+        }
+
+
+        private static int ReadLongArray(byte[] buf, int pos, int length, out long[] values)
+        {
+            values = null;
+            if (pos < length && buf[pos] == 'n')
+            {
+                return SkipValue(buf, pos, length);
+            }
+
+            Expect(buf, pos++, length, (byte)'[');
+            var list = new List<long>();
+            while (true)
+            {
+                pos = SkipWhitespace(buf, pos, length);
+                if (pos < length && buf[pos] == ']')
+                {
+                    values = list.ToArray();
+                    return pos + 1;
+                }
+
+                pos = ReadLong(buf, pos, length, out long value);
+                list.Add(value);
+
+                pos = SkipWhitespace(buf, pos, length);
+                if (pos < length && buf[pos] == ',')
+                {
+                    pos++;
+                }
+            }
+        }
+
+
+        private static int ReadString(byte[] buf, int pos, int length, out string value)
+        {
+            if (pos < length && buf[pos] == 'n')
+            {
+                value = null;
+                return SkipValue(buf, pos, length);
+            }
+
+            int start = pos + 1;
+            int end = SkipString(buf, pos, length, out bool escaped);
+            value = escaped ? Unescape(buf, start, end - 1) : Encoding.UTF8.GetString(buf, start, end - 1 - start);
+            return end;
+        }
+
+
+        private static string Unescape(byte[] buf, int start, int end)
+        {
+            var sb = new StringBuilder(end - start);
+            int run = start;
+
+            for (int i = start; i < end; i++)
+            {
+                if (buf[i] != '\\')
+                {
+                    continue;
+                }
+
+                sb.Append(Encoding.UTF8.GetString(buf, run, i - run));
+                char e = (char)buf[++i];
+                switch (e)
+                {
+                    case 'b': sb.Append('\b'); break;
+                    case 'f': sb.Append('\f'); break;
+                    case 'n': sb.Append('\n'); break;
+                    case 'r': sb.Append('\r'); break;
+                    case 't': sb.Append('\t'); break;
+                    case 'u':
+                        sb.Append((char)Convert.ToInt32(Encoding.ASCII.GetString(buf, i + 1, 4), 16));
+                        i += 4;
+                        break;
+                    default: sb.Append(e); break;
+                }
+                run = i + 1;
+            }
+
+            sb.Append(Encoding.UTF8.GetString(buf, run, end - run));
+            return sb.ToString();
+        }
+    }
+}
@@ -0,0 +1,196 @@
+﻿// ResponseWriter.cs
+
+using Newtonsoft.Json;
+using Newtonsoft.Json.Linq;
+using System.Collections;
+using System.IO;
+using System.Text;
+
+
+namespace MANAGED_Bridge
+{
+    // Reusable UTF-8 response buffer: each worker owns one and writes every reply
+    // through a JsonTextWriter straight into it, then sends Buffer[0..Length) to the pipe.
+    internal sealed class ResponseWriter
+    {
+        private const int InitialCapacity = 32768;
+        private const int MaxRetainedCapacity = 1 << 20;
+
+        private static readonly UTF8Encoding utf8 = new UTF8Encoding(false);
+        private static readonly JsonSerializer serializer = JsonSerializer.CreateDefault();
+
+        private MemoryStream stream;
+        private StreamWriter text;
+        private JsonTextWriter json;
+        private bool open;
+
+        // Set by the owning worker when timing is enabled; appended to every reply built here.
+        public RequestTiming Timing;
+
+        // Requests still waiting for a worker when this reply was built; -1 leaves it out.
+        // Clients use it to stop adding load to a pipe that is already backed up.
+        public int QueueDepth = -1;
+
+        public ResponseWriter()
+        {
+            Allocate();
+        }
+
+        public byte[] Buffer => stream.GetBuffer();
+        public int Length => (int)stream.Length;
+
+
+        public ResponseWriter Start(bool success)
+        {
+            Clear();
+            open = true;
+            json.WriteStartObject();
+            json.WritePropertyName("success");
+            json.WriteValue(success);
+            return this;
+        }
+
+
+        public ResponseWriter Success()
+        {
+            return Start(true);
+        }
+
+
+        public void Failure(string error)
+        {
+            Start(false).Field("error", error).End();
+        }
+
+
+        public ResponseWriter Field(string name, string value)
+        {
+            json.WritePropertyName(name);
+            json.WriteValue(value);
+            return this;
+        }
+
+
+        public ResponseWriter Field(string name, long value)
+        {
+            json.WritePropertyName(name);
+            json.WriteValue(value);
+            return this;
+        }
+
+
+        public ResponseWriter Field(string name, JToken value)
+        {
+            json.WritePropertyName(name);
+            value.WriteTo(json);
+            return this;
+        }
+
+
+        public ResponseWriter Result(object value)
+        {
+            json.WritePropertyName("result");
+            Timing?.Start();
+            serializer.Serialize(json, value);
+            if (Timing != null)
+            {
+                Timing.Serialize += Timing.Lap();
+            }
+            return this;
+        }
+
+
+        // Writes "rows": the next items of a sequence, up to maxRows or until about maxBytes of reply.
+        // True once the sequence has ended.
+        public bool Rows(IEnumerator rows, int maxRows, int maxBytes)
+        {
+            json.WritePropertyName("rows");
+            json.WriteStartArray();
+            Timing?.Start();
+
+            bool ended = false;
+            for (int n = 0; n < maxRows; n++)
+            {
+                if (!rows.MoveNext())
+                {
+                    ended = true;
+                    break;
+                }
+                serializer.Serialize(json, rows.Current);
+
+                // Length only sees what the text writer has flushed, so this may overshoot by its buffer.
+                if (stream.Length >= maxBytes)
+                {
+                    break;
+                }
+            }
+
+            json.WriteEndArray();
+            if (Timing != null)
+            {
+                Timing.Serialize += Timing.Lap();
+            }
+            return ended;
+        }
+
+
+        // Writes an already serialized JSON value as the result.
+        public ResponseWriter RawResult(string json)
+        {
+            this.json.WritePropertyName("result");
+            this.json.WriteRawValue(json);
+            return this;
+        }
+
+
+        public void End()
+        {
+            if (QueueDepth >= 0)
+            {
+                json.WritePropertyName("queue");
+                json.WriteValue(QueueDepth);
+            }
+            Timing?.WriteTo(json);
+            json.WriteEndObject();
+            json.Flush();
+            open = false;
+        }
+
+
+        public void Raw(byte[] bytes)
+        {
+            Clear();
+            stream.Write(bytes, 0, bytes.Length);
+        }
+
+
+        public byte[] ToArray()
+        {
+            return stream.ToArray();
+        }
+
+
+        public void Clear()
+        {
+            if (open || stream.Capacity > MaxRetainedCapacity)
+            {
+                // A previous reply was abandoned half-written (or grew the buffer past the
+                // retention limit): start over with a fresh writer.
+                Allocate();
+                return;
+            }
+
+            text.Flush();
+            stream.SetLength(0);
+        }
+
+
+        private void Allocate()
+        {
+            stream = new MemoryStream(InitialCapacity);
+            text = new StreamWriter(stream, utf8, 4096);
+            json = new JsonTextWriter(text) { Formatting = Formatting.None, CloseOutput = false };
+            open = false;
+        }
+    }
+}
@@ -0,0 +1,204 @@
+﻿// ResultCache.cs
+
+using Newtonsoft.Json;
+using Newtonsoft.Json.Linq;
+using System;
+using System.Collections.Generic;
+using System.IO;
+
+
+namespace MANAGED_Bridge
+{
+    // Methods marked with this attribute (or any attribute named "CacheableAttribute", so callers
+    // need not reference this assembly) have their results memoized per argument list.
+    // Only use it on static methods whose result depends on nothing but their arguments.
+    [AttributeUsage(AttributeTargets.Method, Inherited = false)]
+    public sealed class CacheableAttribute : Attribute
+    {
+    }
+
+
+    // LRU of serialized results keyed by method and the raw UTF-8 bytes of its argument array.
+    internal sealed class ResultCache
+    {
+        private struct Key
+        {
+            public string Method;
+            public ArraySegment<byte> Args;
+            public int Hash;
+        }
+
+        private sealed class KeyComparer : IEqualityComparer<Key>
+        {
+            public bool Equals(Key a, Key b)
+            {
+                if (a.Hash != b.Hash || a.Args.Count != b.Args.Count || !string.Equals(a.Method, b.Method, StringComparison.Ordinal))
+                {
+                    return false;
+                }
+
+                for (int i = 0; i < a.Args.Count; i++)
+                {
+                    if (a.Args.Array[a.Args.Offset + i] != b.Args.Array[b.Args.Offset + i])
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            public int GetHashCode(Key key) => key.Hash;
+        }
+
+        private sealed class Entry
+        {
+            public Key Key;
+            public string Json;
+            public long Size;
+        }
+
+        private static readonly JsonSerializer serializer = JsonSerializer.CreateDefault();
+
+        private readonly object sync = new object();
+        private readonly Dictionary<Key, LinkedListNode<Entry>> map = new Dictionary<Key, LinkedListNode<Entry>>(new KeyComparer());
+        private readonly LinkedList<Entry> lru = new LinkedList<Entry>();
+        private readonly int maxEntries;
+        private readonly long maxBytes;
+        private long bytes;
+        private long hits;
+        private long misses;
+        private long evictions;
+
+        public ResultCache(int maxEntries, long maxBytes)
+        {
+            this.maxEntries = Math.Max(0, maxEntries);
+            this.maxBytes = Math.Max(0, maxBytes);
+        }
+
+
+        public bool TryGet(string method, ArraySegment<byte> args, out string json)
+        {
+            var key = MakeKey(method, args);
+
+            lock (sync)
+            {
+                if (map.TryGetValue(key, out var node))
+                {
+                    lru.Remove(node);
+                    lru.AddFirst(node);
+                    hits++;
+                    json = node.Value.Json;
+                    return true;
+                }
+                misses++;
+            }
+
+            json = null;
+            return false;
+        }
+
+
+        public void Add(string method, ArraySegment<byte> args, string json)
+        {
+            var copy = new byte[args.Count];
+            if (args.Count > 0)
+            {
+                Buffer.BlockCopy(args.Array, args.Offset, copy, 0, args.Count);
+            }
+
+            var entry = new Entry
+            {
+                Key = MakeKey(method, new ArraySegment<byte>(copy)),
+                Json = json,
+                Size = (json.Length + method.Length) * 2L + copy.Length
+            };
+
+            if (maxEntries == 0 || entry.Size > maxBytes)
+            {
+                return;
+            }
+
+            lock (sync)
+            {
+                if (map.TryGetValue(entry.Key, out var existing))
+                {
+                    Unlink(existing);
+                }
+
+                var node = lru.AddFirst(entry);
+                map[entry.Key] = node;
+                bytes += entry.Size;
+
+                while (map.Count > maxEntries || bytes > maxBytes)
+                {
+                    Unlink(lru.Last);
+                    evictions++;
+                }
+            }
+        }
+
+
+        public void Clear()
+        {
+            lock (sync)
+            {
+                map.Clear();
+                lru.Clear();
+                bytes = 0;
+            }
+        }
+
+
+        public JObject Snapshot()
+        {
+            lock (sync)
+            {
+                return new JObject
+                {
+                    ["entries"] = map.Count,
+                    ["bytes"] = bytes,
+                    ["maxEntries"] = maxEntries,
+                    ["maxBytes"] = maxBytes,
+                    ["hits"] = hits,
+                    ["misses"] = misses,
+                    ["evictions"] = evictions
+                };
+            }
+        }
+
+
+        public static string Serialize(object value)
+        {
+            using (var text = new StringWriter())
+            {
+                using (var json = new JsonTextWriter(text) { Formatting = Formatting.None })
+                {
+                    serializer.Serialize(json, value);
+                }
+                return text.ToString();
+            }
+        }
+
+
+        private void Unlink(LinkedListNode<Entry> node)
+        {
+            map.Remove(node.Value.Key);
+            lru.Remove(node);
+            bytes -= node.Value.Size;
+        }
+
+
+        private static Key MakeKey(string method, ArraySegment<byte> args)
+        {
+            // FNV-1a over the argument bytes, folded with the method name.
+            uint hash = 2166136261;
+            int end = args.Offset + args.Count;
+            for (int i = args.Offset; i < end; i++)
+            {
+                hash = (hash ^ args.Array[i]) * 16777619;
+            }
+
+            return new Key { Method = method, Args = args, Hash = (int)hash ^ StringComparer.Ordinal.GetHashCode(method) };
+        }
+    }
+}
@@ -1,405 +1,2275 @@
 // NM-Bridge.cpp
 
 #include "NM-Bridge.h"
+#include "NM-Metrics.h"
+#include "NM-Transport.h"
+#include "NM-Capture.h"
+#include "NM-Throttle.h"
+#include "NM-Process.h"
 
 #include <thread>
 #include <chrono>
 #include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstring>
 #include <mutex>
+#include <random>
+
+#ifdef _WIN32
 #include <bcrypt.h>
 #include <wintrust.h>
 
 #pragma comment(lib, "bcrypt.lib")
 #pragma comment(lib, "wintrust.lib")
+#else
+#include <unistd.h>
+#endif
 
 #include "include/json.hpp"
 using json = nlohmann::json;
 
-namespace
+namespace
+{
+    uint64_t MicrosSince(std::chrono::steady_clock::time_point& mark)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - mark).count();
+        mark = now;
+        return static_cast<uint64_t>(us);
+    }
+
+    // The argument array travels as a JSON value under "args", not as an escaped string,
+    // so the managed side can decode it straight from the request bytes.
+    bool SetArgs(json& rq, const std::string& argsJson, std::wstring& error)
+    {
+        json args = json::parse(argsJson, nullptr, false);
+        if (args.is_discarded())
+        {
+            error = L"Invalid arguments JSON";
+            return false;
+        }
+        rq["args"] = std::move(args);
+        return true;
+    }
+
+    // Appended to the serialized request, so the capture and the client cache key never see them.
+    // The deadline is absolute (Unix ms): time spent queued on the server counts against it.
+    // Queued instance releases for the domain ride along as "release". Written in place, so a
+    // reused buffer takes the stamp without allocating.
+    void Stamp(std::string& request, int timeoutMs, uint64_t cancelId, const std::vector<uint64_t>* releases = nullptr)
+    {
+        if (request.size() < 2 || request.back() != '}') return;
+
+        request.pop_back();
+        if (timeoutMs > 0)
+        {
+            auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            request += ",\"deadline\":";
+            request += std::to_string(now + timeoutMs);
+        }
+        if (cancelId != 0)
+        {
+            request += ",\"cancelId\":";
+            request += std::to_string(cancelId);
+        }
+        if (releases && !releases->empty())
+        {
+            request += ",\"release\":[";
+            for (size_t i = 0; i < releases->size(); ++i)
+            {
+                if (i > 0) request += ',';
+                request += std::to_string((*releases)[i]);
+            }
+            request += ']';
+        }
+        request += '}';
+    }
+
+    // The "timing" fields of a reply that run with --server-timing.
+    const struct { const char* name; NM_Metrics::Phase phase; } ServerPhases[] = {
+        { "queued", NM_Metrics::Phase::ServerQueued }, { "parse", NM_Metrics::Phase::ServerParse },
+        { "lookup", NM_Metrics::Phase::ServerLookup }, { "resolve", NM_Metrics::Phase::ServerResolve },
+        { "decode", NM_Metrics::Phase::ServerDecode }, { "invoke", NM_Metrics::Phase::ServerInvoke },
+        { "serialize", NM_Metrics::Phase::ServerSerialize }
+    };
+    const int ServerPhaseCount = static_cast<int>(sizeof(ServerPhases) / sizeof(ServerPhases[0]));
+
+    // What RoundTrip needs from every reply, read in place: building a json document for it, or
+    // running json's own lexer over it, would allocate on each call.
+    struct ReplyHead
+    {
+        bool object = false;
+        bool success = false;
+        bool overloaded = false;
+        int queue = -1;
+        bool timed = false;
+        uint64_t timing[ServerPhaseCount] = {};
+    };
+
+    // Checks JSON text in place, without allocating. Read() also picks out the ReplyHead fields
+    // of a reply; values it does not need are checked for shape and skipped.
+    class JsonScanner
+    {
+    public:
+        explicit JsonScanner(const std::string& text) : p(text.data()), end(text.data() + text.size()) {}
+
+        // False if the text is not a single JSON value.
+        bool Valid()
+        {
+            return Value(0) && AtEnd();
+        }
+
+        bool Read(ReplyHead& head)
+        {
+            Space();
+            if (p < end && *p == '{')
+            {
+                head.object = true;
+                if (!Members([&](const char* key, size_t length) { return Field(key, length, head); })) return false;
+            }
+            else if (!Value(0))
+            {
+                return false;
+            }
+            return AtEnd();
+        }
+
+    private:
+        static constexpr int MaxDepth = 256;
+
+        const char* p;
+        const char* end;
+
+        static bool Is(const char* key, size_t length, const char* name)
+        {
+            return std::strlen(name) == length && std::memcmp(key, name, length) == 0;
+        }
+
+        bool AtEnd()
+        {
+            Space();
+            return p == end;
+        }
+
+        bool Field(const char* key, size_t length, ReplyHead& head)
+        {
+            if (Is(key, length, "success")) return Bool(head.success);
+            if (Is(key, length, "overloaded")) return Bool(head.overloaded);
+            if (Is(key, length, "queue"))
+            {
+                uint64_t queue = 0;
+                if (!Digit()) return Value(1);
+                if (!Number(queue)) return false;
+                head.queue = static_cast<int>((std::min)(queue, static_cast<uint64_t>(INT_MAX)));
+                return true;
+            }
+            if (Is(key, length, "timing"))
+            {
+                Space();
+                if (p >= end || *p != '{') return Value(1);
+                head.timed = true;
+                return Members([&](const char* name, size_t nameLength)
+                {
+                    for (int i = 0; i < ServerPhaseCount; ++i)
+                    {
+                        if (Is(name, nameLength, ServerPhases[i].name)) return Digit() ? Number(head.timing[i]) : Value(2);
+                    }
+                    return Value(2);
+                });
+            }
+            return Value(1);
+        }
+
+        void Space()
+        {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+        }
+
+        bool Eat(char c)
+        {
+            Space();
+            if (p >= end || *p != c) return false;
+            ++p;
+            return true;
+        }
+
+        bool Word(const char* word)
+        {
+            size_t length = std::strlen(word);
+            if (static_cast<size_t>(end - p) < length || std::memcmp(p, word, length) != 0) return false;
+            p += length;
+            return true;
+        }
+
+        // Keys are compared as written; none of the ones looked for needs an escape.
+        template <typename Member>
+        bool Members(Member member)
+        {
+            if (!Eat('{')) return false;
+            if (Eat('}')) return true;
+            do
+            {
+                Space();
+                const char* key = p + 1;
+                if (!String()) return false;
+                size_t length = static_cast<size_t>(p - 1 - key);
+                if (!Eat(':') || !member(key, length)) return false;
+            } while (Eat(','));
+            return Eat('}');
+        }
+
+        bool Value(int depth)
+        {
+            Space();
+            if (p >= end || depth > MaxDepth) return false;
+            switch (*p)
+            {
+            case '"': return String();
+            case '{': return Members([&](const char*, size_t) { return Value(depth + 1); });
+            case '[':
+                ++p;
+                if (Eat(']')) return true;
+                do
+                {
+                    if (!Value(depth + 1)) return false;
+                } while (Eat(','));
+                return Eat(']');
+            case 't': return Word("true");
+            case 'f': return Word("false");
+            case 'n': return Word("null");
+            default:
+                uint64_t ignored;
+                return Number(ignored);
+            }
+        }
+
+        bool String()
+        {
+            if (p >= end || *p != '"') return false;
+            for (++p; p < end; ++p)
+            {
+                if (*p == '\\')
+                {
+                    if (++p == end) return false;
+                    if (*p == 'u')
+                    {
+                        for (int i = 0; i < 4; ++i)
+                        {
+                            if (++p == end || !std::isxdigit(static_cast<unsigned char>(*p))) return false;
+                        }
+                    }
+                    else if (!std::strchr("\"\\/bfnrt", *p) || *p == '\0')
+                    {
+                        return false;
+                    }
+                }
+                else if (*p == '"')
+                {
+                    ++p;
+                    return true;
+                }
+                else if (static_cast<unsigned char>(*p) < 0x20)
+                {
+                    return false;
+                }
+            }
+            return false;
+        }
+
+        // A true or false; anything else is skipped and leaves value as it was.
+        bool Bool(bool& value)
+        {
+            Space();
+            if (Word("true")) value = true;
+            else if (Word("false")) value = false;
+            else return Value(1);
+            return true;
+        }
+
+        // Whether a non-negative number comes next, for Number to read truncated to an integer.
+        bool Digit()
+        {
+            Space();
+            return p < end && *p >= '0' && *p <= '9';
+        }
+
+        // Saturates rather than wrapping for integer parts past 2^64.
+        bool Number(uint64_t& value)
+        {
+            auto digits = [this](uint64_t* into)
+            {
+                const char* start = p;
+                for (; p < end && *p >= '0' && *p <= '9'; ++p)
+                {
+                    if (!into) continue;
+                    uint64_t digit = static_cast<uint64_t>(*p - '0');
+                    *into = *into > (UINT64_MAX - digit) / 10 ? UINT64_MAX : *into * 10 + digit;
+                }
+                return p > start;
+            };
+
+            value = 0;
+            if (p < end && *p == '-') ++p;
+            const char* first = p;
+            if (!digits(&value)) return false;
+            if (*first == '0' && p - first > 1) return false;
+            if (p < end && *p == '.' && (++p, !digits(nullptr))) return false;
+            if (p < end && (*p == 'e' || *p == 'E'))
+            {
+                ++p;
+                if (p < end && (*p == '+' || *p == '-')) ++p;
+                if (!digits(nullptr)) return false;
+            }
+            return true;
+        }
+    };
+
+    // Appends s to out as a JSON string.
+    void AppendQuoted(std::string& out, const std::string& s)
+    {
+        static const char hex[] = "0123456789abcdef";
+
+        out += '"';
+        for (char c : s)
+        {
+            unsigned char u = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if (u < 0x20)
+            {
+                out += "\\u00";
+                out += hex[u >> 4];
+                out += hex[u & 15];
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    // Invoke arguments as NM_Bridge::FormatArgs would give them, written into the request
+    // as they are instead of going through a json document.
+    bool AppendArgs(std::string& out, const std::string& argsJson, std::wstring& error)
+    {
+        if (argsJson.empty() || argsJson == "null")
+        {
+            out += "[]";
+            return true;
+        }
+        if (argsJson.front() != '[' || argsJson.back() != ']')
+        {
+            out += '[';
+            AppendQuoted(out, argsJson);
+            out += ']';
+            return true;
+        }
+        if (!JsonScanner(argsJson).Valid())
+        {
+            error = L"Invalid arguments JSON";
+            return false;
+        }
+        out += argsJson;
+        return true;
+    }
+
+    // An InvokeStatic or InvokeInstance request, with the keys in the order json::dump gives them.
+    // A static call (instance null) names typeName, an instance call its handle.
+    bool EncodeInvoke(std::string& request, int op, const std::string& domainId, const std::string& authToken, const std::string& assemblyAlias, const uint64_t* instance, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::wstring& error)
+    {
+        request.assign("{\"args\":");
+        if (!AppendArgs(request, argsJson, error)) return false;
+        request += ",\"assemblyName\":";
+        AppendQuoted(request, assemblyAlias);
+        request += ",\"authToken\":";
+        AppendQuoted(request, authToken);
+        request += ",\"domainId\":";
+        AppendQuoted(request, domainId);
+        if (instance)
+        {
+            request += ",\"instanceHandle\":";
+            request += std::to_string(*instance);
+        }
+        request += ",\"methodName\":";
+        AppendQuoted(request, methodName);
+        request += ",\"op\":";
+        request += std::to_string(op);
+        if (!instance)
+        {
+            request += ",\"typeName\":";
+            AppendQuoted(request, typeName);
+        }
+        request += '}';
+        return true;
+    }
+
+#ifdef _WIN32
+    std::string utf16_to_utf8(const std::wstring& ws)
+    {
+        if (ws.empty()) return {};
+        int sz = WideCharToMultiByte(CP_UTF8, 0, ws.c_str(), -1, nullptr, 0, nullptr, nullptr);
+        std::string s(sz, 0);
+        WideCharToMultiByte(CP_UTF8, 0, ws.c_str(), -1, &s[0], sz, nullptr, nullptr);
+        if (!s.empty() && s.back() == '\0') s.pop_back();
+        return s;
+    }
+
+    std::wstring utf8_to_utf16(const std::string& s)
+    {
+        if (s.empty()) return {};
+        int sz = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, nullptr, 0);
+        std::wstring ws(sz, 0);
+        MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, &ws[0], sz);
+        if (!ws.empty() && ws.back() == L'\0') ws.pop_back();
+        return ws;
+    }
+
+
+    std::string base64_encode(const std::vector<uint8_t>& data)
+    {
+        if (data.empty()) return "";
+        DWORD outLen = 0;
+        CryptBinaryToStringA((const BYTE*)data.data(), (DWORD)data.size(), CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, NULL, &outLen);
+        std::string out(outLen + 1, '\0');
+        if (CryptBinaryToStringA((const BYTE*)data.data(), (DWORD)data.size(), CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, &out[0], &outLen)) {
+            out.resize(outLen);
+            return out;
+        }
+        return "";
+    }
+#else
+    // wchar_t holds a whole code point here, so these are plain UTF-8 <-> UTF-32.
+    std::string utf16_to_utf8(const std::wstring& ws)
+    {
+        std::string s;
+        s.reserve(ws.size());
+        for (wchar_t wc : ws)
+        {
+            uint32_t c = static_cast<uint32_t>(wc);
+            if (c < 0x80) s += static_cast<char>(c);
+            else if (c < 0x800) { s += static_cast<char>(0xC0 | (c >> 6)); s += static_cast<char>(0x80 | (c & 0x3F)); }
+            else if (c < 0x10000) { s += static_cast<char>(0xE0 | (c >> 12)); s += static_cast<char>(0x80 | ((c >> 6) & 0x3F)); s += static_cast<char>(0x80 | (c & 0x3F)); }
+            else { s += static_cast<char>(0xF0 | (c >> 18)); s += static_cast<char>(0x80 | ((c >> 12) & 0x3F)); s += static_cast<char>(0x80 | ((c >> 6) & 0x3F)); s += static_cast<char>(0x80 | (c & 0x3F)); }
+        }
+        return s;
+    }
+
+    std::wstring utf8_to_utf16(const std::string& s)
+    {
+        std::wstring ws;
+        ws.reserve(s.size());
+        for (size_t i = 0; i < s.size();)
+        {
+            unsigned char b = static_cast<unsigned char>(s[i]);
+            int extra = b < 0x80 ? 0 : b < 0xE0 ? 1 : b < 0xF0 ? 2 : 3;
+            uint32_t c = extra == 0 ? b : b & (0x3F >> extra);
+            for (int k = 1; k <= extra && i + k < s.size(); ++k) c = (c << 6) | (static_cast<unsigned char>(s[i + k]) & 0x3F);
+            ws += static_cast<wchar_t>(c);
+            i += extra + 1;
+        }
+        return ws;
+    }
+
+    std::string base64_encode(const std::vector<uint8_t>& data)
+    {
+        static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        std::string out;
+        out.reserve((data.size() + 2) / 3 * 4);
+        size_t i = 0;
+        for (; i + 2 < data.size(); i += 3)
+        {
+            uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+            out += table[v >> 18]; out += table[(v >> 12) & 63]; out += table[(v >> 6) & 63]; out += table[v & 63];
+        }
+        if (i < data.size())
+        {
+            uint32_t v = data[i] << 16;
+            if (i + 1 < data.size()) v |= data[i + 1] << 8;
+            out += table[v >> 18]; out += table[(v >> 12) & 63];
+            out += i + 1 < data.size() ? table[(v >> 6) & 63] : '=';
+            out += '=';
+        }
+        return out;
+    }
+#endif
+
+    const char* gcPolicyNames[] = { "None", "Deferred", "EveryN" };
+
+    // The server half of NM_Bridge::Options, under the names Managed_Bridge reads at startup.
+    json ServerOptions(const NM_Bridge::Options& options)
+    {
+        return {
+            {"controlWorkers", options.controlWorkers},
+            {"domainWorkers", options.domainWorkers},
+            {"gcPolicy", gcPolicyNames[static_cast<int>(options.gcPolicy)]},
+            {"gcEveryN", options.gcEveryN},
+            {"gcMemoryLoadPercent", options.gcMemoryLoadPercent},
+            {"domainPoolSize", options.domainPoolSize},
+            {"shareAssemblies", options.shareAssemblies},
+            {"resultCacheEntries", options.resultCacheEntries},
+            {"resultCacheMB", options.resultCacheMB},
+            {"serverTiming", options.serverTiming},
+            {"maxQueueDepth", options.maxQueueDepth},
+            {"maxInFlight", options.maxInFlight},
+            {"maxFrameMB", options.maxFrameMB}
+        };
+    }
+
+#ifdef _WIN32
+    NM_Bridge::Options ParseServerOptions(const json& j)
+    {
+        NM_Bridge::Options options;
+        options.controlWorkers = j.value("controlWorkers", options.controlWorkers);
+        options.domainWorkers = j.value("domainWorkers", options.domainWorkers);
+        options.gcEveryN = j.value("gcEveryN", options.gcEveryN);
+        options.gcMemoryLoadPercent = j.value("gcMemoryLoadPercent", options.gcMemoryLoadPercent);
+        options.domainPoolSize = j.value("domainPoolSize", options.domainPoolSize);
+        options.shareAssemblies = j.value("shareAssemblies", options.shareAssemblies);
+        options.resultCacheEntries = j.value("resultCacheEntries", options.resultCacheEntries);
+        options.resultCacheMB = j.value("resultCacheMB", options.resultCacheMB);
+        options.serverTiming = j.value("serverTiming", options.serverTiming);
+        options.maxQueueDepth = j.value("maxQueueDepth", options.maxQueueDepth);
+        options.maxInFlight = j.value("maxInFlight", options.maxInFlight);
+        options.maxFrameMB = j.value("maxFrameMB", options.maxFrameMB);
+
+        std::string policy = j.value("gcPolicy", std::string());
+        for (int i = 0; i < 3; ++i)
+        {
+            if (policy == gcPolicyNames[i]) options.gcPolicy = static_cast<NM_Bridge::GcPolicy>(i);
+        }
+        return options;
+    }
+
+    struct RelayRoutes
+    {
+        std::string control;
+        std::mutex lock;
+        std::map<std::string, std::string> pipes;   // domainId -> pipe, from CreateDomain replies
+        std::map<std::string, std::string> events;  // domainId -> event pipe
+    };
+
+    // A subscribed client only reads from here on: every event batch is passed through as is.
+    void RelayEvents(NM_Connection& client, const std::string& request, const std::string& pipe)
+    {
+        std::wstring error;
+        std::string message;
+        auto upstream = pipe.empty() ? nullptr : NM_Connection::Open(pipe, 15000, error);
+        if (!upstream || !upstream->Write(request.data(), request.size(), error))
+        {
+            message = json{ {"success", false}, {"error", pipe.empty() ? std::string("domain not found") : utf16_to_utf8(error)} }.dump();
+            client.Write(message.data(), message.size(), error);
+            return;
+        }
+
+        while (upstream->Read(message, -1, error) && client.Write(message.data(), message.size(), error))
+        {
+        }
+    }
+
+    // Relays one TCP client of a host: control ops to the control pipe, the rest to the pipe of
+    // the domain they name. A Subscribe turns the connection into that domain's event stream.
+    void RelayClient(NM_Connection& client, RelayRoutes& routes)
+    {
+        // Must match NM_Bridge::Op.
+        const int CreateDomain = 1, UnloadDomain = 2, GetStats = 11, StopServer = 12, Cancel = 14, Subscribe = 16;
+
+        std::map<std::string, std::unique_ptr<NM_Connection>> upstream;
+        std::string request, reply;
+        std::wstring error;
+        while (client.Read(request, -1, error))
+        {
+            json rq = json::parse(request, nullptr, false);
+            int op = rq.is_object() ? rq.value("op", 0) : 0;
+            std::string domainId = rq.is_object() ? rq.value("domainId", std::string()) : std::string();
+
+            if (op == Subscribe)
+            {
+                std::string events;
+                {
+                    std::lock_guard<std::mutex> lock(routes.lock);
+                    auto it = routes.events.find(domainId);
+                    if (it != routes.events.end()) events = it->second;
+                }
+                RelayEvents(client, request, events);
+                return;
+            }
+
+            std::string pipe = routes.control;
+            if (op != CreateDomain && op != UnloadDomain && op != GetStats && op != StopServer && op != Cancel)
+            {
+                std::lock_guard<std::mutex> lock(routes.lock);
+                auto it = routes.pipes.find(domainId);
+                if (it != routes.pipes.end()) pipe = it->second;
+            }
+
+            auto& connection = upstream[pipe];
+            if (!connection) connection = NM_Connection::Open(pipe, 15000, error);
+            if (!connection || !connection->Write(request.data(), request.size(), error) || !connection->Read(reply, -1, error))
+            {
+                connection.reset();
+                reply = json{ {"success", false}, {"error", utf16_to_utf8(error)} }.dump();
+            }
+            else if (op == CreateDomain || op == UnloadDomain)
+            {
+                json rs = json::parse(reply, nullptr, false);
+                if (rs.is_object() && rs.value("success", false))
+                {
+                    std::lock_guard<std::mutex> lock(routes.lock);
+                    if (op == CreateDomain && rs.contains("pipeName"))
+                    {
+                        routes.pipes[rs.value("domainId", domainId)] = rs["pipeName"].get<std::string>();
+                        if (rs.contains("eventPipe")) routes.events[rs.value("domainId", domainId)] = rs["eventPipe"].get<std::string>();
+                    }
+                    else if (op == UnloadDomain)
+                    {
+                        auto it = routes.pipes.find(domainId);
+                        if (it != routes.pipes.end())
+                        {
+                            upstream.erase(it->second);
+                            routes.pipes.erase(it);
+                        }
+                        routes.events.erase(domainId);
+                    }
+                }
+            }
+
+            if (!client.Write(reply.data(), reply.size(), error)) break;
+        }
+    }
+
+    void RelayLoop(NM_Listener& listener, RelayRoutes& routes)
+    {
+        struct Session
+        {
+            std::unique_ptr<NM_Connection> client;
+            std::thread thread;
+            std::atomic<bool> done{ false };
+        };
+
+        std::list<std::unique_ptr<Session>> sessions;
+        while (auto client = listener.Accept())
+        {
+            for (auto it = sessions.begin(); it != sessions.end();)
+            {
+                if (!(*it)->done) { ++it; continue; }
+                (*it)->thread.join();
+                it = sessions.erase(it);
+            }
+
+            sessions.emplace_back(new Session());
+            Session* session = sessions.back().get();
+            session->client = std::move(client);
+            session->thread = std::thread([session, &routes] {
+                RelayClient(*session->client, routes);
+                session->done = true;
+            });
+        }
+
+        for (auto& s : sessions) s->client->Interrupt();
+        for (auto& s : sessions) s->thread.join();
+    }
+#endif
+
+    std::string RandomHex(size_t bytes)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::random_device rd;
+        std::string out;
+        for (size_t i = 0; i < bytes; ++i)
+        {
+            unsigned b = rd() & 0xFF;
+            out += digits[b >> 4];
+            out += digits[b & 0xF];
+        }
+        return out;
+    }
+
+    unsigned long CurrentProcessId()
+    {
+#ifdef _WIN32
+        return GetCurrentProcessId();
+#else
+        return static_cast<unsigned long>(getpid());
+#endif
+    }
+}
+
+
+// ---------------- Constructor / Destructor ----------------
+
+NM_Bridge::NM_Bridge() : metrics(new NM_Metrics())
+{
+    static const struct { Op op; const char* name; } names[] = {
+        { Op::CreateDomain, "createDomain" }, { Op::UnloadDomain, "unloadDomain" },
+        { Op::LoadFromFile, "loadFromFile" }, { Op::LoadFromMemory, "loadFromMemory" },
+        { Op::CreateInstance, "createInstance" }, { Op::ReleaseInstance, "releaseInstance" },
+        { Op::InvokeStatic, "invokeStatic" }, { Op::InvokeInstance, "invokeInstance" },
+        { Op::RunWpfApp, "runWpfApp" }, { Op::StopWpfApp, "stopWpfApp" },
+        { Op::GetStats, "getStats" }, { Op::StopServer, "stopServer" },
+        { Op::RegisterCacheable, "registerCacheable" }, { Op::Cancel, "cancel" },
+        { Op::ReleaseInstances, "releaseInstances" }, { Op::ReadCursor, "readCursor" }
+    };
+
+    for (const auto& n : names) metrics->SetCommandName(static_cast<int>(n.op), n.name);
+}
+
+NM_Bridge::~NM_Bridge()
+{
+    Shutdown();
+}
+
+// ---------------- Initialization ---------------- 
+
+#ifdef _WIN32
+bool NM_Bridge::Init(const std::wstring& ManagedDllPath, std::wstring& error)
+{
+    return Init(ManagedDllPath, Options(), error);
+}
+
+bool NM_Bridge::Init(const std::wstring& ManagedDllPath, const Options& options, std::wstring& error)
+{
+    if (ClrRuntimeHost) return true;
+
+    DWORD pid = GetCurrentProcessId();
+    std::string endpoint = "managedbridge_server_" + std::to_string(pid) + "_" + std::to_string(rand() % 10000);
+    std::string token = std::to_string(GetTickCount64()) + "_" + std::to_string(rand());
+    return StartServer(ManagedDllPath, options, endpoint, token, error);
+}
+
+bool NM_Bridge::StartServer(const std::wstring& ManagedDllPath, const Options& options, const std::string& endpoint, const std::string& token, std::wstring& error)
+{
+    HRESULT hr = CLRCreateInstance(CLSID_CLRMetaHost, IID_PPV_ARGS(&MetaHost));
+    if (FAILED(hr))
+    {
+        error = L"CLRCreateInstance failed";
+        return false;
+    }
+
+    hr = MetaHost->GetRuntime(L"v4.0.30319", IID_PPV_ARGS(&RuntimeInfo));
+    if (FAILED(hr))
+    {
+        error = L"GetRuntime failed";
+        return false;
+    }
+
+    BOOL loadable = FALSE;
+    hr = RuntimeInfo->IsLoadable(&loadable);
+    if (FAILED(hr) || !loadable)
+    {
+        error = L"Runtime not loadable";
+        return false;
+    }
+
+    if (options.shareAssemblies)
+    {
+        DWORD flags = 0;
+        DWORD configLen = 0;
+        RuntimeInfo->GetDefaultStartupFlags(&flags, nullptr, &configLen);
+        flags = (flags & ~STARTUP_LOADER_OPTIMIZATION_MASK) | STARTUP_LOADER_OPTIMIZATION_MULTI_DOMAIN_HOST;
+        RuntimeInfo->SetDefaultStartupFlags(flags, nullptr);
+    }
+
+    hr = RuntimeInfo->GetInterface(CLSID_CLRRuntimeHost, IID_ICLRRuntimeHost, (void**)&ClrRuntimeHost);
+    if (FAILED(hr))
+    {
+        error = L"GetInterface(ICLRRuntimeHost) failed";
+        return false;
+    }
+
+    hr = ClrRuntimeHost->Start();
+    if (FAILED(hr))
+    {
+        error = L"CLR Start failed";
+        return false;
+    }
+
+    pipename = endpoint;
+    authToken = token;
+
+    if (!ApplyClientOptions(options, error))
+    {
+        pipename.clear();
+        return false;
+    }
+
+    json initReq = ServerOptions(options);
+    initReq["cmd"] = "_start_server";
+    initReq["pipeName"] = pipename;
+    initReq["authToken"] = authToken;
+
+    std::string dummy;
+    if (!StartManagedServer(ManagedDllPath, initReq.dump(), dummy, error, 15000)) return false;
+    ownsServer = true;
+    return true;
+}
+
+int NM_Bridge::HostMain(int argc, char** argv)
+{
+    std::string managed, endpoint, listen;
+    std::string token = NM_Process::TakeVariable(HostTokenVariable);
+    json settings = json::object();
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--managed") managed = argv[++i];
+        else if (arg == "--endpoint") endpoint = argv[++i];
+        else if (arg == "--options") settings = json::parse(argv[++i], nullptr, false);
+        else if (arg == "--listen") listen = argv[++i];
+    }
+
+    if (managed.empty() || endpoint.empty() || token.empty() || !settings.is_object()) return 2;
+
+    NM_Bridge bridge;
+    std::wstring error;
+    NM_Bridge::Options options = ParseServerOptions(settings);
+    if (!bridge.StartServer(utf8_to_utf16(managed), options, endpoint, token, error)) return 1;
+
+    NM_Listener listener;
+    RelayRoutes routes;
+    routes.control = endpoint;
+    std::thread relay;
+    if (!listen.empty())
+    {
+        // Frames from remote clients are bounded like the ones this host reads as a client.
+        NM_TcpOptions tcp;
+        tcp.maxFrameBytes = static_cast<size_t>((std::max)(1, options.maxFrameMB)) << 20;
+        if (!listener.Listen(listen, error, tcp)) return 1;
+        relay = std::thread(RelayLoop, std::ref(listener), std::ref(routes));
+    }
+
+    // The server runs on CLR threads. StopServer takes its pipe down; a single miss may just be
+    // the moment between two listening instances, so it takes a few in a row.
+    std::string pipePath = "\\\\.\\pipe\\" + endpoint;
+    for (int misses = 0; misses < 3;)
+    {
+        bool listening = WaitNamedPipeA(pipePath.c_str(), 500) || GetLastError() != ERROR_FILE_NOT_FOUND;
+        misses = listening ? 0 : misses + 1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+
+    listener.Close();
+    if (relay.joinable()) relay.join();
+    bridge.ownsServer = false;
+    return 0;
+}
+#endif
+
+bool NM_Bridge::Connect(const std::string& endpoint, const std::string& token, const Options& options, std::wstring& error)
+{
+    if (!pipename.empty()) return true;
+
+    pipename = endpoint;
+    authToken = token;
+    ownsServer = false;
+
+    // GetStats doubles as a probe: it needs a live server and a valid token.
+    std::string response;
+    if (!ApplyClientOptions(options, error) || !GetStats(response, error))
+    {
+        if (capture) capture->Close();
+        pipename.clear();
+        authToken.clear();
+        return false;
+    }
+    return true;
+}
+
+bool NM_Bridge::ApplyClientOptions(const Options& options, std::wstring& error)
+{
+    clientCacheEntries = static_cast<size_t>((std::max)(0, options.clientCacheEntries));
+    clientCacheTtlMs = (std::max)(0, options.clientCacheTtlMs);
+    methodMetrics = options.methodMetrics;
+    maxIdleConnections = static_cast<size_t>((std::max)(0, options.maxIdleConnections));
+    clientMaxInFlight = (std::max)(0, options.clientMaxInFlight);
+    tcpNoDelay = options.tcpNoDelay;
+    tcpKeepAliveSec = (std::max)(0, options.tcpKeepAliveSec);
+    maxFrameBytes = static_cast<size_t>((std::max)(1, options.maxFrameMB)) << 20;
+    {
+        std::lock_guard<std::mutex> lock(releaseLock);
+        releaseFlushMs = (std::max)(0, options.releaseFlushMs);
+        releaseBatchMax = static_cast<size_t>((std::max)(1, options.releaseBatchMax));
+        flusherAllowed = true;
+    }
+
+    if (options.capturePath.empty()) return true;
+    if (!capture) capture.reset(new NM_CaptureWriter());
+    return capture->Open(options.capturePath, authToken, error);
+}
+
+// ---------------- Host processes ----------------
+
+bool NM_Bridge::Launch(const std::string& path, const std::vector<std::string>& args, int hostCount, const Options& options, std::wstring& error)
+{
+    if (!pipename.empty()) return true;
+    if (hostCount < 1)
+    {
+        error = L"At least one host process is needed";
+        return false;
+    }
+
+    hostPath = path;
+    hostArgs = args;
+    hostOptions = ServerOptions(options).dump();
+    authToken = RandomHex(16);
+    if (!ApplyClientOptions(options, error))
+    {
+        authToken.clear();
+        return false;
+    }
+
+    std::string prefix = "nm_host_" + std::to_string(CurrentProcessId()) + "_" + RandomHex(2) + "_";
+    std::vector<Host> started(hostCount);
+    for (int i = 0; i < hostCount; ++i)
+    {
+        started[i].endpoint = prefix + std::to_string(i);
+        if (StartHost(started[i], error)) continue;
+
+        for (auto& host : started)
+        {
+            if (host.process) host.process->Terminate();
+        }
+        if (capture) capture->Close();
+        authToken.clear();
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(hostLock);
+        hosts = std::move(started);
+        supervising = true;
+    }
+    pipename = hosts[0].endpoint;
+    ownsServer = true;
+    supervisor = std::thread(&NM_Bridge::Supervise, this);
+    return true;
+}
+
+bool NM_Bridge::StartHost(Host& host, std::wstring& error)
+{
+    std::vector<std::string> args = hostArgs;
+    args.insert(args.end(), { "--endpoint", host.endpoint, "--options", hostOptions });
+
+    std::unique_ptr<NM_Process> process(new NM_Process());
+    if (!process->Start(hostPath, args, error, { { HostTokenVariable, authToken } })) return false;
+
+    // GetStats doubles as the readiness probe; short rounds notice a host that exits on startup.
+    json rq = { {"op", Op::GetStats}, {"authToken", authToken} };
+    std::string response;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(15);
+    while (!RoundTrip(Op::GetStats, host.endpoint, rq.dump(), response, error, 250, std::string()))
+    {
+        if (!process->Running() || std::chrono::steady_clock::now() >= deadline)
+        {
+            process->Terminate();
+            error = L"Host process did not start: " + error;
+            return false;
+        }
+    }
+
+    host.process = std::move(process);
+    return true;
+}
+
+// Restarts hosts that have exited. Their domains are gone with them: forgetting the domain pipes
+// makes calls on those domains fail at once on the host's control pipe until they are created again.
+void NM_Bridge::Supervise()
+{
+    std::unique_lock<std::mutex> lock(hostLock);
+    while (supervising)
+    {
+        supervisorWake.wait_for(lock, std::chrono::milliseconds(250));
+
+        for (size_t i = 0; supervising && i < hosts.size(); ++i)
+        {
+            Host& host = hosts[i];
+            if (host.process && host.process->Running()) continue;
+
+            std::vector<std::string> lost;
+            for (const auto& p : placement)
+            {
+                if (p.second == i) lost.push_back(p.first);
+            }
+            host.domains = 0;
+            ++host.restarts;
+
+            Host replacement;
+            replacement.endpoint = host.endpoint;
+            lock.unlock();
+
+            for (const auto& domainId : lost)
+            {
+                std::string pipe;
+                {
+                    std::unique_lock<std::shared_mutex> domains(domainLock);
+                    auto it = domainPipes.find(domainId);
+                    if (it != domainPipes.end())
+                    {
+                        pipe = it->second;
+                        domainPipes.erase(it);
+                    }
+                    // Its event stream keeps retrying, and resumes if the domain is created again.
+                    eventPipes.erase(domainId);
+                }
+
+                if (!pipe.empty())
+                {
+                    DropConnections(pipe);
+                    std::lock_guard<std::mutex> throttle(throttleLock);
+                    throttles.erase(pipe);
+                }
+                CacheDropDomain(domainId);
+                DropReleases(domainId);
+            }
+            DropConnections(replacement.endpoint);
+
+            std::wstring error;
+            bool restarted = StartHost(replacement, error);
+            lock.lock();
+            if (restarted) host.process = std::move(replacement.process);
+        }
+    }
+}
+
+// Picks the host for domainId: the one it was placed on before, else the one with the fewest
+// domains. Caller holds hostLock.
+size_t NM_Bridge::PlaceDomain(const std::string& domainId)
+{
+    auto it = placement.find(domainId);
+    if (it != placement.end()) return it->second;
+
+    size_t best = 0;
+    for (size_t i = 1; i < hosts.size(); ++i)
+    {
+        if (hosts[i].domains < hosts[best].domains) best = i;
+    }
+    return best;
+}
+
+// Control pipe of the host that owns domainId; empty (the default pipe) without Launch().
+std::string NM_Bridge::ControlPipeFor(const std::string& domainId)
+{
+    std::lock_guard<std::mutex> lock(hostLock);
+    if (hosts.empty()) return std::string();
+
+    auto it = placement.find(domainId);
+    return hosts[it != placement.end() ? it->second : 0].endpoint;
+}
+
+void NM_Bridge::Shutdown()
+{
+    std::vector<std::string> streams;
+    {
+        std::lock_guard<std::mutex> lock(eventLock);
+        for (const auto& s : eventStreams) streams.push_back(s.first);
+    }
+    for (const auto& domainId : streams) StopEvents(domainId);
+
+    // No QueueRelease may start a flusher from here on, so the one moved out is the last.
+    std::thread stopping;
+    {
+        std::lock_guard<std::mutex> lock(releaseLock);
+        flusherAllowed = false;
+        flushing = false;
+        stopping = std::move(flusher);
+    }
+    if (stopping.joinable())
+    {
+        releaseWake.notify_all();
+        stopping.join();
+    }
+
+    // A server this bridge leaves running would keep those instances otherwise.
+    if (!pipename.empty())
+    {
+        std::wstring err;
+        FlushReleases(err, 2000);
+    }
+
+    if (supervisor.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(hostLock);
+            supervising = false;
+        }
+        supervisorWake.notify_all();
+        supervisor.join();
+    }
+
+    if (!pipename.empty())
+    {
+        // New requests fail from here on; taking the lifecycle lock waits out the ones in flight.
+        closing.store(true, std::memory_order_release);
+        std::unique_lock<std::shared_mutex> drain(lifecycle);
+
+        if (ownsServer)
+        {
+            std::vector<std::string> servers(1, pipename);
+            if (!hosts.empty()) servers.clear();
+            for (const auto& host : hosts) servers.push_back(host.endpoint);
+
+            std::string dummy;
+            std::wstring err;
+            json rq = { {"op", Op::StopServer}, {"authToken", authToken} };
+            for (const auto& server : servers) RoundTrip(Op::StopServer, server, rq.dump(), dummy, err, 2000, std::string());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(hostLock);
+            for (auto& host : hosts)
+            {
+                if (host.process && !host.process->Wait(2000)) host.process->Terminate();
+            }
+            hosts.clear();
+            placement.clear();
+        }
+        pipename.clear();
+        domainPipes.clear();
+        eventPipes.clear();
+        if (capture) capture->Close();
+
+        {
+            std::lock_guard<std::mutex> lock(poolLock);
+            idleConnections.clear();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(throttleLock);
+            throttles.clear();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(releaseLock);
+            pendingReleases.clear();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(cacheLock);
+            resultCache.clear();
+            resultLru.clear();
+        }
+        closing.store(false, std::memory_order_release);
+    }
+
+#ifdef _WIN32
+    if (ClrRuntimeHost)
+    {
+        ClrRuntimeHost->Stop();
+        ClrRuntimeHost->Release();
+        ClrRuntimeHost = nullptr;
+    }
+
+    if (RuntimeInfo)
+    {
+        RuntimeInfo->Release();
+        RuntimeInfo = nullptr;
+    }
+
+    if (MetaHost)
+    {
+        MetaHost->Release();
+        MetaHost = nullptr;
+    }
+#endif
+}
+
+#ifdef _WIN32
+bool NM_Bridge::StartManagedServer(const std::wstring& ManagedDllPath, const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs)
+{
+    if (!ClrRuntimeHost)
+    {
+        error = L"CLR not initialized";
+        return false;
+    }
+
+    std::wstring wideReq = utf8_to_utf16(requestJson);
+
+    DWORD ret = 0;
+    HRESULT hr = ClrRuntimeHost->ExecuteInDefaultAppDomain(ManagedDllPath.c_str(), L"MANAGED_Bridge.Managed_Bridge", L"StartServer", wideReq.c_str(), &ret);
+
+    if (FAILED(hr))
+    {
+        error = L"StartServer failed";
+        return false;
+    }
+
+    int tries = timeoutMs / 200;
+    bool ok = false;
+
+    for (int i = 0; i < tries; ++i)
+    {
+        std::string pipePath = "\\\\.\\pipe\\" + pipename;
+
+        if (WaitNamedPipeA(pipePath.c_str(), 100) || GetLastError() == ERROR_PIPE_BUSY)
+        {
+            ok = true;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    if (!ok)
+    {
+        error = L"Managed server did not start or pipe not available";
+        return false;
+    }
+
+    output = "{\"success\":true}";
+    return true;
+}
+#endif
+
+// ---------------- Domain ----------------
+
+bool NM_Bridge::CreateDomain(const std::string& domainId, std::string& response, std::wstring& error, int timeoutMs)
+{
+    json rq;
+    rq["op"] = Op::CreateDomain;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+
+    std::string control;
+    size_t host = 0;
+    {
+        std::lock_guard<std::mutex> lock(hostLock);
+        if (!hosts.empty())
+        {
+            host = PlaceDomain(domainId);
+            control = hosts[host].endpoint;
+        }
+    }
+    if (!SendToPipe(Op::CreateDomain, control, rq.dump(), response, error, timeoutMs, std::string())) return false;
+
+    // The pipe named in the reply is local to the server's machine; a TCP client reaches the
+    // domain through the endpoint it already has.
+    auto resp = json::parse(response, nullptr, false);
+    std::string id = resp.is_object() ? resp.value("domainId", domainId) : domainId;
+    if (resp.is_object() && resp.contains("pipeName") && !NM_Connection::IsTcp(control.empty() ? pipename : control))
+    {
+        std::unique_lock<std::shared_mutex> lock(domainLock);
+        domainPipes[id] = resp["pipeName"].get<std::string>();
+        if (resp.contains("eventPipe")) eventPipes[id] = resp["eventPipe"].get<std::string>();
+    }
+
+    if (!control.empty())
+    {
+        std::lock_guard<std::mutex> lock(hostLock);
+        if (host < hosts.size())
+        {
+            placement[id] = host;
+            ++hosts[host].domains;
+        }
+    }
+    return true;
+}
+
+bool NM_Bridge::UnloadDomain(const std::string& domainId, std::string& response, std::wstring& error, int timeoutMs)
+{
+    json rq;
+    rq["op"] = Op::UnloadDomain;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    if (!SendToPipe(Op::UnloadDomain, ControlPipeFor(domainId), rq.dump(), response, error, timeoutMs, std::string())) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(hostLock);
+        auto it = placement.find(domainId);
+        if (it != placement.end() && it->second < hosts.size() && hosts[it->second].domains > 0) --hosts[it->second].domains;
+    }
+
+    std::string pipe;
+    {
+        std::unique_lock<std::shared_mutex> lock(domainLock);
+        auto it = domainPipes.find(domainId);
+        if (it != domainPipes.end())
+        {
+            pipe = it->second;
+            domainPipes.erase(it);
+        }
+        eventPipes.erase(domainId);
+    }
+
+    if (!pipe.empty() && pipe != pipename)
+    {
+        DropConnections(pipe);
+        std::lock_guard<std::mutex> lock(throttleLock);
+        throttles.erase(pipe);
+    }
+    CacheDropDomain(domainId);
+    DropReleases(domainId);
+    StopEvents(domainId);
+    return true;
+}
+
+bool NM_Bridge::GetStats(std::string& response, std::wstring& error, int timeoutMs)
+{
+    json rq;
+    rq["op"] = Op::GetStats;
+    rq["authToken"] = authToken;
+
+    json hostList = json::array();
+    {
+        std::lock_guard<std::mutex> lock(hostLock);
+        for (const auto& host : hosts)
+        {
+            hostList.push_back({
+                {"endpoint", host.endpoint}, {"pid", host.process ? host.process->Id() : 0},
+                {"restarts", host.restarts}, {"domains", host.domains}
+            });
+        }
+    }
+    if (hostList.empty()) return SendCommand(Op::GetStats, rq.dump(), response, error, timeoutMs);
+
+    // A host that is down or restarting reports its error instead of failing the whole call.
+    for (auto& host : hostList)
+    {
+        std::string stats;
+        std::wstring hostError;
+        if (SendToPipe(Op::GetStats, host["endpoint"].get<std::string>(), rq.dump(), stats, hostError, timeoutMs, std::string()))
+        {
+            host["stats"] = json::parse(stats, nullptr, false);
+        }
+        else
+        {
+            host["error"] = utf16_to_utf8(hostError);
+        }
+    }
+
+    response = json{ {"success", true}, {"hosts", hostList} }.dump();
+    return true;
+}
+
+// ---------------- Load ----------------
+
+bool NM_Bridge::LoadFromFile(const std::string& domainId, const std::wstring& assemblyPath, const std::string& assemblyAlias, std::string& response, std::wstring& error, int timeoutMs)
+{
+    json rq;
+    rq["op"] = Op::LoadFromFile;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    rq["path"] = utf16_to_utf8(assemblyPath);
+    if (!assemblyAlias.empty()) rq["assemblyAlias"] = assemblyAlias;
+    return SendDomainCommand(Op::LoadFromFile, domainId, rq.dump(), response, error, timeoutMs);
+}
+
+bool NM_Bridge::LoadFromMemory(const std::string& domainId, const std::vector<uint8_t>& bytes, const std::string& simpleName, std::string& response, std::wstring& error, int timeoutMs)
+{
+    json rq;
+    rq["op"] = Op::LoadFromMemory;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    rq["bytesBase64"] = base64_encode(bytes);
+    if (!simpleName.empty()) rq["assemblyAlias"] = simpleName;
+    return SendDomainCommand(Op::LoadFromMemory, domainId, rq.dump(), response, error, timeoutMs);
+}
+
+// ---------------- Invoke ----------------
+
+bool NM_Bridge::CreateInstance(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& constructorArgsJson, InstanceHandle& instance, std::string& resultJson, std::wstring& err, int timeoutMs)
+{
+    json rq;
+    rq["op"] = Op::CreateInstance;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    rq["assemblyName"] = assemblyAlias;
+    rq["typeName"] = typeName;
+
+    instance = InstanceHandle::Invalid;
+    if (!SetArgs(rq, FormatArgs(constructorArgsJson), err)) return false;
+    if (!SendDomainCommand(Op::CreateInstance, domainId, rq.dump(), resultJson, err, timeoutMs)) return false;
+
+    auto resp = json::parse(resultJson, nullptr, false);
+    if (resp.is_object() && resp.contains("instanceHandle"))
+    {
+        instance = static_cast<InstanceHandle>(resp["instanceHandle"].get<uint64_t>());
+    }
+    return true;
+}
+
+bool NM_Bridge::ReleaseInstance(const std::string& domainId, InstanceHandle instance, std::string& resultJson, std::wstring& err, int timeoutMs)
+{
+    json rq;
+    rq["op"] = Op::ReleaseInstance;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    rq["instanceHandle"] = static_cast<uint64_t>(instance);
+    return SendDomainCommand(Op::ReleaseInstance, domainId, rq.dump(), resultJson, err, timeoutMs);
+}
+
+uint64_t NM_Bridge::DomainEpoch(const std::string& domainId) const
+{
+    std::lock_guard<std::mutex> lock(releaseLock);
+    auto it = domainEpochs.find(domainId);
+    return it == domainEpochs.end() ? 0 : it->second;
+}
+
+void NM_Bridge::QueueRelease(const std::string& domainId, InstanceHandle instance, uint64_t epoch)
+{
+    if (instance == InstanceHandle::Invalid) return;
+
+    std::lock_guard<std::mutex> lock(releaseLock);
+    auto current = domainEpochs.find(domainId);
+    if (epoch != (current == domainEpochs.end() ? 0 : current->second))
+    {
+        releasesStale.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    auto& pending = pendingReleases[domainId];
+    if (pending.handles.empty()) pending.since = std::chrono::steady_clock::now();
+    pending.handles.push_back(static_cast<uint64_t>(instance));
+    releasesQueued.fetch_add(1, std::memory_order_relaxed);
+
+    if (!flusher.joinable() && releaseFlushMs > 0 && flusherAllowed && !closing.load(std::memory_order_acquire))
+    {
+        flushing = true;
+        flusher = std::thread(&NM_Bridge::FlushLoop, this);
+    }
+    if (pending.handles.size() >= releaseBatchMax) releaseWake.notify_one();
+}
+
+bool NM_Bridge::FlushReleases(std::wstring& error, int timeoutMs)
+{
+    std::vector<std::string> domains;
+    {
+        std::lock_guard<std::mutex> lock(releaseLock);
+        for (const auto& p : pendingReleases) domains.push_back(p.first);
+    }
+
+    bool ok = true;
+    for (const auto& domainId : domains) ok = SendReleases(domainId, error, timeoutMs) && ok;
+    return ok;
+}
+
+
+bool NM_Bridge::InvokeStatic(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    if (clientCacheEntries > 0) return InvokeCached(domainId, assemblyAlias, typeName, methodName, argsJson, response, error, timeoutMs, cancelId);
+
+    NM_CallBuffers buffers;
+    return Invoke(Op::InvokeStatic, domainId, assemblyAlias, InstanceHandle::Invalid, typeName, methodName, argsJson, response, buffers, error, timeoutMs, cancelId);
+}
+
+
+bool NM_Bridge::InvokeInstance(const std::string& domainId, const std::string& assemblyAlias, InstanceHandle instance, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    NM_CallBuffers buffers;
+    return Invoke(Op::InvokeInstance, domainId, assemblyAlias, instance, typeName, methodName, argsJson, response, buffers, error, timeoutMs, cancelId);
+}
+
+bool NM_Bridge::InvokeStatic(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_CallBuffers& buffers, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    if (clientCacheEntries > 0) return InvokeCached(domainId, assemblyAlias, typeName, methodName, argsJson, buffers.reply, error, timeoutMs, cancelId);
+    return Invoke(Op::InvokeStatic, domainId, assemblyAlias, InstanceHandle::Invalid, typeName, methodName, argsJson, buffers.reply, buffers, error, timeoutMs, cancelId);
+}
+
+bool NM_Bridge::InvokeInstance(const std::string& domainId, const std::string& assemblyAlias, InstanceHandle instance, const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_CallBuffers& buffers, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    return Invoke(Op::InvokeInstance, domainId, assemblyAlias, instance, typeName, methodName, argsJson, buffers.reply, buffers, error, timeoutMs, cancelId);
+}
+
+bool NM_Bridge::InvokeStatic(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_BufferPool::Lease& response, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    return InvokeStatic(domainId, assemblyAlias, typeName, methodName, argsJson, response.Buffers(), error, timeoutMs, cancelId);
+}
+
+bool NM_Bridge::InvokeInstance(const std::string& domainId, const std::string& assemblyAlias, InstanceHandle instance, const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_BufferPool::Lease& response, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    return InvokeInstance(domainId, assemblyAlias, instance, typeName, methodName, argsJson, response.Buffers(), error, timeoutMs, cancelId);
+}
+
+// The request is written straight into buffers.request and sent from there.
+bool NM_Bridge::Invoke(Op op, const std::string& domainId, const std::string& assemblyAlias, InstanceHandle instance, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, NM_CallBuffers& buffers, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    uint64_t handle = static_cast<uint64_t>(instance);
+    if (!EncodeInvoke(buffers.request, static_cast<int>(op), domainId, authToken, assemblyAlias, op == Op::InvokeInstance ? &handle : nullptr, typeName, methodName, argsJson, error)) return false;
+    return SendDomainCommand(op, domainId, buffers.request, response, error, timeoutMs, methodMetrics ? typeName + "." + methodName : std::string(), cancelId, &buffers);
+}
+
+bool NM_Bridge::InvokeCached(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    json rq;
+    rq["op"] = Op::InvokeStatic;
+    rq["domainId"] = domainId;
+    rq["assemblyName"] = assemblyAlias;
+    rq["typeName"] = typeName;
+    rq["methodName"] = methodName;
+    if (!SetArgs(rq, FormatArgs(argsJson), error)) return false;
+
+    // Cache key is the canonical request (object keys are sorted) without the token.
+    std::string key = rq.dump();
+    std::string stale;
+    {
+        std::lock_guard<std::mutex> lock(cacheLock);
+        auto it = resultCache.find(key);
+        if (it != resultCache.end())
+        {
+            resultLru.splice(resultLru.begin(), resultLru, it->second.lru);
+            if (std::chrono::steady_clock::now() < it->second.freshUntil)
+            {
+                response = it->second.response;
+                return true;
+            }
+            rq["ifNoneMatch"] = it->second.etag;
+            stale = it->second.response;
+        }
+    }
+
+    rq["authToken"] = authToken;
+    if (!SendDomainCommand(Op::InvokeStatic, domainId, rq.dump(), response, error, timeoutMs, methodMetrics ? typeName + "." + methodName : std::string(), cancelId)) return false;
+
+    // A reply whose etag or notModified has the wrong type is passed on as it is, uncached.
+    auto resp = json::parse(response, nullptr, false);
+    if (!resp.is_object()) return true;
+    auto etag = resp.find("etag");
+    auto notModified = resp.find("notModified");
+    if (etag == resp.end() || !etag->is_string()) return true;
+    if (notModified != resp.end() && !notModified->is_boolean()) return true;
+
+    if (notModified != resp.end() && notModified->get<bool>())
+    {
+        response = stale;
+    }
+    CacheStore(key, domainId, etag->get<std::string>(), response);
+    return true;
+}
+
+bool NM_Bridge::StreamStatic(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, int chunkRows, std::string& response, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    json rq;
+    rq["op"] = Op::InvokeStatic;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    rq["assemblyName"] = assemblyAlias;
+    rq["typeName"] = typeName;
+    rq["methodName"] = methodName;
+    rq["chunk"] = (std::max)(chunkRows, 1);
+    if (!SetArgs(rq, FormatArgs(argsJson), error)) return false;
+    return SendDomainCommand(Op::InvokeStatic, domainId, rq.dump(), response, error, timeoutMs, methodMetrics ? typeName + "." + methodName : std::string(), cancelId);
+}
+
+bool NM_Bridge::StreamInstance(const std::string& domainId, const std::string& assemblyAlias, InstanceHandle instance, const std::string& typeName, const std::string& methodName, const std::string& argsJson, int chunkRows, std::string& response, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    json rq;
+    rq["op"] = Op::InvokeInstance;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    rq["assemblyName"] = assemblyAlias;
+    rq["instanceHandle"] = static_cast<uint64_t>(instance);
+    rq["methodName"] = methodName;
+    rq["chunk"] = (std::max)(chunkRows, 1);
+    if (!SetArgs(rq, FormatArgs(argsJson), error)) return false;
+    return SendDomainCommand(Op::InvokeInstance, domainId, rq.dump(), response, error, timeoutMs, methodMetrics ? typeName + "." + methodName : std::string(), cancelId);
+}
+
+// The server only enumerates when asked, so a slow reader holds back the producer rather than piling up rows.
+bool NM_Bridge::ReadCursor(const std::string& domainId, InstanceHandle cursor, int chunkRows, std::string& response, std::wstring& error, int timeoutMs)
+{
+    json rq;
+    rq["op"] = Op::ReadCursor;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    rq["instanceHandle"] = static_cast<uint64_t>(cursor);
+    rq["chunk"] = (std::max)(chunkRows, 1);
+    return SendDomainCommand(Op::ReadCursor, domainId, rq.dump(), response, error, timeoutMs);
+}
+
+// Goes to the control pipe: on the domain pipe it would wait behind the call it is meant to stop.
+bool NM_Bridge::Cancel(const std::string& domainId, uint64_t cancelId, std::string& response, std::wstring& error, int timeoutMs)
+{
+    json rq;
+    rq["op"] = Op::Cancel;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    rq["cancelId"] = cancelId;
+    return SendToPipe(Op::Cancel, ControlPipeFor(domainId), rq.dump(), response, error, timeoutMs, std::string());
+}
+
+bool NM_Bridge::RegisterCacheable(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, std::string& response, std::wstring& error, int timeoutMs)
+{
+    json rq;
+    rq["op"] = Op::RegisterCacheable;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    rq["assemblyName"] = assemblyAlias;
+    rq["typeName"] = typeName;
+    rq["methodName"] = methodName;
+    return SendDomainCommand(Op::RegisterCacheable, domainId, rq.dump(), response, error, timeoutMs);
+}
+
+bool NM_Bridge::Replay(int op, const std::string& requestJson, std::string& response, std::wstring& error, int timeoutMs)
+{
+    json rq = json::parse(requestJson, nullptr, false);
+    if (!rq.is_object())
+    {
+        error = L"Invalid request JSON";
+        return false;
+    }
+
+    std::string domainId = rq.value("domainId", std::string());
+    switch (static_cast<Op>(op))
+    {
+    case Op::CreateDomain: return CreateDomain(domainId, response, error, timeoutMs);
+    case Op::UnloadDomain: return UnloadDomain(domainId, response, error, timeoutMs);
+    case Op::GetStats: return GetStats(response, error, timeoutMs);
+    default: break;
+    }
+
+    // Captured requests carry a blank token; this bridge's own goes in its place.
+    rq["authToken"] = authToken;
+    if (domainId.empty()) return SendCommand(static_cast<Op>(op), rq.dump(), response, error, timeoutMs);
+    return SendDomainCommand(static_cast<Op>(op), domainId, rq.dump(), response, error, timeoutMs);
+}
+
+// ---------------- WPF ----------------
+
+bool NM_Bridge::RunWpfApp(const std::string& domainId, const std::string& assemblyName, const std::string& typeName, const std::string& methodName, const std::vector<std::string>& argsJson, std::string& response, std::wstring& error, int timeoutMs) {
+    json rq;
+    rq["op"] = Op::RunWpfApp;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    rq["assemblyName"] = assemblyName;
+    rq["typeName"] = typeName;
+    rq["methodName"] = methodName;
+    if (!argsJson.empty()) rq["args"] = argsJson;
+    return SendDomainCommand(Op::RunWpfApp, domainId, rq.dump(), response, error, timeoutMs);
+}
+
+bool NM_Bridge::StopWpfApp(const std::string& domainId, const std::string& assemblyAlias, std::string& response, std::wstring& error, int timeoutMs) {
+    json rq;
+    rq["op"] = Op::StopWpfApp;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    rq["assemblyAlias"] = assemblyAlias;
+    return SendDomainCommand(Op::StopWpfApp, domainId, rq.dump(), response, error, timeoutMs);
+}
+
+
+// ---------------- Events ----------------
+
+uint64_t NM_Bridge::Subscribe(const std::string& domainId, const std::string& eventName, EventHandler handler, std::wstring& error, int timeoutMs)
+{
+    if (domainId.empty() || !handler)
+    {
+        error = L"domainId and handler required";
+        return 0;
+    }
+
+    std::unique_lock<std::mutex> lock(eventLock);
+    if (!eventStreams.count(domainId))
+    {
+        // Opened up front, so a domain that cannot deliver events fails here rather than going quiet.
+        lock.unlock();
+        auto connection = OpenEvents(domainId, error, timeoutMs);
+        if (!connection) return 0;
+        lock.lock();
+
+        auto& stream = eventStreams[domainId];
+        if (!stream)
+        {
+            stream = std::make_shared<EventStream>();
+            stream->domainId = domainId;
+            stream->connection = std::move(connection);
+            stream->reader = std::thread(&NM_Bridge::EventLoop, this, stream);
+        }
+    }
+
+    uint64_t id = ++nextSubscription;
+    subscriptions[id] = Subscription{ domainId, eventName, std::make_shared<EventHandler>(std::move(handler)) };
+    return id;
+}
+
+// The domain's event pipe stays open until the domain is unloaded.
+void NM_Bridge::Unsubscribe(uint64_t subscription)
+{
+    std::lock_guard<std::mutex> lock(eventLock);
+    subscriptions.erase(subscription);
+}
+
+void NM_Bridge::SetEventExecutor(Executor executor)
+{
+    std::lock_guard<std::mutex> lock(eventLock);
+    eventExecutor = executor ? std::make_shared<Executor>(std::move(executor)) : nullptr;
+}
+
+// The pipe named in CreateDomain's reply, or for a TCP client the endpoint it already has.
+std::string NM_Bridge::EventPipeFor(const std::string& domainId)
+{
+    std::string control = ControlPipeFor(domainId);
+    if (control.empty()) control = pipename;
+    if (NM_Connection::IsTcp(control)) return control;
+
+    std::shared_lock<std::shared_mutex> lock(domainLock);
+    auto it = eventPipes.find(domainId);
+    return it != eventPipes.end() ? it->second : std::string();
+}
+
+std::unique_ptr<NM_Connection> NM_Bridge::OpenEvents(const std::string& domainId, std::wstring& error, int timeoutMs)
+{
+    std::string endpoint = EventPipeFor(domainId);
+    if (endpoint.empty())
+    {
+        error = L"No event pipe for domain " + utf8_to_utf16(domainId);
+        return nullptr;
+    }
+
+    NM_TcpOptions tcp;
+    tcp.noDelay = tcpNoDelay;
+    tcp.keepAliveSec = tcpKeepAliveSec;
+    tcp.maxFrameBytes = maxFrameBytes;
+    auto connection = NM_Connection::Open(endpoint, timeoutMs, error, tcp);
+    if (!connection) return nullptr;
+
+    json rq;
+    rq["op"] = Op::Subscribe;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    std::string request = rq.dump(), reply;
+    if (!connection->Write(request.data(), request.size(), error) || !connection->Read(reply, timeoutMs, error)) return nullptr;
+
+    auto rs = json::parse(reply, nullptr, false);
+    if (!rs.is_object() || !rs.value("success", false))
+    {
+        error = utf8_to_utf16(rs.is_object() ? rs.value("error", std::string("Subscribe failed")) : std::string("Invalid reply"));
+        return nullptr;
+    }
+    return connection;
+}
+
+// After the subscribe reply the server only writes: one message per batch of events.
+void NM_Bridge::EventLoop(std::shared_ptr<EventStream> stream)
+{
+    std::string message;
+    std::wstring error;
+    NM_Connection* connection = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(stream->lock);
+        connection = stream->connection.get();
+    }
+
+    for (;;)
+    {
+        while (connection && connection->Read(message, -1, error)) Dispatch(stream->domainId, message);
+
+        std::unique_lock<std::mutex> lock(stream->lock);
+        stream->connection.reset();
+        connection = nullptr;
+        while (!stream->stopping && !connection)
+        {
+            if (stream->wake.wait_for(lock, std::chrono::milliseconds(250), [&] { return stream->stopping; })) break;
+
+            lock.unlock();
+            auto reopened = OpenEvents(stream->domainId, error, 1000);
+            lock.lock();
+            if (reopened && !stream->stopping)
+            {
+                stream->connection = std::move(reopened);
+                connection = stream->connection.get();
+                eventReconnects.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (stream->stopping) return;
+    }
+}
+
+void NM_Bridge::Dispatch(const std::string& domainId, const std::string& message)
+{
+    json batch = json::parse(message, nullptr, false);
+    if (!batch.is_object() || !batch.contains("events") || !batch["events"].is_array()) return;
+    eventsDropped.fetch_add(batch.value("dropped", uint64_t(0)), std::memory_order_relaxed);
+
+    std::vector<std::shared_ptr<Event>> events;
+    for (const auto& e : batch["events"])
+    {
+        auto event = std::make_shared<Event>();
+        event->domainId = domainId;
+        event->name = e.value("name", std::string());
+        event->payload = e.contains("payload") ? e["payload"].dump() : "null";
+        event->coalesced = e.value("coalesced", uint64_t(0));
+        eventsReceived.fetch_add(1, std::memory_order_relaxed);
+        eventsCoalesced.fetch_add(event->coalesced, std::memory_order_relaxed);
+        events.push_back(std::move(event));
+    }
+
+    // Handlers run outside eventLock, so they may subscribe and unsubscribe.
+    std::vector<std::pair<std::shared_ptr<EventHandler>, std::shared_ptr<Event>>> calls;
+    std::shared_ptr<Executor> executor;
+    {
+        std::lock_guard<std::mutex> lock(eventLock);
+        executor = eventExecutor;
+        for (const auto& event : events)
+        {
+            for (const auto& s : subscriptions)
+            {
+                if (s.second.domainId == domainId && (s.second.name.empty() || s.second.name == event->name)) calls.emplace_back(s.second.handler, event);
+            }
+        }
+    }
+
+    for (auto& call : calls)
+    {
+        if (executor)
+        {
+            auto handler = call.first;
+            auto event = call.second;
+            (*executor)([handler, event] { (*handler)(*event); });
+        }
+        else
+        {
+            (*call.first)(*call.second);
+        }
+    }
+}
+
+// Drops the domain's stream and its subscriptions. A handler running inline may call this
+// (say, through UnloadDomain); its thread then finishes on its own.
+void NM_Bridge::StopEvents(const std::string& domainId)
 {
-    std::string utf16_to_utf8(const std::wstring& ws)
+    std::shared_ptr<EventStream> stream;
     {
-        if (ws.empty()) return {};
-        int sz = WideCharToMultiByte(CP_UTF8, 0, ws.c_str(), -1, nullptr, 0, nullptr, nullptr);
-        std::string s(sz, 0);
-        WideCharToMultiByte(CP_UTF8, 0, ws.c_str(), -1, &s[0], sz, nullptr, nullptr);
-        if (!s.empty() && s.back() == '\0') s.pop_back();
-        return s;
+        std::lock_guard<std::mutex> lock(eventLock);
+        auto it = eventStreams.find(domainId);
+        if (it != eventStreams.end())
+        {
+            stream = it->second;
+            eventStreams.erase(it);
+        }
+        for (auto s = subscriptions.begin(); s != subscriptions.end();)
+        {
+            if (s->second.domainId == domainId) s = subscriptions.erase(s);
+            else ++s;
+        }
     }
+    if (!stream) return;
 
-    std::wstring utf8_to_utf16(const std::string& s)
     {
-        if (s.empty()) return {};
-        int sz = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, nullptr, 0);
-        std::wstring ws(sz, 0);
-        MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, &ws[0], sz);
-        if (!ws.empty() && ws.back() == L'\0') ws.pop_back();
-        return ws;
+        std::lock_guard<std::mutex> lock(stream->lock);
+        stream->stopping = true;
+        if (stream->connection) stream->connection->Interrupt();
     }
+    stream->wake.notify_all();
+
+    if (stream->reader.get_id() == std::this_thread::get_id()) stream->reader.detach();
+    else if (stream->reader.joinable()) stream->reader.join();
+}
+
 
+// ---------------- Metrics ----------------
 
-    std::string base64_encode(const std::vector<BYTE>& data)
+void NM_Bridge::GetMetrics(std::string& response) const
+{
+    auto toJson = [](const std::vector<NM_Metrics::Entry>& entries)
     {
-        if (data.empty()) return "";
-        DWORD outLen = 0;
-        CryptBinaryToStringA((const BYTE*)data.data(), (DWORD)data.size(), CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, NULL, &outLen);
-        std::string out(outLen + 1, '\0');
-        if (CryptBinaryToStringA((const BYTE*)data.data(), (DWORD)data.size(), CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, &out[0], &outLen)) {
-            out.resize(outLen);
-            return out;
+        json out = json::object();
+        for (const auto& e : entries)
+        {
+            json phases = json::object();
+            for (int p = 0; p < static_cast<int>(NM_Metrics::Phase::Count); ++p)
+            {
+                const auto& s = e.phases[p];
+                if (s.count == 0) continue;
+                phases[NM_Metrics::PhaseName(static_cast<NM_Metrics::Phase>(p))] = {
+                    {"count", s.count}, {"meanUs", s.meanUs}, {"p50Us", s.p50Us}, {"p90Us", s.p90Us},
+                    {"p99Us", s.p99Us}, {"p999Us", s.p999Us}, {"maxUs", s.maxUs}
+                };
+            }
+            out[e.name] = std::move(phases);
+        }
+        return out;
+    };
+
+    json pipes = json::object();
+    {
+        std::lock_guard<std::mutex> lock(throttleLock);
+        for (const auto& t : throttles)
+        {
+            auto s = t.second->Snapshot();
+            pipes[t.first] = {
+                {"inFlight", s.inFlight}, {"peakInFlight", s.peakInFlight}, {"window", s.window},
+                {"serverQueue", s.serverQueue}, {"serverPeakQueue", s.serverPeakQueue},
+                {"throttled", s.throttled}, {"overloaded", s.overloaded}
+            };
         }
-        return "";
     }
-}
 
+    size_t pending = 0;
+    {
+        std::lock_guard<std::mutex> lock(releaseLock);
+        for (const auto& p : pendingReleases) pending += p.second.handles.size();
+    }
+
+    json releases = {
+        {"queued", releasesQueued.load()}, {"carried", releasesCarried.load()},
+        {"flushed", releasesFlushed.load()}, {"batches", releaseBatches.load()}, {"stale", releasesStale.load()},
+        {"pending", pending}
+    };
 
-// ---------------- Constructor / Destructor ----------------
+    json events;
+    {
+        std::lock_guard<std::mutex> lock(eventLock);
+        events = {
+            {"subscriptions", subscriptions.size()}, {"streams", eventStreams.size()},
+            {"received", eventsReceived.load()}, {"coalesced", eventsCoalesced.load()},
+            {"dropped", eventsDropped.load()}, {"reconnects", eventReconnects.load()}
+        };
+    }
 
-NM_Bridge::NM_Bridge() {}
+    json rs = {
+        {"commands", toJson(metrics->SnapshotCommands())},
+        {"methods", toJson(metrics->SnapshotMethods())},
+        {"pipes", pipes},
+        {"releases", releases},
+        {"events", events}
+    };
+    response = rs.dump();
+}
 
-NM_Bridge::~NM_Bridge()
+void NM_Bridge::ResetMetrics()
 {
-    Shutdown();
+    metrics->Reset();
+
+    std::lock_guard<std::mutex> lock(throttleLock);
+    for (const auto& t : throttles) t.second->ResetPeaks();
 }
 
-// ---------------- Initialization ---------------- 
 
-bool NM_Bridge::Init(const std::wstring& ManagedDllPath, std::wstring& error)
+// ---------------- SendCommand ----------------
+
+bool NM_Bridge::SendCommand(Op op, const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs)
 {
-    if (ClrRuntimeHost) return true;
+    return SendToPipe(op, std::string(), requestJson, output, error, timeoutMs, std::string());
+}
 
-    HRESULT hr = CLRCreateInstance(CLSID_CLRMetaHost, IID_PPV_ARGS(&MetaHost));
-    if (FAILED(hr))
+bool NM_Bridge::SendDomainCommand(Op op, const std::string& domainId, const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs, const std::string& methodKey, uint64_t cancelId, NM_CallBuffers* buffers)
+{
+    std::string local;
+    std::string& pipe = buffers ? buffers->pipe : local;
+    pipe.clear();
     {
-        error = L"CLRCreateInstance failed";
-        return false;
+        std::shared_lock<std::shared_mutex> lock(domainLock);
+        auto it = domainPipes.find(domainId);
+        if (it != domainPipes.end()) pipe.assign(it->second);
     }
+    if (pipe.empty()) pipe = ControlPipeFor(domainId);
 
-    hr = MetaHost->GetRuntime(L"v4.0.30319", IID_PPV_ARGS(&RuntimeInfo));
-    if (FAILED(hr))
+    uint64_t epoch = 0;
+    std::vector<uint64_t> releases = TakeReleases(domainId, epoch);
+    if (releases.empty()) return SendToPipe(op, pipe, requestJson, output, error, timeoutMs, methodKey, cancelId, nullptr, buffers);
+
+    output.clear();
+    bool ok = SendToPipe(op, pipe, requestJson, output, error, timeoutMs, methodKey, cancelId, &releases, buffers);
+    if (!ok && output.empty())
     {
-        error = L"GetRuntime failed";
+        // Never got to the server: they go with the next request instead, unless the domain
+        // was unloaded meanwhile.
+        std::lock_guard<std::mutex> lock(releaseLock);
+        auto current = domainEpochs.find(domainId);
+        if (epoch != (current == domainEpochs.end() ? 0 : current->second)) return false;
+        auto& pending = pendingReleases[domainId];
+        if (pending.handles.empty()) pending.since = std::chrono::steady_clock::now();
+        pending.handles.insert(pending.handles.end(), releases.begin(), releases.end());
         return false;
     }
 
-    BOOL loadable = FALSE;
-    hr = RuntimeInfo->IsLoadable(&loadable);
-    if (FAILED(hr) || !loadable)
+    (op == Op::ReleaseInstances ? releasesFlushed : releasesCarried).fetch_add(releases.size(), std::memory_order_relaxed);
+    return ok;
+}
+
+// An empty pipe means the control pipe.
+bool NM_Bridge::SendToPipe(Op op, const std::string& pipe, const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs, const std::string& methodKey, uint64_t cancelId, const std::vector<uint64_t>* releases, NM_CallBuffers* buffers)
+{
+    if (closing.load(std::memory_order_acquire))
     {
-        error = L"Runtime not loadable";
+        error = L"Bridge is shutting down";
         return false;
     }
 
-    hr = RuntimeInfo->GetInterface(CLSID_CLRRuntimeHost, IID_ICLRRuntimeHost, (void**)&ClrRuntimeHost);
-    if (FAILED(hr))
+    std::shared_lock<std::shared_mutex> scope(lifecycle);
+    const std::string& target = pipe.empty() ? pipename : pipe;
+
+    // A Cancel request's own cancelId names the call to cancel.
+    if (op != Op::Cancel && cancelId == 0) cancelId = NewCancelId();
+    std::string local;
+    std::string& stamped = buffers ? buffers->stamped : local;
+    stamped.assign(requestJson);
+    Stamp(stamped, timeoutMs, op == Op::Cancel ? 0 : cancelId, releases);
+
+    // Cancel must get through to a pipe that is backed up, so it bypasses the throttle.
+    std::shared_ptr<NM_Throttle> throttle = op == Op::Cancel ? nullptr : ThrottleFor(target);
+    auto deadline = timeoutMs > 0 ? NM_Throttle::Clock::now() + std::chrono::milliseconds(timeoutMs) : NM_Throttle::Clock::time_point::max();
+    if (throttle && !throttle->Acquire(deadline))
     {
-        error = L"GetInterface(ICLRRuntimeHost) failed";
+        error = L"Overloaded: too many calls in flight";
         return false;
     }
 
-    hr = ClrRuntimeHost->Start();
-    if (FAILED(hr))
+    auto sent = std::chrono::steady_clock::now();
+    bool capturing = capture && capture->IsOpen();
+    if (capturing) output.clear();
+
+    ReplySignals signals;
+    bool ok = RoundTrip(op, target, stamped, output, error, timeoutMs, methodKey, &signals);
+    if (capturing) capture->Write(static_cast<int>(op), sent, std::chrono::steady_clock::now(), ok, requestJson, output);
+
+    if (throttle)
     {
-        error = L"CLR Start failed";
-        return false;
+        auto outcome = signals.overloaded ? NM_Throttle::Outcome::Overloaded : ok ? NM_Throttle::Outcome::Ok : NM_Throttle::Outcome::Failed;
+        throttle->Release(outcome, signals.queue);
     }
+    return ok;
+}
 
-    DWORD pid = GetCurrentProcessId();
-    pipename = "managedbridge_server_" + std::to_string(pid) + "_" + std::to_string(rand() % 10000);
-    authToken = std::to_string(GetTickCount64()) + "_" + std::to_string(rand());
-
-    json initReq = {
-        {"cmd", "_start_server"},
-        {"pipeName", pipename},
-        {"authToken", authToken}
-    };
+std::shared_ptr<NM_Throttle> NM_Bridge::ThrottleFor(const std::string& pipe)
+{
+    std::lock_guard<std::mutex> lock(throttleLock);
 
-    std::string dummy;
-    return StartManagedServer(ManagedDllPath, initReq.dump(), dummy, error, 15000);
+    auto& throttle = throttles[pipe];
+    if (!throttle) throttle = std::make_shared<NM_Throttle>(clientMaxInFlight);
+    return throttle;
 }
 
-void NM_Bridge::Shutdown()
+bool NM_Bridge::RoundTrip(Op op, const std::string& pipe, const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs, const std::string& methodKey, ReplySignals* signals)
 {
-    if (!pipename.empty())
+    if (pipe.empty())
     {
-        std::string dummy;
-        std::wstring err;
-        json rq = { {"cmd", "stopServer"} };
-        SendCommand(rq.dump(), dummy, err, 2000);
-        pipename.clear();
+        error = L"Server not started";
+        return false;
     }
 
-    if (ClrRuntimeHost)
+    auto begin = std::chrono::steady_clock::now();
+    auto mark = begin;
+    auto record = [&](NM_Metrics::Phase phase, uint64_t us)
     {
-        ClrRuntimeHost->Stop();
-        ClrRuntimeHost->Release();
-        ClrRuntimeHost = nullptr;
-    }
+        metrics->Record(static_cast<int>(op), phase, us);
+        if (!methodKey.empty()) metrics->RecordMethod(methodKey, phase, us);
+    };
 
-    if (RuntimeInfo)
+    NM_TcpOptions tcp;
+    tcp.noDelay = tcpNoDelay;
+    tcp.keepAliveSec = tcpKeepAliveSec;
+    tcp.maxFrameBytes = maxFrameBytes;
+
+    bool reused = false;
+    auto connection = TakeConnection(pipe, reused);
+    if (!connection) connection = NM_Connection::Open(pipe, timeoutMs, error, tcp);
+    if (!connection) return false;
+    record(NM_Metrics::Phase::Connect, MicrosSince(mark));
+
+    // Until the first byte of the reply arrives we are waiting on the server: that is the wait phase.
+    // The reply is read straight into output, so a caller that keeps its string gets no allocation.
+    NM_Connection::Clock::time_point firstByte;
+    bool received = connection->Write(requestJson.data(), requestJson.size(), error);
+    if (received)
     {
-        RuntimeInfo->Release();
-        RuntimeInfo = nullptr;
+        record(NM_Metrics::Phase::Write, MicrosSince(mark));
+        received = connection->Read(output, timeoutMs, error, &firstByte);
     }
 
-    if (MetaHost)
+    // A pooled connection the server has closed while it sat idle fails before any reply: resend once.
+    if (!received && reused && connection->Closed() && firstByte == NM_Connection::Clock::time_point())
     {
-        MetaHost->Release();
-        MetaHost = nullptr;
+        connection = NM_Connection::Open(pipe, timeoutMs, error, tcp);
+        if (!connection) return false;
+        received = connection->Write(requestJson.data(), requestJson.size(), error) && connection->Read(output, timeoutMs, error, &firstByte);
     }
-}
 
-bool NM_Bridge::StartManagedServer(const std::wstring& ManagedDllPath, const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs)
-{
-    if (!ClrRuntimeHost)
+    if (firstByte != NM_Connection::Clock::time_point())
     {
-        error = L"CLR not initialized";
+        record(NM_Metrics::Phase::Wait, std::chrono::duration_cast<std::chrono::microseconds>(firstByte - mark).count());
+        mark = firstByte;
+    }
+    if (!received)
+    {
+        output.clear();
         return false;
     }
+    record(NM_Metrics::Phase::Read, MicrosSince(mark));
+    ReturnConnection(pipe, std::move(connection));
 
-    std::wstring wideReq = utf8_to_utf16(requestJson);
+    ReplyHead head;
+    bool valid = JsonScanner(output).Read(head);
+    record(NM_Metrics::Phase::Parse, MicrosSince(mark));
+    record(NM_Metrics::Phase::Total, MicrosSince(begin));
 
-    DWORD ret = 0;
-    HRESULT hr = ClrRuntimeHost->ExecuteInDefaultAppDomain(ManagedDllPath.c_str(), L"MANAGED_Bridge.Managed_Bridge", L"StartServer", wideReq.c_str(), &ret);
+    if (valid && head.timed)
+    {
+        for (int i = 0; i < ServerPhaseCount; ++i) record(ServerPhases[i].phase, head.timing[i]);
+    }
 
-    if (FAILED(hr))
+    if (!valid)
     {
-        error = L"StartServer failed";
+        error = L"Invalid JSON response";
         return false;
     }
 
-    int tries = timeoutMs / 200;
-    bool ok = false;
-
-    for (int i = 0; i < tries; ++i)
+    if (signals && head.object)
     {
-        std::string pipePath = "\\\\.\\pipe\\" + pipename;
-
-        if (WaitNamedPipeA(pipePath.c_str(), 100) || GetLastError() == ERROR_PIPE_BUSY)
-        {
-            ok = true;
-            break;
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        signals->overloaded = head.overloaded;
+        signals->queue = head.queue;
     }
 
-    if (!ok)
+    // Only a failure is worth a full parse, for the message.
+    if (head.object && !head.success)
     {
-        error = L"Managed server did not start or pipe not available";
+        auto resp = json::parse(output, nullptr, false);
+        std::string errMsg = resp.value("error", "Unknown error");
+        error = utf8_to_utf16(errMsg);
         return false;
     }
-
-    output = "{\"success\":true}";
     return true;
 }
 
-// ---------------- Domain ----------------
 
-bool NM_Bridge::CreateDomain(const std::string& domainId, std::string& response, std::wstring& error, int timeoutMs)
+std::unique_ptr<NM_Connection> NM_Bridge::TakeConnection(const std::string& pipe, bool& reused)
 {
-    json rq;
-    rq["cmd"] = "createDomain";
-    rq["domainId"] = domainId;
-    rq["authToken"] = authToken;
-    return SendCommand(rq.dump(), response, error, timeoutMs);
-}
+    std::lock_guard<std::mutex> lock(poolLock);
 
-bool NM_Bridge::UnloadDomain(const std::string& domainId, std::string& response, std::wstring& error, int timeoutMs)
-{
-    json rq;
-    rq["cmd"] = "unloadDomain";
-    rq["domainId"] = domainId;
-    rq["authToken"] = authToken;
-    return SendCommand(rq.dump(), response, error, timeoutMs);
-}
+    reused = false;
+    auto it = idleConnections.find(pipe);
+    if (it == idleConnections.end() || it->second.empty()) return nullptr;
 
-// ---------------- Load ----------------
+    auto connection = std::move(it->second.back());
+    it->second.pop_back();
+    reused = true;
+    return connection;
+}
 
-bool NM_Bridge::LoadFromFile(const std::string& domainId, const std::wstring& assemblyPath, const std::string& assemblyAlias, std::string& response, std::wstring& error, int timeoutMs)
+void NM_Bridge::ReturnConnection(const std::string& pipe, std::unique_ptr<NM_Connection> connection)
 {
-    json rq;
-    rq["cmd"] = "loadFromFile";
-    rq["domainId"] = domainId;
-    rq["authToken"] = authToken;
-    rq["path"] = utf16_to_utf8(assemblyPath);
-    if (!assemblyAlias.empty()) rq["assemblyAlias"] = assemblyAlias;
-    return SendCommand(rq.dump(), response, error, timeoutMs);
+    std::lock_guard<std::mutex> lock(poolLock);
+
+    auto& idle = idleConnections[pipe];
+    if (idle.size() < maxIdleConnections) idle.push_back(std::move(connection));
 }
 
-bool NM_Bridge::LoadFromMemory(const std::string& domainId, const std::vector<BYTE>& bytes, const std::string& simpleName, std::string& response, std::wstring& error, int timeoutMs)
+void NM_Bridge::DropConnections(const std::string& pipe)
 {
-    json rq;
-    rq["cmd"] = "loadFromMemory";
-    rq["domainId"] = domainId;
-    rq["authToken"] = authToken;
-    rq["bytesBase64"] = base64_encode(bytes);
-    if (!simpleName.empty()) rq["assemblySimpleName"] = simpleName;
-    return SendCommand(rq.dump(), response, error, timeoutMs);
+    std::lock_guard<std::mutex> lock(poolLock);
+    idleConnections.erase(pipe);
 }
 
-// ---------------- Invoke ----------------
 
-bool NM_Bridge::CreateInstance(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& constructorArgsJson, std::string& resultJson, std::wstring& err, int timeoutMs)
+void NM_Bridge::CacheStore(const std::string& key, const std::string& domainId, const std::string& etag, const std::string& response)
 {
-    json rq;
-    rq["cmd"] = "createInstance";
-    rq["domainId"] = domainId;
-    rq["authToken"] = authToken;
-    rq["assemblyName"] = assemblyAlias;
-    rq["typeName"] = typeName;
-    rq["ctorArgsJson"] = FormatArgs(constructorArgsJson);
-    return SendCommand(rq.dump(), resultJson, err, timeoutMs);
-}
+    std::lock_guard<std::mutex> lock(cacheLock);
 
-bool NM_Bridge::ReleaseInstance(const std::string& domainId, const std::string& instanceId, std::string& resultJson, std::wstring& err, int timeoutMs)
-{
-    json rq;
-    rq["cmd"] = "releaseInstance";
-    rq["domainId"] = domainId;
-    rq["authToken"] = authToken;
-    rq["instanceId"] = instanceId;
-    return SendCommand(rq.dump(), resultJson, err, timeoutMs);
-}
+    auto it = resultCache.find(key);
+    if (it == resultCache.end())
+    {
+        resultLru.push_front(key);
+        it = resultCache.emplace(key, CachedResult()).first;
+        it->second.lru = resultLru.begin();
+    }
 
+    it->second.domainId = domainId;
+    it->second.etag = etag;
+    it->second.response = response;
+    it->second.freshUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(clientCacheTtlMs);
 
-bool NM_Bridge::InvokeStatic(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs)
-{
-    json rq;
-    rq["cmd"] = "invokeStatic";
-    rq["domainId"] = domainId;
-    rq["authToken"] = authToken;
-    rq["assemblyName"] = assemblyAlias;
-    rq["typeName"] = typeName;
-    rq["methodName"] = methodName;
-    rq["argsJson"] = FormatArgs(argsJson);
-    return SendCommand(rq.dump(), response, error, timeoutMs);
+    while (resultCache.size() > clientCacheEntries)
+    {
+        resultCache.erase(resultLru.back());
+        resultLru.pop_back();
+    }
 }
 
+// ---------------- Batched release ----------------
 
-bool NM_Bridge::InvokeInstance(const std::string& domainId, const std::string& assemblyAlias, const std::string& instanceId, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs)
+std::vector<uint64_t> NM_Bridge::TakeReleases(const std::string& domainId, uint64_t& epoch)
 {
-    json rq;
-    rq["cmd"] = "invokeInstance";
-    rq["domainId"] = domainId;
-    rq["authToken"] = authToken;
-    rq["assemblyName"] = assemblyAlias;
-    rq["instanceId"] = instanceId;
-    rq["methodName"] = methodName;
-    rq["argsJson"] = FormatArgs(argsJson);
-    return SendCommand(rq.dump(), response, error, timeoutMs);
-}
+    std::lock_guard<std::mutex> lock(releaseLock);
+    if (pendingReleases.empty()) return {};
 
-// ---------------- WPF ----------------
+    auto current = domainEpochs.find(domainId);
+    epoch = current == domainEpochs.end() ? 0 : current->second;
 
-bool NM_Bridge::RunWpfApp(const std::string& domainId, const std::string& assemblyName, const std::string& typeName, const std::string& methodName, const std::vector<std::string>& argsJson, std::string& response, std::wstring& error, int timeoutMs) {
-    json rq;
-    rq["cmd"] = "runWpfApp";
-    rq["domainId"] = domainId;
-    rq["authToken"] = authToken;
-    rq["assemblyName"] = assemblyName;
-    rq["typeName"] = typeName;
-    rq["methodName"] = methodName;
-    if (!argsJson.empty()) rq["argsJson"] = argsJson;
-    return SendCommand(rq.dump(), response, error, timeoutMs);
-}
+    auto it = pendingReleases.find(domainId);
+    if (it == pendingReleases.end()) return {};
 
-bool NM_Bridge::StopWpfApp(const std::string& domainId, const std::string& assemblyAlias, std::string& response, std::wstring& error, int timeoutMs) {
-    json rq;
-    rq["cmd"] = "stopWpfApp";
-    rq["domainId"] = domainId;
-    rq["authToken"] = authToken;
-    rq["assemblyAlias"] = assemblyAlias;
-    return SendCommand(rq.dump(), response, error, timeoutMs);
+    std::vector<uint64_t> handles = std::move(it->second.handles);
+    pendingReleases.erase(it);
+    return handles;
 }
 
+// The domain is gone, and its instances with it. Handles still out for it belong to the old
+// epoch, so their releases are dropped rather than sent to a domain re-created under the id.
+void NM_Bridge::DropReleases(const std::string& domainId)
+{
+    std::lock_guard<std::mutex> lock(releaseLock);
+    pendingReleases.erase(domainId);
+    domainEpochs[domainId] = ++lastEpoch;
+}
 
-// ---------------- SendCommand ----------------
-
-bool NM_Bridge::SendCommand(const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs)
+bool NM_Bridge::SendReleases(const std::string& domainId, std::wstring& error, int timeoutMs)
 {
-    if (pipename.empty())
     {
-        error = L"Server not started";
-        return false;
+        std::lock_guard<std::mutex> lock(releaseLock);
+        if (!pendingReleases.count(domainId)) return true;
     }
 
-    std::string pipePath = "\\\\.\\pipe\\" + pipename;
-    HANDLE hPipe = INVALID_HANDLE_VALUE;
-    DWORD start = GetTickCount64();
+    json rq;
+    rq["op"] = Op::ReleaseInstances;
+    rq["domainId"] = domainId;
+    rq["authToken"] = authToken;
+    std::string response;
+    releaseBatches.fetch_add(1, std::memory_order_relaxed);
+    return SendDomainCommand(Op::ReleaseInstances, domainId, rq.dump(), response, error, timeoutMs);
+}
 
-    while (true)
+// Sends the releases of domains that have had no request for releaseFlushMs, and of those whose
+// queue reached releaseBatchMax.
+void NM_Bridge::FlushLoop()
+{
+    std::unique_lock<std::mutex> lock(releaseLock);
+    while (flushing)
     {
-        hPipe = CreateFileA(pipePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
-        if (hPipe != INVALID_HANDLE_VALUE) break;
+        releaseWake.wait_for(lock, std::chrono::milliseconds(releaseFlushMs));
 
-        DWORD errc = GetLastError();
-        if (errc != ERROR_PIPE_BUSY && errc != ERROR_FILE_NOT_FOUND)
+        auto due = std::chrono::steady_clock::now() - std::chrono::milliseconds(releaseFlushMs);
+        std::vector<std::string> domains;
+        for (const auto& p : pendingReleases)
         {
-            error = L"CreateFile pipe failed";
-            return false;
+            if (p.second.since <= due || p.second.handles.size() >= releaseBatchMax) domains.push_back(p.first);
         }
+        if (domains.empty()) continue;
 
-        if (!WaitNamedPipeA(pipePath.c_str(), 100))
+        lock.unlock();
+        for (const auto& domainId : domains)
         {
-            if ((GetTickCount64() - start) > (DWORD)timeoutMs)
-            {
-                error = L"Timeout connecting to pipe";
-                return false;
-            }
+            std::wstring error;
+            SendReleases(domainId, error, 15000);
         }
+        lock.lock();
     }
+}
 
-    DWORD mode = PIPE_READMODE_MESSAGE;
-    SetNamedPipeHandleState(hPipe, &mode, nullptr, nullptr);
-
-    DWORD written = 0;
-    if (!WriteFile(hPipe, requestJson.c_str(), (DWORD)requestJson.size(), &written, nullptr))
-    {
-        CloseHandle(hPipe);
-        error = L"WriteFile failed";
-        return false;
-    }
-
-    std::string buffer;
-    char temp[8192];
-    DWORD bytesRead = 0;
-
-    while (true)
-    {
-        BOOL r = ReadFile(hPipe, temp, sizeof(temp), &bytesRead, nullptr);
-        DWORD err = GetLastError();
-        if (bytesRead > 0) buffer.append(temp, bytesRead);
-        if (r) break;
-        if (!r && err != ERROR_MORE_DATA) break;
-    }
-
-    CloseHandle(hPipe);
-
-    if (buffer.empty())
-    {
-        error = L"Empty response";
-        return false;
-    }
-
-    output = buffer;
-
-    auto resp = json::parse(output, nullptr, false);
-    if (resp.is_discarded())
-    {
-        error = L"Invalid JSON response";
-        return false;
-    }
+void NM_Bridge::CacheDropDomain(const std::string& domainId)
+{
+    std::lock_guard<std::mutex> lock(cacheLock);
 
-    if (resp.is_object())
+    for (auto it = resultCache.begin(); it != resultCache.end();)
     {
-        if (!resp.value("success", false))
+        if (it->second.domainId == domainId)
         {
-            std::string errMsg = resp.value("error", "Unknown error");
-            error = utf8_to_utf16(errMsg);
-            return false;
+            resultLru.erase(it->second.lru);
+            it = resultCache.erase(it);
+        }
+        else
+        {
+            ++it;
         }
     }
-    return true;
+}
+
+
+std::wstring NM_Bridge::WideFromUtf8(const std::string& utf8)
+{
+    return utf8_to_utf16(utf8);
 }
 
 
@@ -418,6 +2288,7 @@ std::string NM_Bridge::FormatArgs(const std::string& argsJson)
 }
 
 
+#ifdef _WIN32
 void NM_Bridge::UnlinkModuleFromPEB(HMODULE hModule)
 {
     if (!hModule) return;
@@ -472,4 +2343,5 @@ void NM_Bridge::HideCLR()
         HMODULE hMod = GetModuleHandleA(mod);
         if (hMod) UnlinkModuleFromPEB(hMod);
     }
-}
\ No newline at end of file
+}
+#endif
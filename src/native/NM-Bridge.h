@@ -1,56 +1,375 @@
 // NM-Bridge.h
 
 #pragma once
-#ifdef _WIN32
 
-#include <windows.h>
-#include <metahost.h>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <vector>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+
+#include "NM-Buffers.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <metahost.h>
 #include <winternl.h>
 #include <intrin.h>
 
 #pragma comment(lib, "mscoree.lib")
+#endif
 
+class NM_Metrics;
+class NM_CaptureWriter;
+class NM_Connection;
+class NM_Throttle;
+class NM_Process;
+
+// Commands may be issued from any number of threads on one bridge. Init, Connect and Shutdown
+// must not race each other; Shutdown lets requests already sent finish, and fails new ones.
 class NM_Bridge {
 	
 public:
+    // Opaque handle of a managed object living in a domain's instance table.
+    enum class InstanceHandle : uint64_t { Invalid = 0 };
+
+    enum class GcPolicy { None, Deferred, EveryN };
+
+    // Raised by managed code through MANAGED_Bridge.NativeEvents. payload is JSON;
+    // coalesced counts the earlier Post()s of the same name this one replaced.
+    struct Event
+    {
+        std::string domainId;
+        std::string name;
+        std::string payload;
+        uint64_t coalesced = 0;
+    };
+
+    using EventHandler = std::function<void(const Event&)>;
+    using Executor = std::function<void(std::function<void()>)>;
+
+    struct Options
+    {
+        int controlWorkers = 2;     // threads serving create/unload on the default pipe
+        int domainWorkers = 1;      // threads serving each domain's pipe
+        GcPolicy gcPolicy = GcPolicy::Deferred;
+        int gcEveryN = 4;           // unloads per collection with GcPolicy::EveryN
+        int gcMemoryLoadPercent = 0; // if set, a scheduled collection runs only at this physical memory load
+        int domainPoolSize = 0;     // pre-created domains kept ready for CreateDomain
+        bool shareAssemblies = false; // MultiDomainHost, and LoadFromFile binds by path with Assembly.LoadFrom (see DomainProxy.LoadFromFile)
+        int resultCacheEntries = 1024; // per-domain memoized results of cacheable static methods
+        int resultCacheMB = 16;
+        int clientCacheEntries = 0; // InvokeStatic results of cacheable methods kept here; 0 disables
+        int clientCacheTtlMs = 0;   // served without a round-trip for this long, then revalidated by ETag
+        bool methodMetrics = false; // also keep latency histograms per invoked type.method
+        bool serverTiming = false;  // server appends its own phase breakdown to every reply; folded into metrics
+        std::string capturePath;    // log every request and reply here (token blanked) for nm_replay
+        int maxIdleConnections = 16; // kept open per pipe between calls; 0 connects for every call
+        int maxQueueDepth = 1024;   // requests a pipe holds for its workers; past it the server answers "Overloaded"
+        int maxInFlight = 0;        // queued plus running per pipe before "Overloaded"; 0 means no limit
+        int clientMaxInFlight = 64; // calls this bridge keeps in flight per pipe, backing off on overload; 0 disables
+        bool tcpNoDelay = true;     // tcp:// endpoints: turn Nagle off
+        int tcpKeepAliveSec = 30;   // tcp:// endpoints: keepalive probes after this much idle time; 0 disables
+        int maxFrameMB = 256;       // socket endpoints: a longer incoming message is rejected and its connection closed
+        int releaseFlushMs = 100;   // queued releases no request has carried are sent after this long; 0 leaves them to requests and FlushReleases()
+        int releaseBatchMax = 512;  // a domain with this many queued releases is flushed without waiting
+    };
+
     NM_Bridge();
     ~NM_Bridge();
 
+#ifdef _WIN32
     bool Init(const std::wstring& HelperDllPath, std::wstring& error);
+    bool Init(const std::wstring& HelperDllPath, const Options& options, std::wstring& error);
+#endif
+    // Attaches to a server that is already listening on endpoint (another process, or a stand-in).
+    // Only the client-side options apply; Shutdown() detaches and leaves that server running.
+    // A "tcp://host:port" endpoint reaches a host on another machine; its domains are then
+    // served through that same endpoint, since their pipes are local to the host.
+    bool Connect(const std::string& endpoint, const std::string& token, const Options& options, std::wstring& error);
+    // Starts hostCount host processes, each its own server, and spreads domains over them: a new
+    // domain goes to the host with the fewest, and an id keeps its host across unload and re-create.
+    // Hosts that die are started again on the same endpoint; their domains are gone and must be
+    // created anew. Each host is run as
+    //   hostPath hostArgs... --endpoint NAME --options JSON
+    // where JSON holds the server side of options. The token is passed in the HostTokenVariable
+    // environment variable, which the host clears once read, since arguments are visible to
+    // every local user. On Windows a program whose main() returns
+    // NM_Bridge::HostMain(argc, argv) serves; bench/nm_standin_host is the POSIX stand-in.
+    bool Launch(const std::string& hostPath, const std::vector<std::string>& hostArgs, int hostCount, const Options& options, std::wstring& error);
+    static constexpr const char* HostTokenVariable = "NM_BRIDGE_HOST_TOKEN";
+#ifdef _WIN32
+    // Host process side of Launch(): --managed PATH names managed_bridge.dll. Returns once the server stops.
+    // With --listen tcp://ADDR:PORT the host also relays TCP clients to its control and domain pipes,
+    // so Connect() from another machine can drive it.
+    static int HostMain(int argc, char** argv);
+#endif
     void Shutdown();
 	
     bool CreateDomain(const std::string& domainId, std::string& response, std::wstring& error, int timeoutMs = 15000);
     bool UnloadDomain(const std::string& domainId, std::string& response, std::wstring& error, int timeoutMs = 15000);
+    // With Launch() the reply is {"hosts":[{endpoint, pid, restarts, domains, stats}]}.
+    bool GetStats(std::string& response, std::wstring& error, int timeoutMs = 15000);
+
+    // Client-side latency percentiles per command and phase (connect, write, wait, read, parse, total),
+    // per pipe the calls in flight, the throttle window and the queue depth the server reports,
+    // how queued releases went out, and the events received.
+    void GetMetrics(std::string& response) const;
+    void ResetMetrics();
+    NM_Metrics& Metrics() { return *metrics; }
 	
 	bool LoadFromFile(const std::string& domainId, const std::wstring& assemblyPath, const std::string& assemblyAlias, std::string& response, std::wstring& error, int timeoutMs = 15000);
-    bool LoadFromMemory(const std::string& domainId, const std::vector<BYTE>& bytes, const std::string& simpleName, std::string& response, std::wstring& error, int timeoutMs = 15000);
+    bool LoadFromMemory(const std::string& domainId, const std::vector<uint8_t>& bytes, const std::string& simpleName, std::string& response, std::wstring& error, int timeoutMs = 15000);
 	
-    bool CreateInstance(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& constructorArgsJson, std::string& response, std::wstring& error, int timeoutMs = 15000);
-    bool ReleaseInstance(const std::string& domainId, const std::string& instanceId, std::string& response, std::wstring& error, int timeoutMs = 15000);
+    bool CreateInstance(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& constructorArgsJson, InstanceHandle& instance, std::string& response, std::wstring& error, int timeoutMs = 15000);
+    bool ReleaseInstance(const std::string& domainId, InstanceHandle instance, std::string& response, std::wstring& error, int timeoutMs = 15000);
+    // Changes each time domainId is unloaded here, or lost with its host. A new domain under the
+    // same id hands out the same handle values again, so a handle is only good for the epoch it
+    // was created in.
+    uint64_t DomainEpoch(const std::string& domainId) const;
+    // Releases instance without a round-trip of its own: the next request to domainId carries it,
+    // or a background batch once it has waited releaseFlushMs. epoch is DomainEpoch(domainId) from
+    // before the instance was created; once it is stale the domain took the instance with it, and
+    // the release is dropped. NM_Instance (NM-Handles.h) uses this.
+    void QueueRelease(const std::string& domainId, InstanceHandle instance, uint64_t epoch);
+    // Sends every queued release now, one batch per domain.
+    bool FlushReleases(std::wstring& error, int timeoutMs = 15000);
 	
-    bool InvokeStatic(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs = 15000);
-    bool InvokeInstance(const std::string& domainId, const std::string& assemblyAlias, const std::string& instanceId, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs = 15000);
+    // Every request carries its deadline (now + timeoutMs). A method whose last parameter is a
+    // CancellationToken gets one that fires at that deadline or when Cancel(cancelId) is called.
+    bool InvokeStatic(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool InvokeInstance(const std::string& domainId, const std::string& assemblyAlias, InstanceHandle instance, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    // The same, building the request in buffers and reading the reply into buffers.reply. With one
+    // NM_CallBuffers reused per thread, or a lease from an NM_BufferPool, a call makes no heap
+    // allocation once the buffers have grown: the arguments and the reply are checked in place.
+    // InvokeStatic with clientCacheEntries set still builds its request as a json document for
+    // the cache key.
+    bool InvokeStatic(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_CallBuffers& buffers, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool InvokeInstance(const std::string& domainId, const std::string& assemblyAlias, InstanceHandle instance, const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_CallBuffers& buffers, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool InvokeStatic(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_BufferPool::Lease& response, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool InvokeInstance(const std::string& domainId, const std::string& assemblyAlias, InstanceHandle instance, const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_BufferPool::Lease& response, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    // Like the InvokeStatic and InvokeInstance, except that a sequence result comes back chunkRows at a time: the reply
+    // carries "rows" and "done", and while not done a "cursor" to pass to ReadCursor for the next
+    // rows. A cursor is an instance handle, so releasing it abandons the rest. NM_Cursor
+    // (NM-Handles.h) wraps these.
+    bool StreamStatic(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, int chunkRows, std::string& response, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool StreamInstance(const std::string& domainId, const std::string& assemblyAlias, InstanceHandle instance, const std::string& typeName, const std::string& methodName, const std::string& argsJson, int chunkRows, std::string& response, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool ReadCursor(const std::string& domainId, InstanceHandle cursor, int chunkRows, std::string& response, std::wstring& error, int timeoutMs = 15000);
+    uint64_t NewCancelId() { return nextCancelId.fetch_add(1, std::memory_order_relaxed); }
+    // Cancels the call started with cancelId; one still queued is dropped when it comes up.
+    // The reply's "cancelled" is true when the call was already running.
+    bool Cancel(const std::string& domainId, uint64_t cancelId, std::string& response, std::wstring& error, int timeoutMs = 2000);
+    // Memoizes InvokeStatic results of typeName.methodName by argument list, like [Cacheable] on the method.
+    bool RegisterCacheable(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, std::string& response, std::wstring& error, int timeoutMs = 15000);
+    // Sends a captured request (see NM-Capture.h) with this bridge's token, routed by its domainId.
+    bool Replay(int op, const std::string& requestJson, std::string& response, std::wstring& error, int timeoutMs = 15000);
+    // Messages in replies are UTF-8; the error strings here are wide.
+    static std::wstring WideFromUtf8(const std::string& utf8);
 
     bool RunWpfApp(const std::string& domainId, const std::string& assemblyName, const std::string& typeName, const std::string& methodName, const std::vector<std::string>& argsJson, std::string& response, std::wstring& error, int timeoutMs = 15000);
     bool StopWpfApp(const std::string& domainId, const std::string& assemblyAlias, std::string& response, std::wstring& error, int timeoutMs = 15000);
 
+    // Calls handler for every event domainId raises named eventName (empty: all of them). The
+    // first subscription to a domain opens its event pipe; a dropped pipe is reopened until
+    // the domain is unloaded, and events raised in between are lost. Returns 0 on failure.
+    uint64_t Subscribe(const std::string& domainId, const std::string& eventName, EventHandler handler, std::wstring& error, int timeoutMs = 15000);
+    void Unsubscribe(uint64_t subscription);
+    // Runs every handler call; by default they run on the domain's event thread, in order.
+    void SetEventExecutor(Executor executor);
+
+#ifdef _WIN32
     void UnlinkModuleFromPEB(HMODULE hModule);
     void HideCLR();
+#endif
 
 
 private:
+    // Must match MANAGED_Bridge.Opcode.
+    enum class Op : int
+    {
+        CreateDomain = 1,
+        UnloadDomain = 2,
+        LoadFromFile = 3,
+        LoadFromMemory = 4,
+        CreateInstance = 5,
+        ReleaseInstance = 6,
+        InvokeStatic = 7,
+        InvokeInstance = 8,
+        RunWpfApp = 9,
+        StopWpfApp = 10,
+        GetStats = 11,
+        StopServer = 12,
+        RegisterCacheable = 13,
+        Cancel = 14,
+        ReleaseInstances = 15,
+        Subscribe = 16,
+        ReadCursor = 17
+    };
+
+#ifdef _WIN32
     ICLRMetaHost* MetaHost = nullptr;
     ICLRRuntimeInfo* RuntimeInfo = nullptr;
     ICLRRuntimeHost* ClrRuntimeHost = nullptr;
+#endif
     std::string pipename;
 	std::string authToken;
+    std::map<std::string, std::string> domainPipes;
+    std::shared_mutex domainLock;
+    bool ownsServer = false;
+    std::atomic<uint64_t> nextCancelId{ 1 };
+
+    // Out-of-process mode (Launch). The host list is fixed once Launch returns; its entries
+    // and placement change under hostLock.
+    struct Host
+    {
+        std::string endpoint;
+        std::unique_ptr<NM_Process> process;
+        int domains = 0;
+        uint64_t restarts = 0;
+    };
+
+    std::vector<Host> hosts;
+    std::map<std::string, size_t> placement;    // domainId -> host, kept after unload so ids stay put
+    std::mutex hostLock;
+    std::string hostPath;
+    std::vector<std::string> hostArgs;
+    std::string hostOptions;
+    std::thread supervisor;
+    std::condition_variable supervisorWake;
+    bool supervising = false;
+
+    std::shared_mutex lifecycle;        // held shared by every request, exclusively by Shutdown
+    std::atomic<bool> closing{ false };
+
+    struct ReplySignals
+    {
+        bool overloaded = false;
+        int queue = -1;
+    };
+
+    mutable std::mutex throttleLock;
+    std::unordered_map<std::string, std::shared_ptr<NM_Throttle>> throttles;
+    int clientMaxInFlight = 64;
+
+    std::mutex poolLock;
+    std::unordered_map<std::string, std::vector<std::unique_ptr<NM_Connection>>> idleConnections;
+    size_t maxIdleConnections = 16;
+    bool tcpNoDelay = true;
+    int tcpKeepAliveSec = 30;
+    size_t maxFrameBytes = 256 * 1024 * 1024;
+
+    struct CachedResult
+    {
+        std::string domainId;
+        std::string etag;
+        std::string response;
+        std::chrono::steady_clock::time_point freshUntil;
+        std::list<std::string>::iterator lru;
+    };
+
+    std::mutex cacheLock;
+    std::unordered_map<std::string, CachedResult> resultCache;
+    std::list<std::string> resultLru;
+    size_t clientCacheEntries = 0;
+    int clientCacheTtlMs = 0;
+
+    struct PendingReleases
+    {
+        std::vector<uint64_t> handles;
+        std::chrono::steady_clock::time_point since;   // when the oldest was queued
+    };
 
+    mutable std::mutex releaseLock;
+    std::unordered_map<std::string, PendingReleases> pendingReleases;
+    std::unordered_map<std::string, uint64_t> domainEpochs;  // ids unloaded at least once
+    uint64_t lastEpoch = 0;
+    std::condition_variable releaseWake;
+    std::thread flusher;            // started by the first QueueRelease, under releaseLock
+    bool flushing = false;
+    bool flusherAllowed = false;    // from attaching to a server until Shutdown
+    int releaseFlushMs = 100;
+    size_t releaseBatchMax = 512;
+    std::atomic<uint64_t> releasesQueued{ 0 };
+    std::atomic<uint64_t> releasesCarried{ 0 };  // went out on some other request
+    std::atomic<uint64_t> releasesFlushed{ 0 };  // went out in a ReleaseInstances batch
+    std::atomic<uint64_t> releaseBatches{ 0 };
+    std::atomic<uint64_t> releasesStale{ 0 };    // dropped, their domain unloaded since
+
+    // One event connection per subscribed domain, read by its own thread.
+    struct EventStream
+    {
+        std::string domainId;
+        std::thread reader;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::unique_ptr<NM_Connection> connection;
+        bool stopping = false;
+    };
+
+    struct Subscription
+    {
+        std::string domainId;
+        std::string name;
+        std::shared_ptr<EventHandler> handler;
+    };
+
+    mutable std::mutex eventLock;
+    std::map<uint64_t, Subscription> subscriptions;
+    std::unordered_map<std::string, std::shared_ptr<EventStream>> eventStreams;
+    std::map<std::string, std::string> eventPipes;     // domainId -> event pipe, under domainLock
+    std::shared_ptr<Executor> eventExecutor;
+    uint64_t nextSubscription = 0;
+    std::atomic<uint64_t> eventsReceived{ 0 };
+    std::atomic<uint64_t> eventsCoalesced{ 0 };
+    std::atomic<uint64_t> eventsDropped{ 0 };      // reported by the server: queue full
+    std::atomic<uint64_t> eventReconnects{ 0 };
+
+    std::unique_ptr<NM_Metrics> metrics;
+    bool methodMetrics = false;
+    std::unique_ptr<NM_CaptureWriter> capture;
+
+#ifdef _WIN32
     bool StartManagedServer(const std::wstring& HelperDllPath, const std::string& request, std::string& output, std::wstring& error, int timeoutMs = 15000);
-    bool SendCommand(const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs = 15000); 
+    bool StartServer(const std::wstring& HelperDllPath, const Options& options, const std::string& endpoint, const std::string& token, std::wstring& error);
+#endif
+    bool ApplyClientOptions(const Options& options, std::wstring& error);
+    bool StartHost(Host& host, std::wstring& error);
+    void Supervise();
+    size_t PlaceDomain(const std::string& domainId);
+    std::string ControlPipeFor(const std::string& domainId);
+    bool SendCommand(Op op, const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs = 15000); 
+    bool SendToPipe(Op op, const std::string& pipe, const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs, const std::string& methodKey, uint64_t cancelId = 0, const std::vector<uint64_t>* releases = nullptr, NM_CallBuffers* buffers = nullptr);
+    bool RoundTrip(Op op, const std::string& pipe, const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs, const std::string& methodKey, ReplySignals* signals = nullptr);
+    std::shared_ptr<NM_Throttle> ThrottleFor(const std::string& pipe);
+    bool SendDomainCommand(Op op, const std::string& domainId, const std::string& requestJson, std::string& output, std::wstring& error, int timeoutMs = 15000, const std::string& methodKey = std::string(), uint64_t cancelId = 0, NM_CallBuffers* buffers = nullptr);
+    bool Invoke(Op op, const std::string& domainId, const std::string& assemblyAlias, InstanceHandle instance, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, NM_CallBuffers& buffers, std::wstring& error, int timeoutMs, uint64_t cancelId);
+    bool InvokeCached(const std::string& domainId, const std::string& assemblyAlias, const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs, uint64_t cancelId);
     std::string FormatArgs(const std::string& argsJson);
+    std::unique_ptr<NM_Connection> TakeConnection(const std::string& pipe, bool& reused);
+    void ReturnConnection(const std::string& pipe, std::unique_ptr<NM_Connection> connection);
+    void DropConnections(const std::string& pipe);
+    void CacheStore(const std::string& key, const std::string& domainId, const std::string& etag, const std::string& response);
+    void CacheDropDomain(const std::string& domainId);
+    std::vector<uint64_t> TakeReleases(const std::string& domainId, uint64_t& epoch);
+    void DropReleases(const std::string& domainId);
+    bool SendReleases(const std::string& domainId, std::wstring& error, int timeoutMs);
+    void FlushLoop();
+    std::string EventPipeFor(const std::string& domainId);
+    std::unique_ptr<NM_Connection> OpenEvents(const std::string& domainId, std::wstring& error, int timeoutMs);
+    void EventLoop(std::shared_ptr<EventStream> stream);
+    void Dispatch(const std::string& domainId, const std::string& message);
+    void StopEvents(const std::string& domainId);
 
+#ifdef _WIN32
     typedef struct _PEB_LDR_DATA_FULL {
         ULONG Length;
         BOOLEAN Initialized;
@@ -73,6 +392,5 @@ private:
         UNICODE_STRING FullDllName;
         UNICODE_STRING BaseDllName;
     } LDR_DATA_TABLE_ENTRY_FULL, * PLDR_DATA_TABLE_ENTRY_FULL;
-};
-
 #endif
+};
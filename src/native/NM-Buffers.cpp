@@ -0,0 +1,87 @@
+// NM-Buffers.cpp
+
+#include "NM-Buffers.h"
+
+#include <utility>
+
+// ---------------- NM_BufferPool::Lease ----------------
+
+NM_BufferPool::Lease::~Lease()
+{
+    Return();
+}
+
+NM_BufferPool::Lease::Lease(Lease&& other) noexcept
+    : pool(std::exchange(other.pool, nullptr)), buffers(std::move(other.buffers))
+{
+}
+
+NM_BufferPool::Lease& NM_BufferPool::Lease::operator=(Lease&& other) noexcept
+{
+    if (this != &other)
+    {
+        Return();
+        pool = std::exchange(other.pool, nullptr);
+        buffers = std::move(other.buffers);
+    }
+    return *this;
+}
+
+void NM_BufferPool::Lease::Return()
+{
+    if (pool) std::exchange(pool, nullptr)->Put(buffers);
+}
+
+
+// ---------------- NM_BufferPool ----------------
+
+NM_BufferPool::NM_BufferPool(size_t maxBuffers, size_t maxRetainedBytes) : maxBuffers(maxBuffers), maxRetainedBytes(maxRetainedBytes)
+{
+    // Reserved up front so that returning a lease never allocates.
+    sets.reserve(maxBuffers);
+}
+
+NM_BufferPool::Lease NM_BufferPool::Acquire()
+{
+    Lease lease;
+    lease.pool = this;
+
+    std::lock_guard<std::mutex> guard(lock);
+    ++stats.leases;
+    if (sets.empty())
+    {
+        ++stats.misses;
+        return lease;
+    }
+
+    lease.buffers = std::move(sets.back());
+    sets.pop_back();
+    return lease;
+}
+
+NM_BufferPool::Stats NM_BufferPool::Snapshot() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    Stats snapshot = stats;
+    snapshot.pooled = sets.size();
+    for (const auto& set : sets) snapshot.pooledBytes += set.Capacity();
+    return snapshot;
+}
+
+void NM_BufferPool::Put(NM_CallBuffers& buffers)
+{
+    buffers.reply.clear();
+    buffers.request.clear();
+    buffers.stamped.clear();
+    buffers.pipe.clear();
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (buffers.Capacity() > maxRetainedBytes || sets.size() >= maxBuffers)
+    {
+        ++stats.discarded;
+        buffers = NM_CallBuffers();
+        return;
+    }
+    sets.push_back(std::move(buffers));
+}
@@ -0,0 +1,79 @@
+// NM-Buffers.h
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// The strings one call works in: the reply handed to the caller, and the request the bridge
+// writes, stamps and sends. Each keeps its capacity between calls, so once they have grown to
+// the sizes a caller's traffic needs, building and reading a call does not allocate for them.
+struct NM_CallBuffers
+{
+    std::string reply;
+    std::string request;
+    std::string stamped;
+    std::string pipe;
+
+    size_t Capacity() const { return reply.capacity() + request.capacity() + stamped.capacity() + pipe.capacity(); }
+};
+
+// Call buffers for callers that cannot keep one set per thread. A lease hands its buffers back,
+// emptied but with their capacity, when destroyed; a set that grew past maxRetainedBytes is
+// freed instead so a single large reply does not stay pinned. The pool must outlive its leases.
+class NM_BufferPool {
+
+public:
+    class Lease {
+
+    public:
+        Lease() = default;
+        ~Lease();
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        // The reply of the last call made with this lease.
+        std::string& operator*() { return buffers.reply; }
+        std::string* operator->() { return &buffers.reply; }
+
+        NM_CallBuffers& Buffers() { return buffers; }
+
+    private:
+        friend class NM_BufferPool;
+
+        void Return();
+
+        NM_BufferPool* pool = nullptr;
+        NM_CallBuffers buffers;
+    };
+
+    struct Stats
+    {
+        size_t pooled = 0;          // buffer sets waiting for a lease
+        size_t pooledBytes = 0;     // their capacity
+        uint64_t leases = 0;
+        uint64_t misses = 0;        // leases that found the pool empty
+        uint64_t discarded = 0;     // sets freed on return, too large or the pool full
+    };
+
+    explicit NM_BufferPool(size_t maxBuffers = 16, size_t maxRetainedBytes = 1024 * 1024);
+    NM_BufferPool(const NM_BufferPool&) = delete;
+    NM_BufferPool& operator=(const NM_BufferPool&) = delete;
+
+    Lease Acquire();
+    Stats Snapshot() const;
+
+private:
+    void Put(NM_CallBuffers& buffers);
+
+    mutable std::mutex lock;
+    const size_t maxBuffers;
+    const size_t maxRetainedBytes;
+    std::vector<NM_CallBuffers> sets;
+    Stats stats;
+};
@@ -0,0 +1,118 @@
+// NM-Capture.cpp
+
+#include "NM-Capture.h"
+
+#include <cstring>
+
+namespace
+{
+    const char Magic[8] = { 'N', 'M', 'C', 'A', 'P', '\0', '\1', '\0' };
+    const size_t RecordHeaderSize = 24;
+
+    void Put(char* p, uint64_t v, int bytes)
+    {
+        for (int i = 0; i < bytes; ++i) p[i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+    }
+
+    uint64_t Get(const char* p, int bytes)
+    {
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; ++i) v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+        return v;
+    }
+}
+
+
+// ---------------- NM_CaptureWriter ----------------
+
+bool NM_CaptureWriter::Open(const std::string& path, const std::string& authToken, std::wstring& error)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        error = L"Cannot open capture file";
+        return false;
+    }
+
+    tokenField = "\"authToken\":\"" + authToken + "\"";
+    start = Clock::now();
+
+    char header[16];
+    std::memcpy(header, Magic, sizeof(Magic));
+    auto unixUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    Put(header + 8, static_cast<uint64_t>(unixUs), 8);
+    file.write(header, sizeof(header));
+    return true;
+}
+
+void NM_CaptureWriter::Close()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (file.is_open()) file.close();
+}
+
+void NM_CaptureWriter::Write(int op, Clock::time_point sent, Clock::time_point done, bool ok, const std::string& request, const std::string& response)
+{
+    std::string redacted = request;
+    size_t at = redacted.find(tokenField);
+    if (at != std::string::npos) redacted.replace(at, tokenField.size(), "\"authToken\":\"\"");
+
+    auto offset = std::chrono::duration_cast<std::chrono::microseconds>(sent - start).count();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(done - sent).count();
+
+    char header[RecordHeaderSize] = {};
+    Put(header, static_cast<uint64_t>(offset > 0 ? offset : 0), 8);
+    Put(header + 8, static_cast<uint64_t>(duration > 0xFFFFFFFF ? 0xFFFFFFFF : duration), 4);
+    Put(header + 12, static_cast<uint64_t>(op), 1);
+    Put(header + 13, ok ? NM_CaptureRecord::Ok : 0, 1);
+    Put(header + 16, redacted.size(), 4);
+    Put(header + 20, response.size(), 4);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (!file.is_open()) return;
+    file.write(header, sizeof(header));
+    file.write(redacted.data(), redacted.size());
+    file.write(response.data(), response.size());
+}
+
+
+// ---------------- NM_CaptureReader ----------------
+
+bool NM_CaptureReader::Open(const std::string& path, std::wstring& error)
+{
+    file.open(path, std::ios::binary);
+    if (!file)
+    {
+        error = L"Cannot open capture file";
+        return false;
+    }
+
+    char header[16];
+    if (!file.read(header, sizeof(header)) || std::memcmp(header, Magic, sizeof(Magic)) != 0)
+    {
+        error = L"Not a capture file";
+        return false;
+    }
+
+    startUnixUs = Get(header + 8, 8);
+    return true;
+}
+
+bool NM_CaptureReader::Next(NM_CaptureRecord& record)
+{
+    char header[RecordHeaderSize];
+    if (!file.read(header, sizeof(header))) return false;
+
+    record.offsetUs = Get(header, 8);
+    record.durationUs = static_cast<uint32_t>(Get(header + 8, 4));
+    record.op = static_cast<int>(Get(header + 12, 1));
+    record.flags = static_cast<uint8_t>(Get(header + 13, 1));
+    record.request.resize(static_cast<size_t>(Get(header + 16, 4)));
+    record.response.resize(static_cast<size_t>(Get(header + 20, 4)));
+
+    if (!record.request.empty() && !file.read(&record.request[0], record.request.size())) return false;
+    if (!record.response.empty() && !file.read(&record.response[0], record.response.size())) return false;
+    return true;
+}
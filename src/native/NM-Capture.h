@@ -0,0 +1,62 @@
+// NM-Capture.h
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+// Binary traffic log written by NM_Bridge when Options::capturePath is set, read back by nm_replay.
+//
+//   file   := "NMCAP\0\1\0" startUnixUs:u64 record*
+//   record := offsetUs:u64 durationUs:u32 op:u8 flags:u8 reserved:u16 requestLen:u32 responseLen:u32
+//             request[requestLen] response[responseLen]
+//
+// All integers are little-endian. offsetUs is when the request was sent, relative to the start
+// of the capture. The auth token is blanked out of every request before it reaches the file.
+struct NM_CaptureRecord
+{
+    enum Flags : uint8_t { Ok = 1 };
+
+    uint64_t offsetUs = 0;
+    uint32_t durationUs = 0;
+    int op = 0;
+    uint8_t flags = 0;
+    std::string request;
+    std::string response;
+};
+
+
+class NM_CaptureWriter {
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    bool Open(const std::string& path, const std::string& authToken, std::wstring& error);
+    void Close();
+    bool IsOpen() const { return file.is_open(); }
+
+    void Write(int op, Clock::time_point sent, Clock::time_point done, bool ok, const std::string& request, const std::string& response);
+
+private:
+    std::mutex lock;
+    std::ofstream file;
+    std::string tokenField;     // "authToken":"<token>" as it appears in a serialized request
+    Clock::time_point start;
+};
+
+
+class NM_CaptureReader {
+
+public:
+    bool Open(const std::string& path, std::wstring& error);
+    bool Next(NM_CaptureRecord& record);   // false at end of file or on a truncated record
+
+    uint64_t StartUnixUs() const { return startUnixUs; }
+
+private:
+    std::ifstream file;
+    uint64_t startUnixUs = 0;
+};
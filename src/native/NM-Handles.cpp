@@ -0,0 +1,359 @@
+// NM-Handles.cpp
+
+#include "NM-Handles.h"
+
+#include <utility>
+
+#include "include/json.hpp"
+using json = nlohmann::json;
+
+namespace
+{
+    // Loads reply with the name the assembly is registered under.
+    bool AssemblyName(const std::string& response, std::string& alias, std::wstring& error)
+    {
+        json rs = json::parse(response, nullptr, false);
+        alias = rs.is_object() ? rs.value("assemblyName", std::string()) : std::string();
+        if (alias.empty())
+        {
+            error = L"Reply carries no assemblyName";
+            return false;
+        }
+        return true;
+    }
+
+    std::wstring ReplyError(const json& rs)
+    {
+        std::string message = rs.is_object() ? rs.value("error", std::string("Invalid reply")) : std::string("Invalid reply");
+        return NM_Bridge::WideFromUtf8(message);
+    }
+}
+
+
+// ---------------- NM_Domain ----------------
+
+NM_Domain::~NM_Domain()
+{
+    std::wstring error;
+    Unload(error, 2000);
+}
+
+NM_Domain::NM_Domain(NM_Domain&& other) noexcept
+    : bridge(std::exchange(other.bridge, nullptr)), domainId(std::move(other.domainId))
+{
+}
+
+NM_Domain& NM_Domain::operator=(NM_Domain&& other) noexcept
+{
+    if (this != &other)
+    {
+        std::wstring error;
+        Unload(error, 2000);
+        bridge = std::exchange(other.bridge, nullptr);
+        domainId = std::move(other.domainId);
+    }
+    return *this;
+}
+
+bool NM_Domain::Create(NM_Bridge& bridge, const std::string& domainId, NM_Domain& domain, std::wstring& error, int timeoutMs)
+{
+    std::string response;
+    if (!bridge.CreateDomain(domainId, response, error, timeoutMs)) return false;
+
+    json rs = json::parse(response, nullptr, false);
+    std::string id = rs.is_object() ? rs.value("domainId", domainId) : domainId;
+    if (id.empty())
+    {
+        error = L"Reply carries no domainId";
+        return false;
+    }
+
+    domain = NM_Domain();
+    domain.bridge = &bridge;
+    domain.domainId = std::move(id);
+    return true;
+}
+
+bool NM_Domain::LoadFromFile(const std::wstring& assemblyPath, const std::string& assemblyAlias, NM_Assembly& assembly, std::wstring& error, int timeoutMs)
+{
+    if (!bridge)
+    {
+        error = L"Domain is not loaded";
+        return false;
+    }
+
+    std::string response, alias;
+    if (!bridge->LoadFromFile(domainId, assemblyPath, assemblyAlias, response, error, timeoutMs)) return false;
+    if (!AssemblyName(response, alias, error)) return false;
+
+    assembly.bridge = bridge;
+    assembly.domainId = domainId;
+    assembly.alias = std::move(alias);
+    return true;
+}
+
+bool NM_Domain::LoadFromMemory(const std::vector<uint8_t>& bytes, const std::string& simpleName, NM_Assembly& assembly, std::wstring& error, int timeoutMs)
+{
+    if (!bridge)
+    {
+        error = L"Domain is not loaded";
+        return false;
+    }
+
+    std::string response, alias;
+    if (!bridge->LoadFromMemory(domainId, bytes, simpleName, response, error, timeoutMs)) return false;
+    if (!AssemblyName(response, alias, error)) return false;
+
+    assembly.bridge = bridge;
+    assembly.domainId = domainId;
+    assembly.alias = std::move(alias);
+    return true;
+}
+
+bool NM_Domain::Unload(std::wstring& error, int timeoutMs)
+{
+    if (!bridge) return true;
+
+    // Unloading drops the releases still queued for the domain and moves it to a new epoch, so
+    // instances and cursors that outlive it queue nothing for a domain re-created under the id.
+    NM_Bridge* owner = std::exchange(bridge, nullptr);
+    std::string response;
+    return owner->UnloadDomain(domainId, response, error, timeoutMs);
+}
+
+
+// ---------------- NM_Assembly ----------------
+
+bool NM_Assembly::CreateInstance(const std::string& typeName, const std::string& constructorArgsJson, NM_Instance& instance, std::wstring& error, int timeoutMs)
+{
+    if (!bridge)
+    {
+        error = L"Assembly is not loaded";
+        return false;
+    }
+
+    NM_Bridge::InstanceHandle handle = NM_Bridge::InstanceHandle::Invalid;
+    uint64_t epoch = bridge->DomainEpoch(domainId);
+    std::string response;
+    if (!bridge->CreateInstance(domainId, alias, typeName, constructorArgsJson, handle, response, error, timeoutMs)) return false;
+
+    instance.Release();
+    instance.bridge = bridge;
+    instance.domainId = domainId;
+    instance.alias = alias;
+    instance.typeName = typeName;
+    instance.handle = handle;
+    instance.epoch = epoch;
+    return true;
+}
+
+bool NM_Assembly::StreamStatic(const std::string& typeName, const std::string& methodName, const std::string& argsJson, int chunkRows, NM_Cursor& cursor, std::wstring& error, int timeoutMs)
+{
+    if (!bridge)
+    {
+        error = L"Assembly is not loaded";
+        return false;
+    }
+
+    uint64_t epoch = bridge->DomainEpoch(domainId);
+    std::string response;
+    if (!bridge->StreamStatic(domainId, alias, typeName, methodName, argsJson, chunkRows, response, error, timeoutMs)) return false;
+    return cursor.Open(*bridge, domainId, epoch, chunkRows, response, error);
+}
+
+bool NM_Assembly::InvokeStatic(const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    if (!bridge)
+    {
+        error = L"Assembly is not loaded";
+        return false;
+    }
+    return bridge->InvokeStatic(domainId, alias, typeName, methodName, argsJson, response, error, timeoutMs, cancelId);
+}
+
+bool NM_Assembly::InvokeStatic(const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_CallBuffers& buffers, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    if (!bridge)
+    {
+        error = L"Assembly is not loaded";
+        return false;
+    }
+    return bridge->InvokeStatic(domainId, alias, typeName, methodName, argsJson, buffers, error, timeoutMs, cancelId);
+}
+
+bool NM_Assembly::InvokeStatic(const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_BufferPool::Lease& response, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    return InvokeStatic(typeName, methodName, argsJson, response.Buffers(), error, timeoutMs, cancelId);
+}
+
+
+// ---------------- NM_Instance ----------------
+
+NM_Instance::~NM_Instance()
+{
+    Release();
+}
+
+NM_Instance::NM_Instance(NM_Instance&& other) noexcept
+    : bridge(std::exchange(other.bridge, nullptr)), domainId(std::move(other.domainId)), alias(std::move(other.alias)),
+      typeName(std::move(other.typeName)), handle(std::exchange(other.handle, NM_Bridge::InstanceHandle::Invalid)), epoch(other.epoch)
+{
+}
+
+NM_Instance& NM_Instance::operator=(NM_Instance&& other) noexcept
+{
+    if (this != &other)
+    {
+        Release();
+        bridge = std::exchange(other.bridge, nullptr);
+        domainId = std::move(other.domainId);
+        alias = std::move(other.alias);
+        typeName = std::move(other.typeName);
+        handle = std::exchange(other.handle, NM_Bridge::InstanceHandle::Invalid);
+        epoch = other.epoch;
+    }
+    return *this;
+}
+
+bool NM_Instance::Invoke(const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    if (handle == NM_Bridge::InstanceHandle::Invalid)
+    {
+        error = L"Instance is released";
+        return false;
+    }
+    return bridge->InvokeInstance(domainId, alias, handle, typeName, methodName, argsJson, response, error, timeoutMs, cancelId);
+}
+
+bool NM_Instance::Invoke(const std::string& methodName, const std::string& argsJson, NM_CallBuffers& buffers, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    if (handle == NM_Bridge::InstanceHandle::Invalid)
+    {
+        error = L"Instance is released";
+        return false;
+    }
+    return bridge->InvokeInstance(domainId, alias, handle, typeName, methodName, argsJson, buffers, error, timeoutMs, cancelId);
+}
+
+bool NM_Instance::Invoke(const std::string& methodName, const std::string& argsJson, NM_BufferPool::Lease& response, std::wstring& error, int timeoutMs, uint64_t cancelId)
+{
+    return Invoke(methodName, argsJson, response.Buffers(), error, timeoutMs, cancelId);
+}
+
+bool NM_Instance::Stream(const std::string& methodName, const std::string& argsJson, int chunkRows, NM_Cursor& cursor, std::wstring& error, int timeoutMs)
+{
+    if (handle == NM_Bridge::InstanceHandle::Invalid)
+    {
+        error = L"Instance is released";
+        return false;
+    }
+
+    std::string response;
+    if (!bridge->StreamInstance(domainId, alias, handle, typeName, methodName, argsJson, chunkRows, response, error, timeoutMs)) return false;
+    return cursor.Open(*bridge, domainId, epoch, chunkRows, response, error);
+}
+
+void NM_Instance::Release()
+{
+    if (handle == NM_Bridge::InstanceHandle::Invalid) return;
+
+    bridge->QueueRelease(domainId, std::exchange(handle, NM_Bridge::InstanceHandle::Invalid), epoch);
+    bridge = nullptr;
+}
+
+
+// ---------------- NM_Cursor ----------------
+
+NM_Cursor::~NM_Cursor()
+{
+    Close();
+}
+
+NM_Cursor::NM_Cursor(NM_Cursor&& other) noexcept
+    : bridge(std::exchange(other.bridge, nullptr)), domainId(std::move(other.domainId)), epoch(other.epoch), chunkRows(other.chunkRows),
+      handle(std::exchange(other.handle, NM_Bridge::InstanceHandle::Invalid)), rows(std::move(other.rows)),
+      next(std::exchange(other.next, 0)), fetches(other.fetches)
+{
+    other.rows.clear();
+}
+
+NM_Cursor& NM_Cursor::operator=(NM_Cursor&& other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        bridge = std::exchange(other.bridge, nullptr);
+        domainId = std::move(other.domainId);
+        epoch = other.epoch;
+        chunkRows = other.chunkRows;
+        handle = std::exchange(other.handle, NM_Bridge::InstanceHandle::Invalid);
+        rows = std::move(other.rows);
+        other.rows.clear();
+        next = std::exchange(other.next, 0);
+        fetches = other.fetches;
+    }
+    return *this;
+}
+
+bool NM_Cursor::Open(NM_Bridge& owner, const std::string& domain, uint64_t domainEpoch, int chunk, const std::string& response, std::wstring& error)
+{
+    Close();
+    bridge = &owner;
+    domainId = domain;
+    epoch = domainEpoch;
+    chunkRows = chunk;
+    fetches = 1;
+    return Take(response, error);
+}
+
+// The next chunk is asked for only once this one is used up, so the server never runs ahead of
+// the reader and neither side holds more than a chunk.
+bool NM_Cursor::Next(std::string& row, std::wstring& error, int timeoutMs)
+{
+    error.clear();
+    while (next >= rows.size())
+    {
+        if (handle == NM_Bridge::InstanceHandle::Invalid) return false;
+
+        std::string response;
+        if (!bridge->ReadCursor(domainId, handle, chunkRows, response, error, timeoutMs)) return false;
+        ++fetches;
+        if (!Take(response, error)) return false;
+    }
+
+    row.swap(rows[next++]);
+    return true;
+}
+
+void NM_Cursor::Close()
+{
+    if (handle != NM_Bridge::InstanceHandle::Invalid) bridge->QueueRelease(domainId, std::exchange(handle, NM_Bridge::InstanceHandle::Invalid), epoch);
+    rows.clear();
+    next = 0;
+}
+
+// The server drops a cursor by itself once it reaches the end or fails, so only one still
+// open leaves a handle to release. Only the first reply names the cursor.
+bool NM_Cursor::Take(const std::string& response, std::wstring& error)
+{
+    json rs = json::parse(response, nullptr, false);
+    rows.clear();
+    next = 0;
+    NM_Bridge::InstanceHandle open = std::exchange(handle, NM_Bridge::InstanceHandle::Invalid);
+
+    if (!rs.is_object() || !rs.value("success", false))
+    {
+        error = ReplyError(rs);
+        return false;
+    }
+
+    if (!rs.contains("rows"))
+    {
+        rows.push_back(rs.contains("result") ? rs["result"].dump() : "null");
+        return true;
+    }
+
+    for (const auto& r : rs["rows"]) rows.push_back(r.dump());
+    if (!rs.value("done", true)) handle = rs.contains("cursor") ? static_cast<NM_Bridge::InstanceHandle>(rs["cursor"].get<uint64_t>()) : open;
+    return true;
+}
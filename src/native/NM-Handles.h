@@ -0,0 +1,137 @@
+// NM-Handles.h
+
+#pragma once
+
+#include "NM-Bridge.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class NM_Assembly;
+class NM_Instance;
+class NM_Cursor;
+
+// Move-only owners of what NM_Bridge hands out as plain ids. An NM_Domain unloads its domain
+// when destroyed; an NM_Instance queues its release (NM_Bridge::QueueRelease), so dropping
+// many instances costs one batched message rather than a round-trip each. The bridge must
+// outlive every handle made from it.
+class NM_Domain {
+
+public:
+    NM_Domain() = default;
+    ~NM_Domain();
+    NM_Domain(NM_Domain&& other) noexcept;
+    NM_Domain& operator=(NM_Domain&& other) noexcept;
+    NM_Domain(const NM_Domain&) = delete;
+    NM_Domain& operator=(const NM_Domain&) = delete;
+
+    // An empty domainId lets the server pick one.
+    static bool Create(NM_Bridge& bridge, const std::string& domainId, NM_Domain& domain, std::wstring& error, int timeoutMs = 15000);
+
+    bool LoadFromFile(const std::wstring& assemblyPath, const std::string& assemblyAlias, NM_Assembly& assembly, std::wstring& error, int timeoutMs = 15000);
+    bool LoadFromMemory(const std::vector<uint8_t>& bytes, const std::string& simpleName, NM_Assembly& assembly, std::wstring& error, int timeoutMs = 15000);
+
+    // Unloads now and reports how it went; the destructor does the same and ignores failures.
+    bool Unload(std::wstring& error, int timeoutMs = 15000);
+
+    const std::string& Id() const { return domainId; }
+    explicit operator bool() const { return bridge != nullptr; }
+
+private:
+    NM_Bridge* bridge = nullptr;
+    std::string domainId;
+};
+
+// An assembly stays loaded until its domain unloads, so this only names it. It owns nothing
+// to release, which is why, unlike the handles around it, it is copyable.
+class NM_Assembly {
+
+public:
+    NM_Assembly() = default;
+
+    bool CreateInstance(const std::string& typeName, const std::string& constructorArgsJson, NM_Instance& instance, std::wstring& error, int timeoutMs = 15000);
+    bool InvokeStatic(const std::string& typeName, const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool InvokeStatic(const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_CallBuffers& buffers, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool InvokeStatic(const std::string& typeName, const std::string& methodName, const std::string& argsJson, NM_BufferPool::Lease& response, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool StreamStatic(const std::string& typeName, const std::string& methodName, const std::string& argsJson, int chunkRows, NM_Cursor& cursor, std::wstring& error, int timeoutMs = 15000);
+
+    const std::string& Alias() const { return alias; }
+    explicit operator bool() const { return bridge != nullptr; }
+
+private:
+    friend class NM_Domain;
+
+    NM_Bridge* bridge = nullptr;
+    std::string domainId;
+    std::string alias;
+};
+
+class NM_Instance {
+
+public:
+    NM_Instance() = default;
+    ~NM_Instance();
+    NM_Instance(NM_Instance&& other) noexcept;
+    NM_Instance& operator=(NM_Instance&& other) noexcept;
+    NM_Instance(const NM_Instance&) = delete;
+    NM_Instance& operator=(const NM_Instance&) = delete;
+
+    bool Invoke(const std::string& methodName, const std::string& argsJson, std::string& response, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool Invoke(const std::string& methodName, const std::string& argsJson, NM_CallBuffers& buffers, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool Invoke(const std::string& methodName, const std::string& argsJson, NM_BufferPool::Lease& response, std::wstring& error, int timeoutMs = 15000, uint64_t cancelId = 0);
+    bool Stream(const std::string& methodName, const std::string& argsJson, int chunkRows, NM_Cursor& cursor, std::wstring& error, int timeoutMs = 15000);
+
+    // Queues the release now instead of at destruction.
+    void Release();
+
+    NM_Bridge::InstanceHandle Handle() const { return handle; }
+    explicit operator bool() const { return handle != NM_Bridge::InstanceHandle::Invalid; }
+
+private:
+    friend class NM_Assembly;
+
+    NM_Bridge* bridge = nullptr;
+    std::string domainId;
+    std::string alias;
+    std::string typeName;
+    NM_Bridge::InstanceHandle handle = NM_Bridge::InstanceHandle::Invalid;
+    uint64_t epoch = 0;             // NM_Bridge::DomainEpoch when created
+};
+
+// Rows of a streamed sequence result, fetched a chunk at a time as Next() runs out of them.
+// A result that is not a sequence reads as a single row. Closing or destroying a cursor
+// before the end queues its release, which ends the enumeration on the server.
+class NM_Cursor {
+
+public:
+    NM_Cursor() = default;
+    ~NM_Cursor();
+    NM_Cursor(NM_Cursor&& other) noexcept;
+    NM_Cursor& operator=(NM_Cursor&& other) noexcept;
+    NM_Cursor(const NM_Cursor&) = delete;
+    NM_Cursor& operator=(const NM_Cursor&) = delete;
+
+    // The next row as JSON. False at the end, with error left empty, or when a fetch failed.
+    bool Next(std::string& row, std::wstring& error, int timeoutMs = 15000);
+    void Close();
+
+    bool Done() const { return next >= rows.size() && handle == NM_Bridge::InstanceHandle::Invalid; }
+    uint64_t Fetches() const { return fetches; }
+
+private:
+    friend class NM_Assembly;
+    friend class NM_Instance;
+
+    bool Open(NM_Bridge& bridge, const std::string& domainId, uint64_t epoch, int chunkRows, const std::string& response, std::wstring& error);
+    bool Take(const std::string& response, std::wstring& error);
+
+    NM_Bridge* bridge = nullptr;
+    std::string domainId;
+    uint64_t epoch = 0;
+    int chunkRows = 0;
+    NM_Bridge::InstanceHandle handle = NM_Bridge::InstanceHandle::Invalid;
+    std::vector<std::string> rows;
+    size_t next = 0;
+    uint64_t fetches = 0;
+};
@@ -0,0 +1,216 @@
+// NM-Metrics.cpp
+
+#include "NM-Metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    int HighestBit(uint64_t v)
+    {
+#ifdef _MSC_VER
+        unsigned long index = 0;
+        _BitScanReverse64(&index, v);
+        return static_cast<int>(index);
+#else
+        return 63 - __builtin_clzll(v);
+#endif
+    }
+}
+
+
+// ---------------- NM_Histogram ----------------
+
+int NM_Histogram::BucketOf(uint64_t micros)
+{
+    if (micros < LinearLimit) return static_cast<int>(micros);
+
+    int magnitude = HighestBit(micros);
+    if (magnitude >= MaxMagnitude) return BucketCount - 1;
+
+    int sub = static_cast<int>((micros >> (magnitude - 4)) & (SubBuckets - 1));
+    return LinearLimit + (magnitude - 5) * SubBuckets + sub;
+}
+
+uint64_t NM_Histogram::UpperBoundOf(int bucket)
+{
+    if (bucket < LinearLimit) return static_cast<uint64_t>(bucket);
+
+    int magnitude = (bucket - LinearLimit) / SubBuckets + 5;
+    uint64_t sub = static_cast<uint64_t>((bucket - LinearLimit) % SubBuckets);
+    return ((SubBuckets + sub + 1) << (magnitude - 4)) - 1;
+}
+
+void NM_Histogram::Record(uint64_t micros)
+{
+    buckets[BucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(micros, std::memory_order_relaxed);
+
+    uint64_t seen = max.load(std::memory_order_relaxed);
+    while (micros > seen && !max.compare_exchange_weak(seen, micros, std::memory_order_relaxed))
+    {
+    }
+}
+
+NM_Histogram::Summary NM_Histogram::Snapshot() const
+{
+    uint64_t counts[BucketCount];
+    uint64_t total = 0;
+    for (int i = 0; i < BucketCount; ++i)
+    {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    Summary s;
+    s.count = total;
+    s.maxUs = max.load(std::memory_order_relaxed);
+    if (total == 0) return s;
+
+    s.meanUs = static_cast<double>(sum.load(std::memory_order_relaxed)) / static_cast<double>(count.load(std::memory_order_relaxed));
+
+    struct Target { double quantile; uint64_t* out; };
+    Target targets[] = { { 0.50, &s.p50Us }, { 0.90, &s.p90Us }, { 0.99, &s.p99Us }, { 0.999, &s.p999Us } };
+
+    uint64_t seen = 0;
+    int next = 0;
+    for (int i = 0; i < BucketCount && next < 4; ++i)
+    {
+        seen += counts[i];
+        while (next < 4 && seen >= (std::max)(uint64_t(1), static_cast<uint64_t>(std::ceil(targets[next].quantile * total))))
+        {
+            *targets[next].out = (std::min)(UpperBoundOf(i), s.maxUs);
+            ++next;
+        }
+    }
+    return s;
+}
+
+void NM_Histogram::Reset()
+{
+    for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+
+// ---------------- NM_Metrics ----------------
+
+NM_Metrics::NM_Metrics() {}
+
+NM_Metrics::~NM_Metrics()
+{
+    for (auto& c : commands) delete c.load();
+    for (auto& m : methods) delete m.load();
+}
+
+void NM_Metrics::SetCommandName(int command, const char* name)
+{
+    if (command >= 0 && command < MaxCommands) commandNames[command] = name;
+}
+
+void NM_Metrics::Record(int command, Phase phase, uint64_t micros)
+{
+    if (command < 0 || command >= MaxCommands) return;
+
+    Histograms* h = commands[command].load(std::memory_order_acquire);
+    if (!h)
+    {
+        Histograms* created = new Histograms();
+        if (commands[command].compare_exchange_strong(h, created, std::memory_order_acq_rel)) h = created;
+        else delete created;
+    }
+    h->phases[static_cast<int>(phase)].Record(micros);
+}
+
+void NM_Metrics::RecordMethod(const std::string& method, Phase phase, uint64_t micros)
+{
+    size_t hash = std::hash<std::string>()(method);
+    for (int probe = 0; probe < MaxMethods; ++probe)
+    {
+        auto& slot = methods[(hash + probe) % MaxMethods];
+
+        MethodSlot* s = slot.load(std::memory_order_acquire);
+        if (!s)
+        {
+            MethodSlot* created = new MethodSlot(method);
+            if (slot.compare_exchange_strong(s, created, std::memory_order_acq_rel)) s = created;
+            else delete created;
+        }
+
+        if (s->name == method)
+        {
+            s->histograms.phases[static_cast<int>(phase)].Record(micros);
+            return;
+        }
+    }
+}
+
+std::vector<NM_Metrics::Entry> NM_Metrics::SnapshotCommands() const
+{
+    std::vector<Entry> out;
+    for (int c = 0; c < MaxCommands; ++c)
+    {
+        Histograms* h = commands[c].load(std::memory_order_acquire);
+        if (!h || !commandNames[c]) continue;
+
+        Entry e;
+        e.name = commandNames[c];
+        for (int p = 0; p < static_cast<int>(Phase::Count); ++p) e.phases[p] = h->phases[p].Snapshot();
+        out.push_back(e);
+    }
+    return out;
+}
+
+std::vector<NM_Metrics::Entry> NM_Metrics::SnapshotMethods() const
+{
+    std::vector<Entry> out;
+    for (const auto& slot : methods)
+    {
+        const MethodSlot* s = slot.load(std::memory_order_acquire);
+        if (!s) continue;
+
+        Entry e;
+        e.name = s->name;
+        for (int p = 0; p < static_cast<int>(Phase::Count); ++p) e.phases[p] = s->histograms.phases[p].Snapshot();
+        out.push_back(e);
+    }
+
+    std::sort(out.begin(), out.end(), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+    return out;
+}
+
+void NM_Metrics::Reset()
+{
+    for (auto& c : commands)
+    {
+        Histograms* h = c.load(std::memory_order_acquire);
+        if (!h) continue;
+        for (auto& p : h->phases) p.Reset();
+    }
+
+    // Method slots stay allocated: a recorder may still hold a pointer to one.
+    for (auto& slot : methods)
+    {
+        MethodSlot* s = slot.load(std::memory_order_acquire);
+        if (!s) continue;
+        for (auto& h : s->histograms.phases) h.Reset();
+    }
+}
+
+const char* NM_Metrics::PhaseName(Phase phase)
+{
+    static const char* names[] = {
+        "connect", "write", "wait", "read", "parse", "total",
+        "server.queued", "server.parse", "server.lookup", "server.resolve", "server.decode", "server.invoke", "server.serialize"
+    };
+    return names[static_cast<int>(phase)];
+}
@@ -0,0 +1,102 @@
+// NM-Metrics.h
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Log-linear latency histogram (HDR style): values below 32 us get their own bucket, larger
+// values keep 5 significant bits, so any recorded value is reported within ~3% of itself.
+// Recording is a few relaxed atomic increments and never takes a lock.
+class NM_Histogram {
+
+public:
+    struct Summary
+    {
+        uint64_t count = 0;
+        double meanUs = 0;
+        uint64_t p50Us = 0;
+        uint64_t p90Us = 0;
+        uint64_t p99Us = 0;
+        uint64_t p999Us = 0;
+        uint64_t maxUs = 0;
+    };
+
+    void Record(uint64_t micros);
+    Summary Snapshot() const;
+    void Reset();
+
+private:
+    static constexpr int SubBuckets = 16;
+    static constexpr int LinearLimit = 2 * SubBuckets;
+    static constexpr int MaxMagnitude = 40;       // ~12.7 days; larger values land in the last bucket
+    static constexpr int BucketCount = LinearLimit + (MaxMagnitude - 5) * SubBuckets;
+
+    static int BucketOf(uint64_t micros);
+    static uint64_t UpperBoundOf(int bucket);
+
+    std::atomic<uint64_t> buckets[BucketCount] = {};
+    std::atomic<uint64_t> count{ 0 };
+    std::atomic<uint64_t> sum{ 0 };
+    std::atomic<uint64_t> max{ 0 };
+};
+
+
+// Per-command histograms, one per phase of a round-trip, plus optional per-method ones.
+// Server* phases come from the timing block the server appends when serverTiming is on.
+// Recording never locks: histograms are created on first use and published with a CAS.
+class NM_Metrics {
+
+public:
+    enum class Phase
+    {
+        Connect, Write, Wait, Read, Parse, Total,
+        ServerQueued, ServerParse, ServerLookup, ServerResolve, ServerDecode, ServerInvoke, ServerSerialize,
+        Count
+    };
+    static constexpr int MaxCommands = 32;
+    static constexpr int MaxMethods = 1024;     // distinct type.method keys; any beyond are not recorded
+
+    struct Entry
+    {
+        std::string name;                           // command name, or "type.method" for per-method entries
+        NM_Histogram::Summary phases[static_cast<int>(Phase::Count)];
+    };
+
+    NM_Metrics();
+    ~NM_Metrics();
+    NM_Metrics(const NM_Metrics&) = delete;
+    NM_Metrics& operator=(const NM_Metrics&) = delete;
+
+    void Record(int command, Phase phase, uint64_t micros);
+    void RecordMethod(const std::string& method, Phase phase, uint64_t micros);
+    void SetCommandName(int command, const char* name);
+
+    std::vector<Entry> SnapshotCommands() const;
+    std::vector<Entry> SnapshotMethods() const;
+    void Reset();
+
+    static const char* PhaseName(Phase phase);
+
+private:
+    struct Histograms
+    {
+        NM_Histogram phases[static_cast<int>(Phase::Count)];
+    };
+
+    struct MethodSlot
+    {
+        explicit MethodSlot(const std::string& key) : name(key) {}
+        const std::string name;
+        Histograms histograms;
+    };
+
+    // Allocated on first use, so unused commands cost one pointer.
+    std::atomic<Histograms*> commands[MaxCommands] = {};
+    const char* commandNames[MaxCommands] = {};
+
+    // Open-addressed by name hash; a slot, once claimed, belongs to that name for good.
+    std::atomic<MethodSlot*> methods[MaxMethods] = {};
+};
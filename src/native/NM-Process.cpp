@@ -0,0 +1,273 @@
+// NM-Process.cpp
+
+#include "NM-Process.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#include <cstdlib>
+#else
+#include <csignal>
+#include <cerrno>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#endif
+
+NM_Process::~NM_Process()
+{
+#ifdef _WIN32
+    if (process) CloseHandle(process);
+#endif
+}
+
+#ifdef _WIN32
+
+namespace
+{
+    std::wstring Widen(const std::string& s)
+    {
+        if (s.empty()) return {};
+        int sz = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), nullptr, 0);
+        std::wstring ws(sz, 0);
+        MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), &ws[0], sz);
+        return ws;
+    }
+
+    // Quotes one argument the way CommandLineToArgvW and the CRT split it back.
+    void AppendQuoted(std::wstring& line, const std::wstring& arg)
+    {
+        if (!line.empty()) line += L' ';
+        line += L'"';
+        size_t backslashes = 0;
+        for (wchar_t c : arg)
+        {
+            if (c == L'\\')
+            {
+                ++backslashes;
+                continue;
+            }
+            line.append(c == L'"' ? backslashes * 2 + 1 : backslashes, L'\\');
+            backslashes = 0;
+            line += c;
+        }
+        line.append(backslashes * 2, L'\\');
+        line += L'"';
+    }
+
+    HANDLE ChildJob()
+    {
+        static HANDLE job = [] {
+            HANDLE h = CreateJobObjectA(nullptr, nullptr);
+            JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {};
+            limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+            if (h) SetInformationJobObject(h, JobObjectExtendedLimitInformation, &limits, sizeof(limits));
+            return h;
+        }();
+        return job;
+    }
+
+    // This process's environment with env set on top, as a CreateProcessW block: NAME=VALUE
+    // strings sorted by name, each null-terminated, and an empty one at the end.
+    std::wstring EnvironmentBlock(const std::vector<std::pair<std::string, std::string>>& env)
+    {
+        std::vector<std::wstring> entries;
+        if (wchar_t* strings = GetEnvironmentStringsW())
+        {
+            for (const wchar_t* p = strings; *p; p += wcslen(p) + 1) entries.emplace_back(p);
+            FreeEnvironmentStringsW(strings);
+        }
+
+        for (const auto& v : env)
+        {
+            std::wstring prefix = Widen(v.first) + L"=";
+            entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const std::wstring& e) {
+                return _wcsnicmp(e.c_str(), prefix.c_str(), prefix.size()) == 0;
+            }), entries.end());
+            entries.push_back(prefix + Widen(v.second));
+        }
+        std::sort(entries.begin(), entries.end(), [](const std::wstring& a, const std::wstring& b) {
+            return _wcsicmp(a.c_str(), b.c_str()) < 0;
+        });
+
+        std::wstring block;
+        for (const auto& e : entries)
+        {
+            block += e;
+            block += L'\0';
+        }
+        block += L'\0';
+        return block;
+    }
+}
+
+bool NM_Process::Start(const std::string& path, const std::vector<std::string>& args, std::wstring& error, const std::vector<std::pair<std::string, std::string>>& env)
+{
+    std::wstring line;
+    AppendQuoted(line, Widen(path));
+    for (const auto& a : args) AppendQuoted(line, Widen(a));
+
+    std::wstring block;
+    if (!env.empty()) block = EnvironmentBlock(env);
+
+    STARTUPINFOW si = {};
+    si.cb = sizeof(si);
+    PROCESS_INFORMATION pi = {};
+    DWORD flags = CREATE_NO_WINDOW | CREATE_UNICODE_ENVIRONMENT;
+    if (!CreateProcessW(nullptr, &line[0], nullptr, nullptr, FALSE, flags, block.empty() ? nullptr : &block[0], nullptr, &si, &pi))
+    {
+        error = L"CreateProcess failed";
+        return false;
+    }
+
+    if (HANDLE job = ChildJob()) AssignProcessToJobObject(job, pi.hProcess);
+    CloseHandle(pi.hThread);
+    if (process) CloseHandle(process);
+    process = pi.hProcess;
+    pid = pi.dwProcessId;
+    return true;
+}
+
+bool NM_Process::Running()
+{
+    return process && WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+}
+
+bool NM_Process::Wait(int timeoutMs)
+{
+    return !process || WaitForSingleObject(process, (DWORD)timeoutMs) == WAIT_OBJECT_0;
+}
+
+void NM_Process::Terminate()
+{
+    if (process && Running())
+    {
+        TerminateProcess(process, 1);
+        WaitForSingleObject(process, INFINITE);
+    }
+}
+
+int NM_Process::Id() const
+{
+    return static_cast<int>(pid);
+}
+
+std::string NM_Process::TakeVariable(const char* name)
+{
+    DWORD size = GetEnvironmentVariableA(name, nullptr, 0);
+    if (size == 0) return {};
+
+    std::string value(size, '\0');
+    size = GetEnvironmentVariableA(name, &value[0], size);
+    value.resize(size);
+    SetEnvironmentVariableA(name, nullptr);
+    _putenv_s(name, "");
+    return value;
+}
+
+#else
+
+extern char** environ;
+
+bool NM_Process::Start(const std::string& path, const std::vector<std::string>& args, std::wstring& error, const std::vector<std::pair<std::string, std::string>>& env)
+{
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(path.c_str()));
+    for (const auto& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+
+    // Built before fork: only async-signal-safe calls are allowed in the child.
+    std::vector<std::string> added;
+    for (const auto& v : env) added.push_back(v.first + "=" + v.second);
+    std::vector<char*> envp;
+    for (char** e = environ; *e; ++e)
+    {
+        bool replaced = false;
+        for (const auto& v : env)
+        {
+            replaced = replaced || (std::strncmp(*e, v.first.c_str(), v.first.size()) == 0 && (*e)[v.first.size()] == '=');
+        }
+        if (!replaced) envp.push_back(*e);
+    }
+    for (auto& a : added) envp.push_back(&a[0]);
+    envp.push_back(nullptr);
+
+    pid_t parent = getpid();
+    pid_t child = fork();
+    if (child < 0)
+    {
+        error = L"fork failed";
+        return false;
+    }
+
+    if (child == 0)
+    {
+#ifdef __linux__
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != parent) _exit(127);
+#else
+        (void)parent;
+#endif
+        execve(path.c_str(), argv.data(), envp.data());
+        _exit(127);
+    }
+
+    pid = child;
+    return true;
+}
+
+bool NM_Process::Running()
+{
+    if (pid <= 0) return false;
+
+    int status = 0;
+    pid_t r = waitpid(pid, &status, WNOHANG);
+    if (r == 0) return true;
+    if (r == pid || (r < 0 && errno == ECHILD)) pid = -1;
+    return pid > 0;
+}
+
+bool NM_Process::Wait(int timeoutMs)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (Running())
+    {
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+void NM_Process::Terminate()
+{
+    if (!Running()) return;
+
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    pid = -1;
+}
+
+int NM_Process::Id() const
+{
+    return static_cast<int>(pid);
+}
+
+std::string NM_Process::TakeVariable(const char* name)
+{
+    char* value = std::getenv(name);
+    if (!value) return {};
+
+    // The string still sits in the block /proc/<pid>/environ shows, so it is wiped there too.
+    std::string taken = value;
+    std::memset(value, 0, taken.size());
+    unsetenv(name);
+    return taken;
+}
+
+#endif
@@ -0,0 +1,49 @@
+// NM-Process.h
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#endif
+
+// A child process started from a path and an argument list; used for out-of-process hosts.
+// Children do not outlive this process: on Windows they share a kill-on-close job object,
+// on Linux they get SIGKILL when the parent exits.
+class NM_Process {
+
+public:
+    NM_Process() = default;
+    ~NM_Process();
+    NM_Process(const NM_Process&) = delete;
+    NM_Process& operator=(const NM_Process&) = delete;
+
+    // env adds NAME, VALUE pairs to the child's copy of this process's environment; unlike the
+    // arguments, the environment of a process is readable only by its own user.
+    bool Start(const std::string& path, const std::vector<std::string>& args, std::wstring& error, const std::vector<std::pair<std::string, std::string>>& env = {});
+
+    // Child side: reads a variable passed through env and removes it from this process's
+    // environment, so neither it nor its own children keep it.
+    static std::string TakeVariable(const char* name);
+
+    // False once the child has exited; the exit is reaped here.
+    bool Running();
+    // Waits up to timeoutMs for the child to exit on its own.
+    bool Wait(int timeoutMs);
+    void Terminate();
+
+    int Id() const;
+
+private:
+#ifdef _WIN32
+    HANDLE process = nullptr;
+    DWORD pid = 0;
+#else
+    pid_t pid = -1;
+#endif
+};
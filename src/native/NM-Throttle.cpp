@@ -0,0 +1,67 @@
+// NM-Throttle.cpp
+
+#include "NM-Throttle.h"
+
+#include <algorithm>
+
+NM_Throttle::NM_Throttle(int limit) : maxInFlight((std::max)(0, limit))
+{
+    state.window = maxInFlight;
+}
+
+bool NM_Throttle::Acquire(Clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    if (maxInFlight > 0 && state.inFlight >= static_cast<int>(state.window))
+    {
+        ++state.throttled;
+        auto hasSlot = [this] { return state.inFlight < static_cast<int>(state.window); };
+        if (deadline == Clock::time_point::max()) freed.wait(guard, hasSlot);
+        else if (!freed.wait_until(guard, deadline, hasSlot)) return false;
+    }
+
+    ++state.inFlight;
+    state.peakInFlight = (std::max)(state.peakInFlight, state.inFlight);
+    return true;
+}
+
+void NM_Throttle::Release(Outcome outcome, int serverQueue)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        --state.inFlight;
+
+        if (serverQueue >= 0)
+        {
+            state.serverQueue = serverQueue;
+            state.serverPeakQueue = (std::max)(state.serverPeakQueue, serverQueue);
+        }
+
+        if (outcome == Outcome::Overloaded)
+        {
+            ++state.overloaded;
+            if (maxInFlight > 0) state.window = (std::max)(1.0, state.window / 2);
+        }
+        else if (outcome == Outcome::Ok && serverQueue <= 0 && maxInFlight > 0)
+        {
+            state.window = (std::min)(static_cast<double>(maxInFlight), state.window + 1.0 / state.window);
+        }
+    }
+    freed.notify_one();
+}
+
+NM_Throttle::State NM_Throttle::Snapshot() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return state;
+}
+
+void NM_Throttle::ResetPeaks()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    state.peakInFlight = state.inFlight;
+    state.serverPeakQueue = state.serverQueue;
+    state.throttled = 0;
+    state.overloaded = 0;
+}
@@ -0,0 +1,46 @@
+// NM-Throttle.h
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Client-side limit on calls in flight to one pipe. The window halves on every "Overloaded"
+// reply and grows by one per window's worth of replies while the server reports an empty queue;
+// a reply that shows a backlog holds it where it is. maxInFlight 0 only keeps the counters.
+class NM_Throttle {
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Outcome { Ok, Overloaded, Failed };
+
+    struct State
+    {
+        int inFlight = 0;
+        int peakInFlight = 0;
+        double window = 0;
+        int serverQueue = 0;        // depth reported with the latest reply
+        int serverPeakQueue = 0;
+        uint64_t throttled = 0;     // calls that had to wait for a slot
+        uint64_t overloaded = 0;    // replies rejected by the server
+    };
+
+    explicit NM_Throttle(int maxInFlight);
+
+    // Waits for a slot until deadline; false if none came free in time.
+    bool Acquire(Clock::time_point deadline);
+    // serverQueue is the depth the reply carried, or -1 when it had none.
+    void Release(Outcome outcome, int serverQueue);
+
+    State Snapshot() const;
+    void ResetPeaks();
+
+private:
+    mutable std::mutex lock;
+    std::condition_variable freed;
+    const int maxInFlight;
+    State state;
+};
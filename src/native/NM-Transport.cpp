@@ -0,0 +1,718 @@
+// NM-Transport.cpp
+
+#include "NM-Transport.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mstcpip.h>
+#include <windows.h>
+
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    int Remaining(NM_Connection::Clock::time_point deadline)
+    {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - NM_Connection::Clock::now()).count();
+        return left > 0 ? static_cast<int>(left) : 0;
+    }
+}
+
+
+#ifdef _WIN32
+
+// ---------------- Named pipe ----------------
+
+namespace
+{
+    // The handle is opened for overlapped I/O so a read can give up at the caller's deadline.
+    class PipeConnection : public NM_Connection
+    {
+    public:
+        explicit PipeConnection(HANDLE pipe) : hPipe(pipe), hEvent(CreateEventA(nullptr, TRUE, FALSE, nullptr)) {}
+
+        ~PipeConnection() override
+        {
+            CloseHandle(hEvent);
+            CloseHandle(hPipe);
+        }
+
+        bool Write(const char* data, size_t size, std::wstring& error) override
+        {
+            OVERLAPPED ov = {};
+            ov.hEvent = hEvent;
+            DWORD written = 0;
+            DWORD err = Finish(WriteFile(hPipe, data, (DWORD)size, nullptr, &ov), ov, written, Clock::time_point::max());
+            if (err != ERROR_SUCCESS)
+            {
+                closed = IsDisconnect(err);
+                error = L"WriteFile failed";
+                return false;
+            }
+            return true;
+        }
+
+        bool Read(std::string& message, int timeoutMs, std::wstring& error, Clock::time_point* firstByte) override
+        {
+            auto deadline = timeoutMs < 0 ? Clock::time_point::max() : Clock::now() + std::chrono::milliseconds(timeoutMs);
+
+            // Reads go straight into message. The first takes the room it already has; if the
+            // message is longer, the pipe says how much is left and the rest is read in one go.
+            message.resize((std::min)((std::max)(message.capacity(), MinFirstRead), MaxFirstRead));
+            size_t received = 0;
+            while (true)
+            {
+                OVERLAPPED ov = {};
+                ov.hEvent = hEvent;
+                DWORD bytesRead = 0;
+                DWORD err = Finish(ReadFile(hPipe, &message[received], (DWORD)(message.size() - received), nullptr, &ov), ov, bytesRead, deadline);
+                if (err == WAIT_TIMEOUT)
+                {
+                    message.clear();
+                    error = L"Timeout waiting for response";
+                    return false;
+                }
+
+                if (bytesRead > 0)
+                {
+                    if (received == 0 && firstByte) *firstByte = Clock::now();
+                    received += bytesRead;
+                }
+                if (err == ERROR_SUCCESS) break;
+                if (err != ERROR_MORE_DATA)
+                {
+                    closed = IsDisconnect(err);
+                    break;
+                }
+
+                DWORD left = 0;
+                if (!PeekNamedPipe(hPipe, nullptr, 0, nullptr, nullptr, &left) || left == 0) left = (DWORD)MinFirstRead;
+                message.resize(received + left);
+            }
+            message.resize(received);
+
+            if (message.empty())
+            {
+                error = L"Empty response";
+                return false;
+            }
+            return true;
+        }
+
+        void Interrupt() override
+        {
+            CancelIoEx(hPipe, nullptr);
+        }
+
+    private:
+        // A first read larger than the reply costs the zeroing of the bytes it did not use.
+        static constexpr size_t MinFirstRead = 4 * 1024;
+        static constexpr size_t MaxFirstRead = 64 * 1024;
+
+        HANDLE hPipe;
+        HANDLE hEvent;
+
+        // Completes an overlapped operation begun with ov: ERROR_SUCCESS, the error it failed with,
+        // or WAIT_TIMEOUT once it has been cancelled at the deadline.
+        DWORD Finish(BOOL started, OVERLAPPED& ov, DWORD& transferred, Clock::time_point deadline)
+        {
+            DWORD err = started ? ERROR_SUCCESS : GetLastError();
+            if (err != ERROR_SUCCESS && err != ERROR_IO_PENDING && err != ERROR_MORE_DATA) return err;
+
+            if (err == ERROR_IO_PENDING)
+            {
+                DWORD waitMs = deadline == Clock::time_point::max() ? INFINITE : (DWORD)Remaining(deadline);
+                if (WaitForSingleObject(hEvent, waitMs) != WAIT_OBJECT_0)
+                {
+                    CancelIoEx(hPipe, &ov);
+                    GetOverlappedResult(hPipe, &ov, &transferred, TRUE);
+                    return WAIT_TIMEOUT;
+                }
+            }
+            return GetOverlappedResult(hPipe, &ov, &transferred, FALSE) ? ERROR_SUCCESS : GetLastError();
+        }
+
+        static bool IsDisconnect(DWORD err)
+        {
+            return err == ERROR_BROKEN_PIPE || err == ERROR_PIPE_NOT_CONNECTED || err == ERROR_NO_DATA;
+        }
+    };
+}
+
+std::string NM_Connection::EndpointPath(const std::string& endpoint)
+{
+    return "\\\\.\\pipe\\" + endpoint;
+}
+
+namespace
+{
+    std::unique_ptr<NM_Connection> OpenPipe(const std::string& endpoint, int timeoutMs, std::wstring& error)
+    {
+        std::string pipePath = NM_Connection::EndpointPath(endpoint);
+        auto deadline = NM_Connection::Clock::now() + std::chrono::milliseconds(timeoutMs);
+        HANDLE hPipe = INVALID_HANDLE_VALUE;
+
+        while (true)
+        {
+            hPipe = CreateFileA(pipePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+            if (hPipe != INVALID_HANDLE_VALUE) break;
+
+            DWORD errc = GetLastError();
+            if (errc != ERROR_PIPE_BUSY && errc != ERROR_FILE_NOT_FOUND)
+            {
+                error = L"CreateFile pipe failed";
+                return nullptr;
+            }
+
+            if (!WaitNamedPipeA(pipePath.c_str(), 100))
+            {
+                if (Remaining(deadline) == 0)
+                {
+                    error = L"Timeout connecting to pipe";
+                    return nullptr;
+                }
+            }
+        }
+
+        DWORD mode = PIPE_READMODE_MESSAGE;
+        SetNamedPipeHandleState(hPipe, &mode, nullptr, nullptr);
+        return std::unique_ptr<NM_Connection>(new PipeConnection(hPipe));
+    }
+}
+
+#endif
+
+
+// ---------------- Sockets ----------------
+
+// Unix domain sockets and TCP share one connection class. The few calls that differ between
+// Winsock and BSD sockets are wrapped here.
+namespace
+{
+#ifdef _WIN32
+    typedef SOCKET Socket;
+    const Socket NoSocket = INVALID_SOCKET;
+    const int CloseOnExec = 0;
+    const int ShutBoth = SD_BOTH;
+
+    bool StartSockets()
+    {
+        static const bool started = [] { WSADATA data; return WSAStartup(MAKEWORD(2, 2), &data) == 0; }();
+        return started;
+    }
+
+    void CloseSocket(Socket s) { closesocket(s); }
+    int SocketError() { return WSAGetLastError(); }
+    bool Interrupted(int) { return false; }
+    bool Aborted(int err) { return err == WSAECONNRESET; }
+    bool PeerGone(int err) { return err == WSAECONNRESET || err == WSAECONNABORTED || err == WSAESHUTDOWN; }
+    bool Refused(int err) { return err == WSAECONNREFUSED; }
+    bool InProgress(int err) { return err == WSAEWOULDBLOCK; }
+    long SendSome(Socket s, const char* data, size_t size) { return send(s, data, static_cast<int>((std::min)(size, size_t(1) << 30)), 0); }
+    long RecvSome(Socket s, char* data, size_t size) { return recv(s, data, static_cast<int>((std::min)(size, size_t(1) << 30)), 0); }
+    int PollOne(Socket s, short events, int timeoutMs) { WSAPOLLFD p = { s, events, 0 }; return WSAPoll(&p, 1, timeoutMs); }
+    void SetNonBlocking(Socket s, bool on) { u_long mode = on ? 1 : 0; ioctlsocket(s, FIONBIO, &mode); }
+#else
+    typedef int Socket;
+    const Socket NoSocket = -1;
+    const int CloseOnExec = SOCK_CLOEXEC;
+    const int ShutBoth = SHUT_RDWR;
+
+    bool StartSockets() { return true; }
+    void CloseSocket(Socket s) { close(s); }
+    int SocketError() { return errno; }
+    bool Interrupted(int err) { return err == EINTR; }
+    bool Aborted(int err) { return err == ECONNABORTED; }
+    bool PeerGone(int err) { return err == EPIPE || err == ECONNRESET; }
+    bool Refused(int err) { return err == ECONNREFUSED; }
+    bool InProgress(int err) { return err == EINPROGRESS; }
+    long SendSome(Socket s, const char* data, size_t size) { return static_cast<long>(send(s, data, size, MSG_NOSIGNAL)); }
+    long RecvSome(Socket s, char* data, size_t size) { return static_cast<long>(recv(s, data, size, 0)); }
+    int PollOne(Socket s, short events, int timeoutMs) { pollfd p = { s, events, 0 }; return poll(&p, 1, timeoutMs); }
+    void SetNonBlocking(Socket s, bool on) { int flags = fcntl(s, F_GETFL, 0); fcntl(s, F_SETFL, on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK); }
+#endif
+
+    class SocketConnection : public NM_Connection
+    {
+    public:
+        SocketConnection(Socket socket, size_t maxFrameBytes) : fd(socket), maxFrameBytes(maxFrameBytes) {}
+
+        ~SocketConnection() override
+        {
+            CloseSocket(fd);
+        }
+
+        bool Write(const char* data, size_t size, std::wstring& error) override
+        {
+            if (size > 0xFFFFFFFFu)
+            {
+                error = L"Message too long for a frame";
+                return false;
+            }
+
+            char header[4] = {
+                (char)(size), (char)(size >> 8), (char)(size >> 16), (char)(size >> 24)
+            };
+
+            // Header and body in one send: sent apart, Nagle would hold the body until the peer
+            // acknowledges the header, which it delays because it is waiting for the body.
+            bool sent;
+            if (size <= CoalesceLimit)
+            {
+                frame.assign(header, sizeof(header));
+                frame.append(data, size);
+                sent = SendAll(frame.data(), frame.size());
+            }
+            else
+            {
+                sent = SendAll(header, sizeof(header)) && SendAll(data, size);
+            }
+
+            if (!sent)
+            {
+                closed = PeerGone(SocketError());
+                error = L"send failed";
+                return false;
+            }
+            return true;
+        }
+
+        bool Read(std::string& message, int timeoutMs, std::wstring& error, Clock::time_point* firstByte) override
+        {
+            auto deadline = timeoutMs < 0 ? Clock::time_point::max() : Clock::now() + std::chrono::milliseconds(timeoutMs);
+
+            unsigned char header[4];
+            if (!RecvAll(reinterpret_cast<char*>(header), sizeof(header), deadline, error)) return false;
+            if (firstByte) *firstByte = Clock::now();
+
+            // The length comes off the wire, so a garbled or hostile peer must not get to pick the
+            // allocation. The rest of the frame is left unread: the connection is no longer usable.
+            size_t size = (size_t)header[0] | ((size_t)header[1] << 8) | ((size_t)header[2] << 16) | ((size_t)header[3] << 24);
+            if (size > maxFrameBytes)
+            {
+                Drop();
+                error = L"Message of " + std::to_wstring(size) + L" bytes exceeds the frame limit";
+                return false;
+            }
+            try
+            {
+                message.resize(size);
+            }
+            catch (const std::bad_alloc&)
+            {
+                Drop();
+                error = L"Out of memory reading message";
+                return false;
+            }
+            if (size > 0 && !RecvAll(&message[0], size, deadline, error)) return false;
+
+            if (message.empty())
+            {
+                error = L"Empty response";
+                return false;
+            }
+            return true;
+        }
+
+        void Interrupt() override
+        {
+            shutdown(fd, ShutBoth);
+        }
+
+    private:
+        static const size_t CoalesceLimit = 64 * 1024;
+
+        Socket fd;
+        size_t maxFrameBytes;
+        std::string frame;
+
+        void Drop()
+        {
+            closed = true;
+            shutdown(fd, ShutBoth);
+        }
+
+        bool SendAll(const char* data, size_t size)
+        {
+            while (size > 0)
+            {
+                long n = SendSome(fd, data, size);
+                if (n < 0 && Interrupted(SocketError())) continue;
+                if (n <= 0) return false;
+                data += n;
+                size -= (size_t)n;
+            }
+            return true;
+        }
+
+        bool RecvAll(char* data, size_t size, Clock::time_point deadline, std::wstring& error)
+        {
+            while (size > 0)
+            {
+                if (deadline != Clock::time_point::max())
+                {
+                    int ready = PollOne(fd, POLLIN, Remaining(deadline));
+                    if (ready < 0 && Interrupted(SocketError())) continue;
+                    if (ready == 0)
+                    {
+                        error = L"Timeout waiting for response";
+                        return false;
+                    }
+                }
+
+                long n = RecvSome(fd, data, size);
+                int err = n < 0 ? SocketError() : 0;
+                if (n < 0 && Interrupted(err)) continue;
+                if (n <= 0)
+                {
+                    closed = n == 0 || PeerGone(err);
+                    error = closed ? L"Connection closed" : L"recv failed";
+                    return false;
+                }
+                data += n;
+                size -= (size_t)n;
+            }
+            return true;
+        }
+    };
+
+    void Tune(Socket s, const NM_TcpOptions& tcp)
+    {
+        int noDelay = tcp.noDelay ? 1 : 0;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+        if (tcp.keepAliveSec <= 0) return;
+
+        // Probes every third of the idle time, so a vanished peer is noticed within about twice of it.
+        int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, reinterpret_cast<const char*>(&on), sizeof(on));
+        int interval = (std::max)(1, tcp.keepAliveSec / 3);
+#ifdef _WIN32
+        tcp_keepalive settings = { 1, static_cast<ULONG>(tcp.keepAliveSec) * 1000, static_cast<ULONG>(interval) * 1000 };
+        DWORD returned = 0;
+        WSAIoctl(s, SIO_KEEPALIVE_VALS, &settings, sizeof(settings), nullptr, 0, &returned, nullptr, nullptr);
+#elif defined(TCP_KEEPIDLE)
+        int idle = tcp.keepAliveSec;
+        int count = 3;
+        setsockopt(s, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+        setsockopt(s, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+        setsockopt(s, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+#endif
+    }
+
+    // "tcp://host:port"; an IPv6 host goes in brackets.
+    bool SplitTcp(const std::string& endpoint, std::string& host, std::string& port)
+    {
+        std::string rest = endpoint.substr(6);
+        size_t colon = rest.rfind(':');
+        if (colon == std::string::npos || colon + 1 == rest.size()) return false;
+
+        host = rest.substr(0, colon);
+        port = rest.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+        return !host.empty();
+    }
+
+    addrinfo* Resolve(const std::string& endpoint, bool passive, std::wstring& error)
+    {
+        std::string host, port;
+        if (!StartSockets())
+        {
+            error = L"WSAStartup failed";
+            return nullptr;
+        }
+        if (!SplitTcp(endpoint, host, port))
+        {
+            error = L"Invalid tcp endpoint";
+            return nullptr;
+        }
+
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+        addrinfo* found = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0 || !found)
+        {
+            error = L"Cannot resolve host";
+            return nullptr;
+        }
+        return found;
+    }
+
+    // Non-blocking connect, so an unreachable host gives up at the deadline rather than the OS timeout.
+    Socket ConnectBefore(const addrinfo* ai, NM_Connection::Clock::time_point deadline, bool& refused)
+    {
+        Socket s = socket(ai->ai_family, ai->ai_socktype | CloseOnExec, ai->ai_protocol);
+        if (s == NoSocket) return NoSocket;
+
+        SetNonBlocking(s, true);
+        int err = connect(s, ai->ai_addr, static_cast<int>(ai->ai_addrlen)) == 0 ? 0 : SocketError();
+        if (err != 0 && InProgress(err))
+        {
+            socklen_t len = sizeof(err);
+            if (PollOne(s, POLLOUT, Remaining(deadline)) <= 0 || getsockopt(s, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&err), &len) != 0) err = -1;
+        }
+
+        if (err != 0)
+        {
+            refused = refused || Refused(err);
+            CloseSocket(s);
+            return NoSocket;
+        }
+        SetNonBlocking(s, false);
+        return s;
+    }
+
+    std::unique_ptr<NM_Connection> OpenTcp(const std::string& endpoint, int timeoutMs, const NM_TcpOptions& tcp, std::wstring& error)
+    {
+        addrinfo* found = Resolve(endpoint, false, error);
+        if (!found) return nullptr;
+
+        // Like a pipe that is not there yet, a refused connection is retried until the deadline.
+        auto deadline = NM_Connection::Clock::now() + std::chrono::milliseconds(timeoutMs);
+        Socket s = NoSocket;
+        bool refused = false;
+        while (true)
+        {
+            refused = false;
+            for (const addrinfo* ai = found; ai && s == NoSocket; ai = ai->ai_next) s = ConnectBefore(ai, deadline, refused);
+            if (s != NoSocket || !refused || Remaining(deadline) == 0) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        freeaddrinfo(found);
+
+        if (s == NoSocket)
+        {
+            error = refused || Remaining(deadline) == 0 ? L"Timeout connecting to endpoint" : L"connect failed";
+            return nullptr;
+        }
+
+        Tune(s, tcp);
+        return std::unique_ptr<NM_Connection>(new SocketConnection(s, tcp.maxFrameBytes));
+    }
+}
+
+
+#ifndef _WIN32
+
+// ---------------- Unix socket ----------------
+
+namespace
+{
+    bool MakeAddress(const std::string& path, sockaddr_un& addr)
+    {
+        if (path.size() >= sizeof(addr.sun_path)) return false;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    std::unique_ptr<NM_Connection> OpenUnix(const std::string& endpoint, int timeoutMs, size_t maxFrameBytes, std::wstring& error)
+    {
+        sockaddr_un addr;
+        if (!MakeAddress(NM_Connection::EndpointPath(endpoint), addr))
+        {
+            error = L"Endpoint path too long";
+            return nullptr;
+        }
+
+        auto deadline = NM_Connection::Clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (true)
+        {
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0)
+            {
+                error = L"socket failed";
+                return nullptr;
+            }
+
+            if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+            {
+                return std::unique_ptr<NM_Connection>(new SocketConnection(fd, maxFrameBytes));
+            }
+
+            int errc = errno;
+            close(fd);
+
+            if (errc != ENOENT && errc != ECONNREFUSED && errc != EAGAIN)
+            {
+                error = L"connect failed";
+                return nullptr;
+            }
+
+            if (Remaining(deadline) == 0)
+            {
+                error = L"Timeout connecting to endpoint";
+                return nullptr;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+}
+
+std::string NM_Connection::EndpointPath(const std::string& endpoint)
+{
+    if (endpoint.find('/') != std::string::npos) return endpoint;
+
+    const char* tmp = std::getenv("TMPDIR");
+    std::string dir = tmp && *tmp ? tmp : "/tmp";
+    if (dir.back() != '/') dir += '/';
+    return dir + endpoint + ".sock";
+}
+
+#endif
+
+std::unique_ptr<NM_Connection> NM_Connection::Open(const std::string& endpoint, int timeoutMs, std::wstring& error, const NM_TcpOptions& tcp)
+{
+    if (IsTcp(endpoint)) return OpenTcp(endpoint, timeoutMs, tcp, error);
+#ifdef _WIN32
+    return OpenPipe(endpoint, timeoutMs, error);
+#else
+    return OpenUnix(endpoint, timeoutMs, tcp.maxFrameBytes, error);
+#endif
+}
+
+bool NM_Connection::IsTcp(const std::string& endpoint)
+{
+    return endpoint.compare(0, 6, "tcp://") == 0;
+}
+
+
+// ---------------- NM_Listener ----------------
+
+NM_Listener::~NM_Listener()
+{
+    Close();
+}
+
+bool NM_Listener::Listen(const std::string& endpointName, std::wstring& error, const NM_TcpOptions& tcpOptions)
+{
+    tcp = tcpOptions;
+    isTcp = NM_Connection::IsTcp(endpointName);
+    if (isTcp) return ListenTcp(endpointName, error);
+
+#ifdef _WIN32
+    error = L"Only tcp:// endpoints are served natively on Windows";
+    return false;
+#else
+    path = NM_Connection::EndpointPath(endpointName);
+
+    sockaddr_un addr;
+    if (!MakeAddress(path, addr))
+    {
+        error = L"Endpoint path too long";
+        return false;
+    }
+
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0)
+    {
+        error = L"socket failed";
+        return false;
+    }
+
+    unlink(path.c_str());
+    if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(s, SOMAXCONN) != 0)
+    {
+        error = L"bind/listen failed";
+        close(s);
+        return false;
+    }
+
+    endpoint = endpointName;
+    fd = s;
+    return true;
+#endif
+}
+
+// Port 0 takes a free port; Endpoint() then names the one that was bound.
+bool NM_Listener::ListenTcp(const std::string& endpointName, std::wstring& error)
+{
+    addrinfo* found = Resolve(endpointName, true, error);
+    if (!found) return false;
+
+    Socket s = socket(found->ai_family, found->ai_socktype | CloseOnExec, found->ai_protocol);
+    if (s == NoSocket)
+    {
+        freeaddrinfo(found);
+        error = L"socket failed";
+        return false;
+    }
+
+#ifndef _WIN32
+    int reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+    bool bound = bind(s, found->ai_addr, static_cast<int>(found->ai_addrlen)) == 0 && listen(s, SOMAXCONN) == 0;
+    freeaddrinfo(found);
+
+    sockaddr_storage local = {};
+    socklen_t len = sizeof(local);
+    if (!bound || getsockname(s, reinterpret_cast<sockaddr*>(&local), &len) != 0)
+    {
+        error = L"bind/listen failed";
+        CloseSocket(s);
+        return false;
+    }
+
+    unsigned port = ntohs(local.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&local)->sin6_port : reinterpret_cast<sockaddr_in*>(&local)->sin_port);
+    endpoint = endpointName.substr(0, endpointName.rfind(':') + 1) + std::to_string(port);
+    fd = static_cast<intptr_t>(s);
+    return true;
+}
+
+std::unique_ptr<NM_Connection> NM_Listener::Accept()
+{
+    intptr_t s;
+    while ((s = fd.load()) != -1)
+    {
+#ifdef _WIN32
+        Socket client = accept(static_cast<Socket>(s), nullptr, nullptr);
+#else
+        Socket client = accept4(static_cast<Socket>(s), nullptr, nullptr, SOCK_CLOEXEC);
+#endif
+        if (client != NoSocket)
+        {
+            if (isTcp) Tune(client, tcp);
+            return std::unique_ptr<NM_Connection>(new SocketConnection(client, tcp.maxFrameBytes));
+        }
+
+        int err = SocketError();
+        if (!Interrupted(err) && !Aborted(err)) break;
+    }
+    return nullptr;
+}
+
+void NM_Listener::Close()
+{
+    intptr_t s = fd.exchange(-1);
+    if (s == -1) return;
+
+    // Wakes a thread blocked in Accept before the descriptor goes away.
+    shutdown(static_cast<Socket>(s), ShutBoth);
+    CloseSocket(static_cast<Socket>(s));
+#ifndef _WIN32
+    if (!isTcp) unlink(path.c_str());
+#endif
+}
@@ -0,0 +1,81 @@
+// NM-Transport.h
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Socket options for tcp:// endpoints. maxFrameBytes applies to Unix sockets as well.
+struct NM_TcpOptions
+{
+    bool noDelay = true;        // disable Nagle, so small replies are not held back
+    int keepAliveSec = 30;      // idle time before keepalive probes; 0 turns keepalive off
+    size_t maxFrameBytes = 256 * 1024 * 1024;  // a longer incoming message fails the Read and closes the connection
+};
+
+// One connection to a bridge endpoint. On Windows an endpoint is a named pipe opened in
+// message mode; elsewhere it is a Unix domain socket, and every message is framed with a
+// 4-byte little-endian length prefix so both sides still exchange whole messages.
+// "tcp://host:port" is a TCP connection on either platform, framed the same way.
+class NM_Connection {
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    virtual ~NM_Connection() = default;
+
+    // Connects to endpoint, retrying while the server is busy or not yet listening.
+    static std::unique_ptr<NM_Connection> Open(const std::string& endpoint, int timeoutMs, std::wstring& error, const NM_TcpOptions& tcp = NM_TcpOptions());
+    static bool IsTcp(const std::string& endpoint);
+
+    // "\\.\pipe\<name>" on Windows; on POSIX a name without '/' maps to <tmpdir>/<name>.sock.
+    static std::string EndpointPath(const std::string& endpoint);
+
+    virtual bool Write(const char* data, size_t size, std::wstring& error) = 0;
+
+    // Reads one whole message into message, reusing its capacity: a string kept across calls is
+    // only reallocated for a message larger than any before. firstByte, when given, receives the
+    // time the reply started arriving. A negative timeout waits indefinitely.
+    virtual bool Read(std::string& message, int timeoutMs, std::wstring& error, Clock::time_point* firstByte = nullptr) = 0;
+
+    // Unblocks a Read or Write in progress on another thread; the connection is unusable afterwards.
+    virtual void Interrupt() = 0;
+
+    // True once a Read or Write has found that the peer hung up.
+    bool Closed() const { return closed; }
+
+protected:
+    bool closed = false;
+};
+
+
+// Server side of a socket endpoint: a Unix socket (POSIX only) or tcp://host:port.
+// Used by the stand-in server and by hosts relaying TCP clients to their pipes.
+class NM_Listener {
+
+public:
+    NM_Listener() = default;
+    ~NM_Listener();
+    NM_Listener(const NM_Listener&) = delete;
+    NM_Listener& operator=(const NM_Listener&) = delete;
+
+    bool Listen(const std::string& endpoint, std::wstring& error, const NM_TcpOptions& tcp = NM_TcpOptions());
+    std::unique_ptr<NM_Connection> Accept();   // nullptr once Close() has been called
+    void Close();
+
+    // The endpoint being served; for tcp:// with port 0, the port actually bound.
+    const std::string& Endpoint() const { return endpoint; }
+
+private:
+    bool ListenTcp(const std::string& endpoint, std::wstring& error);
+
+    std::atomic<intptr_t> fd{ -1 };     // a SOCKET on Windows
+    std::string path;
+    std::string endpoint;
+    bool isTcp = false;
+    NM_TcpOptions tcp;
+};